@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Microbenchmarks of the hot functions of the package. Each benchmark
+ * is calibrated to run at least --min-time seconds, repeated
+ * --repetitions times and the median is reported in ns/op with the
+ * number of heap allocations per operation. The machine readable
+ * output is a JSON document written with --json.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AI.hpp"
+#include "BuiltinSpecies.hpp"
+#include "CropModel.hpp"
+#include "FileReader.hpp"
+#include "Forecast.hpp"
+#include "Global.hpp"
+#include "PrefetchReader.hpp"
+#include "Weather.hpp"
+
+namespace {
+
+std::atomic <unsigned long long> allocations(0);
+
+}
+
+/* The counting operator new uses malloc: gcc >= 11 can not see that
+ * the operator delete below matches it. */
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace {
+
+/* Prevent the compiler from removing the benchmarked expression. */
+template <typename T>
+void keep(const T &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct Result
+{
+    std::string name;
+    double ns_per_op;
+    double allocs_per_op;
+    unsigned long long iterations;
+};
+
+struct Runner
+{
+    double min_time;
+    int repetitions;
+    std::string filter;
+    std::vector <Result> results;
+
+    Runner()
+        : min_time(0.2), repetitions(5)
+    {}
+
+    /**
+     * Run @e function(n) which must execute n operations.
+     */
+    void run(const std::string &name,
+             std::function <void(unsigned long long)> function)
+    {
+        if (!filter.empty() && name.find(filter) == std::string::npos)
+            return;
+
+        typedef std::chrono::steady_clock clock;
+        typedef std::chrono::duration <double> seconds;
+
+        unsigned long long n = 1;
+        for (;;) {
+            auto start = clock::now();
+            function(n);
+            double elapsed = seconds(clock::now() - start).count();
+
+            if (elapsed >= min_time || n >= (1ull << 40))
+                break;
+
+            n = elapsed <= 0.0 ? n * 10 : std::max(
+                n + 1, static_cast <unsigned long long>(
+                    n * std::min(10.0, 1.2 * min_time / elapsed)));
+        }
+
+        std::vector <double> times;
+        std::vector <double> allocs;
+        for (int i = 0; i < repetitions; ++i) {
+            unsigned long long before = allocations.load();
+            auto start = clock::now();
+            function(n);
+            double elapsed = seconds(clock::now() - start).count();
+            unsigned long long after = allocations.load();
+
+            times.push_back(elapsed * 1e9 / n);
+            allocs.push_back(static_cast <double>(after - before) / n);
+        }
+
+        std::sort(times.begin(), times.end());
+        std::sort(allocs.begin(), allocs.end());
+
+        Result result { name, times[times.size() / 2],
+                allocs[allocs.size() / 2], n };
+        results.push_back(result);
+
+        std::fprintf(stderr, "%-40s %14.1f ns/op %10.2f allocs/op %12llu\n",
+                     name.c_str(), result.ns_per_op, result.allocs_per_op,
+                     result.iterations);
+    }
+
+    void write_json(std::ostream &out) const
+    {
+        out << "{\n  \"benchmarks\": [\n";
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            out << "    {\"name\": \"" << results[i].name
+                << "\", \"ns_per_op\": " << results[i].ns_per_op
+                << ", \"allocs_per_op\": " << results[i].allocs_per_op
+                << ", \"iterations\": " << results[i].iterations << "}"
+                << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+    }
+};
+
+void usage()
+{
+    std::cout <<
+        "benchmarks: microbenchmarks of the safihr.cropmodel package\n\n"
+        "  --data dir         the data directory of the package\n"
+        "  --json file        write the results in JSON\n"
+        "  --filter string    only run benchmarks whose name contains\n"
+        "                     the string\n"
+        "  --min-time s       minimal time of a measure [0.2]\n"
+        "  --repetitions n    number of measures [5]\n";
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Runner runner;
+    std::string data = SAFIHR_DATA_DIR;
+    std::string json;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+
+        if (arg == "-h" || arg == "--help" || i + 1 >= argc) {
+            usage();
+            return arg == "-h" || arg == "--help" ? EXIT_SUCCESS
+                : EXIT_FAILURE;
+        }
+
+        std::string value(argv[++i]);
+        if (arg == "--data")
+            data = value;
+        else if (arg == "--json")
+            json = value;
+        else if (arg == "--filter")
+            runner.filter = value;
+        else if (arg == "--min-time")
+            runner.min_time = safihr::stod(value);
+        else if (arg == "--repetitions")
+            runner.repetitions = std::max(1, safihr::stoi(value));
+        else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    const std::string species = data + "/CULTURES.csv";
+    const std::string weather = data + "/luneray_temp-1992-2011.csv";
+
+    try {
+        safihr::Specie ble = safihr::SpecieFileReader(species).get("BLE");
+
+        runner.run("GenericModel::compute",
+                   [&ble](unsigned long long n)
+                   {
+                       safihr::GenericModel model(2452193.0, ble, 48.48);
+                       double time = 2452193.0;
+                       for (unsigned long long i = 0; i < n; ++i) {
+                           keep(model.compute(time, 5.0 + (i % 16)));
+                           time += 1.0;
+                       }
+                   });
+
+        runner.run("GenericModel::initialize",
+                   [&ble](unsigned long long n)
+                   {
+                       for (unsigned long long i = 0; i < n; ++i) {
+                           safihr::Photoperiod photoperiod(ble, 48.48);
+                           keep(photoperiod.get(1, false));
+                       }
+                   });
+
+        safihr::WeatherSeries series;
+        safihr::read_weather(weather, series);
+        safihr::Forecast forecast(series);
+        safihr::Photoperiod photoperiod(ble, 48.48);
+
+        runner.run("Forecast::run",
+                   [&](unsigned long long n)
+                   {
+                       safihr::GenericState state;
+                       std::vector <double> maturity;
+                       for (unsigned long long i = 0; i < n; ++i) {
+                           forecast.run(ble, photoperiod, state, 2452193.0,
+                                        maturity);
+                           keep(maturity[0]);
+                       }
+                   });
+
+        runner.run("generic_sowing_days",
+                   [&](unsigned long long n)
+                   {
+                       const std::int32_t end = series.begin +
+                           static_cast <std::int32_t>(series.size());
+                       std::vector <std::int32_t> dlev(series.size());
+                       std::vector <std::int32_t> result(series.size());
+                       for (unsigned long long i = 0; i < n; ++i) {
+                           safihr::generic_sowing_days(
+                               ble, photoperiod, series.tmoy.data(),
+                               series.size(), series.begin, end,
+                               series.begin, end, dlev.data(),
+                               result.data());
+                           keep(result[0]);
+                       }
+                   });
+
+        runner.run("SpecieFileReader::get",
+                   [&species](unsigned long long n)
+                   {
+                       for (unsigned long long i = 0; i < n; ++i) {
+                           safihr::SpecieFileReader reader(species);
+                           keep(reader.get("POIS").data[0]);
+                       }
+                   });
+
+        runner.run("builtin_specie",
+                   [](unsigned long long n)
+                   {
+                       for (unsigned long long i = 0; i < n; ++i)
+                           keep(safihr::builtin_specie("POIS").data[0]);
+                   });
+
+        runner.run("FileReader::next",
+                   [&weather](unsigned long long n)
+                   {
+                       safihr::FileReader reader;
+                       reader.open(weather);
+                       for (unsigned long long i = 0; i < n; ++i) {
+                           if (!reader.next())
+                               reader.open(weather);
+                           keep(reader.m_tmoy);
+                       }
+                   });
+
+        runner.run("PrefetchReader::next",
+                   [&weather](unsigned long long n)
+                   {
+                       std::unique_ptr <safihr::PrefetchReader> reader(
+                           new safihr::PrefetchReader(weather));
+                       for (unsigned long long i = 0; i < n; ++i) {
+                           if (!reader->next())
+                               reader.reset(
+                                   new safihr::PrefetchReader(weather));
+                           keep(reader->current().tmoy);
+                       }
+                   });
+
+        runner.run("ai_convert_date",
+                   [](unsigned long long n)
+                   {
+                       for (unsigned long long i = 0; i < n; ++i)
+                           keep(safihr::ai_convert_date("15/10/2001"));
+                   });
+
+        runner.run("parse_date",
+                   [](unsigned long long n)
+                   {
+                       const char *str = "15/10/2001";
+                       std::int32_t jdn;
+                       for (unsigned long long i = 0; i < n; ++i) {
+                           keep(safihr::parse_date(str, str + 10, jdn));
+                           keep(jdn);
+                       }
+                   });
+
+        runner.run("DateCache::parse",
+                   [](unsigned long long n)
+                   {
+                       const char *str = "15/10/2001";
+                       safihr::DateCache cache;
+                       std::int32_t jdn;
+                       for (unsigned long long i = 0; i < n; ++i) {
+                           keep(cache.parse(str, str + 10, jdn));
+                           keep(jdn);
+                       }
+                   });
+
+        runner.run("safihr::stod",
+                   [](unsigned long long n)
+                   {
+                       const std::string str("12.5");
+                       for (unsigned long long i = 0; i < n; ++i)
+                           keep(safihr::stod(str));
+                   });
+    } catch (const std::exception &e) {
+        std::cerr << "benchmarks: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    if (!json.empty()) {
+        std::ofstream out(json);
+        runner.write_json(out);
+    }
+
+    return EXIT_SUCCESS;
+}
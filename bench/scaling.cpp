@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * End-to-end scaling benchmark of the compare experiment. For each
+ * size, a synthetic plan is generated, the exp/compare.vpz experiment
+ * is updated to use it and the whole DEVS simulation is run in a child
+ * process so the peak RSS of each size is measured independently. The
+ * wall time, the DEVS transitions and events counted by the models
+ * (SAFIHR_METRICS) and the peak RSS are reported per size, the machine
+ * readable output is a JSON document written with --json.
+ */
+
+#include <vle/manager/Simulation.hpp>
+#include <vle/utils/ModuleManager.hpp>
+#include <vle/value/Value.hpp>
+#include <vle/vpz/Vpz.hpp>
+#include <vle/vle.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Calendar.hpp"
+#include "CropModel.hpp"
+#include "Global.hpp"
+
+namespace {
+
+/* The first day of the luneray_temp-1992-2011.csv weather file. */
+const int weather_begin = 2448623;
+
+struct Measure
+{
+    unsigned long parcels;
+    double seconds;
+    double transitions;
+    double events;
+    double compute_seconds;
+    double parse_seconds;
+    long peak_rss_kb;
+    int status;
+};
+
+/**
+ * Write a plan of @e parcels rows sown uniformly between @e begin and
+ * @e end. The generator is seeded so a size always gets the same plan.
+ */
+void write_plan(const std::string &filepath,
+                const std::vector <std::string> &species, int begin, int end,
+                unsigned long parcels)
+{
+    std::ofstream out(filepath, std::ios::out | std::ios::trunc);
+    if (!out.is_open())
+        throw std::runtime_error("scaling: can not write " + filepath);
+
+    std::mt19937 gen(static_cast <std::mt19937::result_type>(parcels));
+    std::uniform_int_distribution <std::size_t> specie(0, species.size() - 1);
+    std::uniform_int_distribution <int> sowing(begin, end - 1);
+    std::uniform_int_distribution <int> duration(90, 330);
+    std::uniform_int_distribution <int> surface(1, 40);
+
+    out << "libelle_occup;Surface;Date-semis;Date-recolte-observee;"
+        "Date-recolte-simulee;\n";
+
+    for (unsigned long i = 0; i < parcels; ++i) {
+        const std::string &name = species[specie(gen)];
+        int surface1 = surface(gen);
+        int surface2 = surface(gen) % 10;
+        int dmin = sowing(gen);
+        int days = duration(gen);
+        int y, m, d;
+
+        out << name << ';' << surface1 << ';' << surface2 << ';';
+        safihr::gregorian_date(dmin, y, m, d);
+        out << boost::format("%02d/%02d/%04d") % d % m % y << ';';
+        safihr::gregorian_date(dmin + days, y, m, d);
+        out << boost::format("%02d/%02d/%04d") % d % m % y << ';'
+            << days << '\n';
+    }
+}
+
+/**
+ * Sum the counters of all the dynamics types from the SAFIHR_METRICS
+ * report, one JSON object per line.
+ */
+void read_metrics(const std::string &filepath, Measure &measure)
+{
+    std::ifstream file(filepath);
+    std::string line;
+
+    auto field = [&line](const char *name)
+        {
+            std::string key = std::string("\"") + name + "\": ";
+            std::string::size_type pos = line.find(key);
+
+            return pos == std::string::npos ? 0.0 :
+                std::strtod(line.c_str() + pos + key.size(), nullptr);
+        };
+
+    measure.transitions = 0.0;
+    measure.events = 0.0;
+    measure.compute_seconds = 0.0;
+    measure.parse_seconds = 0.0;
+
+    while (std::getline(file, line)) {
+        measure.transitions += field("internal_transitions")
+            + field("external_transitions");
+        measure.events += field("events");
+        measure.compute_seconds += field("compute_seconds");
+        measure.parse_seconds += field("parse_seconds");
+    }
+}
+
+/**
+ * Run the experiment in a forked process: the child writes its wall
+ * time and peak RSS into a pipe and the models write their counters
+ * into the @e metrics file.
+ */
+void run(const std::string &vpzfile, const std::string &data,
+         const std::string &plan, const std::string &output,
+         const std::string &metrics, int begin, int duration,
+         Measure &measure)
+{
+    std::remove(metrics.c_str());
+
+    int fds[2];
+    if (::pipe(fds) != 0)
+        throw std::runtime_error("scaling: can not create pipe");
+
+    pid_t pid = ::fork();
+    if (pid < 0)
+        throw std::runtime_error("scaling: can not fork");
+
+    if (pid == 0) {
+        ::close(fds[0]);
+        ::setenv("SAFIHR_METRICS", metrics.c_str(), 1);
+
+        int status = EXIT_SUCCESS;
+        double seconds = 0.0;
+
+        try {
+            vle::vpz::Vpz *vpz = new vle::vpz::Vpz(vpzfile);
+            vle::vpz::Experiment &exp = vpz->project().experiment();
+            exp.setBegin(begin);
+            exp.setDuration(duration);
+
+            vle::vpz::Condition &agent = exp.conditions().get("agent");
+            agent.setValueToPort("filename", vle::value::String(plan));
+            agent.setValueToPort("output", vle::value::String(output));
+            agent.setValueToPort("sort-output", vle::value::Boolean(false));
+            agent.del("observe-ids");
+
+            exp.conditions().get("meteo").setValueToPort(
+                "filename", vle::value::String(
+                    data + "/luneray_temp-1992-2011.csv"));
+
+            vle::utils::ModuleManager modules;
+            vle::manager::Error error;
+            vle::manager::Simulation simulation(vle::manager::LOG_NONE,
+                                                vle::manager::SIMULATION_NONE,
+                                                NULL);
+
+            auto start = std::chrono::steady_clock::now();
+            /* The manager takes the ownership of the vpz. */
+            std::unique_ptr <vle::value::Map> result(
+                simulation.run(vpz, modules, &error));
+            seconds = std::chrono::duration <double>(
+                std::chrono::steady_clock::now() - start).count();
+
+            if (error.code) {
+                std::cerr << "scaling: " << error.message << '\n';
+                status = EXIT_FAILURE;
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "scaling: " << e.what() << '\n';
+            status = EXIT_FAILURE;
+        }
+
+        struct rusage usage;
+        ::getrusage(RUSAGE_SELF, &usage);
+
+        std::ostringstream os;
+        os << status << ' ' << seconds << ' ' << usage.ru_maxrss;
+        std::string str = os.str();
+        ssize_t written = ::write(fds[1], str.data(), str.size());
+        (void)written;
+        ::close(fds[1]);
+        std::_Exit(status);
+    }
+
+    ::close(fds[1]);
+
+    std::string str;
+    char buffer[256];
+    ssize_t size;
+    while ((size = ::read(fds[0], buffer, sizeof(buffer))) > 0)
+        str.append(buffer, size);
+    ::close(fds[0]);
+
+    int wstatus = 0;
+    ::waitpid(pid, &wstatus, 0);
+
+    std::istringstream is(str);
+    measure.status = EXIT_FAILURE;
+    is >> measure.status >> measure.seconds >> measure.peak_rss_kb;
+    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != EXIT_SUCCESS)
+        measure.status = EXIT_FAILURE;
+
+    read_metrics(metrics, measure);
+    std::remove(metrics.c_str());
+}
+
+void write_json(std::ostream &out, const std::vector <Measure> &measures,
+                int years)
+{
+    out << "{\n  \"years\": " << years << ",\n  \"runs\": [\n";
+    for (std::size_t i = 0; i < measures.size(); ++i) {
+        const Measure &m = measures[i];
+        out << "    {\"parcels\": " << m.parcels
+            << ", \"seconds\": " << m.seconds
+            << ", \"transitions\": " << m.transitions
+            << ", \"transitions_per_second\": "
+            << (m.seconds > 0.0 ? m.transitions / m.seconds : 0.0)
+            << ", \"events\": " << m.events
+            << ", \"compute_seconds\": " << m.compute_seconds
+            << ", \"parse_seconds\": " << m.parse_seconds
+            << ", \"peak_rss_kb\": " << m.peak_rss_kb
+            << ", \"success\": "
+            << (m.status == EXIT_SUCCESS ? "true" : "false") << "}"
+            << (i + 1 < measures.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+std::vector <unsigned long> parse_sizes(const std::string &str)
+{
+    std::vector <unsigned long> sizes;
+    std::istringstream is(str);
+    std::string token;
+
+    while (std::getline(is, token, ','))
+        sizes.push_back(std::max(1, safihr::stoi(token)));
+
+    return sizes;
+}
+
+void usage()
+{
+    std::cout <<
+        "scaling: scaling benchmark of the compare experiment\n\n"
+        "  --vpz file         the experiment [exp/compare.vpz]\n"
+        "  --data dir         the data directory of the package\n"
+        "  --sizes n,n,...    number of parcels of each run\n"
+        "                     [1000,10000,100000,1000000]\n"
+        "  --years n          simulated years [1]\n"
+        "  --tmp dir          directory of the plans and outputs [/tmp]\n"
+        "  --json file        write the results in JSON\n";
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    std::string vpz = SAFIHR_EXP_DIR "/compare.vpz";
+    std::string data = SAFIHR_DATA_DIR;
+    std::string tmp = "/tmp";
+    std::string json;
+    std::vector <unsigned long> sizes { 1000, 10000, 100000, 1000000 };
+    int years = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+
+        if (arg == "-h" || arg == "--help" || i + 1 >= argc) {
+            usage();
+            return arg == "-h" || arg == "--help" ? EXIT_SUCCESS
+                : EXIT_FAILURE;
+        }
+
+        std::string value(argv[++i]);
+        if (arg == "--vpz")
+            vpz = value;
+        else if (arg == "--data")
+            data = value;
+        else if (arg == "--sizes")
+            sizes = parse_sizes(value);
+        else if (arg == "--years")
+            years = std::max(1, safihr::stoi(value));
+        else if (arg == "--tmp")
+            tmp = value;
+        else if (arg == "--json")
+            json = value;
+        else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    vle::Init app;
+
+    const int begin = weather_begin;
+    const int end = safihr::julian_day_number(1992 + years, 1, 1);
+    std::vector <Measure> measures;
+
+    try {
+        std::vector <std::string> species;
+        for (const auto &specie :
+                 safihr::SpecieFileReader(data + "/CULTURES.csv").get_all())
+            species.push_back(specie.name);
+
+        std::fprintf(stderr, "%10s %12s %16s %14s %16s %12s\n", "parcels",
+                     "seconds", "transitions", "transitions/s", "events",
+                     "peak RSS kB");
+
+        for (auto parcels : sizes) {
+            std::string plan = tmp + "/safihr-scaling-"
+                + std::to_string(parcels) + ".csv";
+            std::string output = tmp + "/safihr-scaling-"
+                + std::to_string(parcels) + "-outputs.csv";
+            std::string metrics = tmp + "/safihr-scaling-"
+                + std::to_string(parcels) + "-metrics.jsonl";
+
+            write_plan(plan, species, begin, end, parcels);
+
+            Measure measure;
+            measure.parcels = parcels;
+            run(vpz, data, plan, output, metrics, begin, end - begin,
+                measure);
+            measures.push_back(measure);
+
+            std::remove(plan.c_str());
+            std::remove(output.c_str());
+
+            std::fprintf(stderr, "%10lu %12.3f %16.0f %14.0f %16.0f %12ld%s\n",
+                         parcels, measure.seconds, measure.transitions,
+                         measure.seconds > 0.0 ?
+                         measure.transitions / measure.seconds : 0.0,
+                         measure.events, measure.peak_rss_kb,
+                         measure.status == EXIT_SUCCESS ? "" : " (failed)");
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "scaling: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    if (!json.empty()) {
+        std::ofstream out(json);
+        write_json(out, measures, years);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -25,12 +25,12 @@
 #ifndef SAFIHR_MODEL_AI_HPP
 #define SAFIHR_MODEL_AI_HPP
 
-#include <boost/date_time.hpp>
-#include <boost/numeric/conversion/cast.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <cstdint>
 #include <exception>
-#include <vle/utils/i18n.hpp>
-#include <vle/utils/DateTime.hpp>
+#include <string>
+#include "Calendar.hpp"
 #include "Global.hpp"
 
 namespace safihr {
@@ -39,60 +39,59 @@ struct ai_open_failure : std::runtime_error
 {
     explicit ai_open_failure(const std::string &filepath)
         : std::runtime_error(
-            (vle::fmt("AI: can not open `%1%'") % filepath).str())
+            (boost::format("AI: can not open `%1%'") % filepath).str())
     {}
 };
 
 struct ai_format_failure : std::runtime_error
 {
-    explicit ai_format_failure(uint line)
+    explicit ai_format_failure(unsigned int line)
         : std::runtime_error(
-            (vle::fmt("AI: fail to read line `%1%'") % line).str())
+            (boost::format("AI: fail to read line `%1%'") % line).str())
+    {}
+};
+
+struct ai_date_failure : std::runtime_error
+{
+    explicit ai_date_failure(const std::string &date)
+        : std::runtime_error(
+            (boost::format("AI: `%1%' is not a valid date") % date).str())
     {}
 };
 
 struct ai_internal_failure : std::runtime_error
 {
-    explicit ai_internal_failure(vle::devs::Time first, vle::devs::Time second)
+    explicit ai_internal_failure(double first, double second)
         : std::runtime_error(
-            (vle::fmt("AI: simulation begin at `%1%', AI data at `%2%'") % first
+            (boost::format("AI: simulation begin at `%1%', AI data at `%2%'") % first
              % second).str())
     {}
 
-    explicit ai_internal_failure(vle::devs::Time first, vle::devs::Time second,
-                                 vle::devs::Time duration)
+    explicit ai_internal_failure(double first, double second,
+                                 double duration)
         : std::runtime_error(
-            (vle::fmt("AI: `%1%' - `%2%' != `%3%'") % first % second %
+            (boost::format("AI: `%1%' - `%2%' != `%3%'") % first % second %
              duration).str())
     {}
 };
 
 
 /**
- * Convert a date into julian day date in vle::devs::Time
- * type. @attention The date must be in format: "dd/mm/yy".
+ * Convert a date into julian day date (see parse_date).
  *
- * @param date A data in the format "dd/mm/yy".
+ * @param date A date in the format "dd/mm/yyyy" or "yyyy-mm-dd".
  *
  * @return A julian day date.
+ * @throw ai_date_failure if @e date is not a valid date.
  */
-inline vle::devs::Time ai_convert_date(std::string date)
+inline double ai_convert_date(const std::string &date)
 {
-    namespace ba = boost::algorithm;
-
-    ba::split_iterator <std::string::iterator> i, e;
-    i = ba::make_split_iterator(date,
-                                ba::token_finder(
-                                    ba::is_any_of("/"),
-                                    ba::token_compress_on));
-
-    int day = safihr::stoi(boost::copy_range <std::string>(*i++));
-    int month = safihr::stoi(boost::copy_range <std::string>(*i++));
-    int year = safihr::stoi(boost::copy_range <std::string>(*i++));
+    std::int32_t jdn;
 
-    boost::gregorian::date d(year, month, day);
+    if (!parse_date(date.c_str(), date.c_str() + date.size(), jdn))
+        throw ai_date_failure(date);
 
-    return boost::numeric_cast <vle::devs::Time>(d.julian_day());
+    return static_cast <double>(jdn);
 }
 
 }
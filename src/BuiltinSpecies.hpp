@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SAFIHR_MODEL_BUILTINSPECIES_HPP
+#define SAFIHR_MODEL_BUILTINSPECIES_HPP
+
+#include <string>
+#include <vector>
+#include "CropModel.hpp"
+#include "Hash.hpp"
+#include "SpecieTable.hpp"
+
+namespace safihr {
+
+/*
+ * The species of data/CULTURES.csv compiled into the package: the
+ * SpecieTable.hpp header is generated at build time by
+ * safihr-speciegen. The names are found with a perfect hash, no file
+ * is read.
+ */
+
+namespace details {
+
+constexpr bool builtin_equal(const char *lhs, const char *rhs)
+{
+    return *lhs == *rhs && (*lhs == '\0' || builtin_equal(lhs + 1, rhs + 1));
+}
+
+constexpr int builtin_check(int index, const char *name)
+{
+    return index >= 0 && builtin_equal(specie_table::names[index], name) ?
+        index : -1;
+}
+
+}
+
+/** Index of the built-in specie @e name, -1 if unknown. */
+constexpr int builtin_specie_index(const char *name)
+{
+    return details::builtin_check(
+        specie_table::index[string_hash(name, specie_table::seed) >>
+                            specie_table::shift], name);
+}
+
+/** A parameter of a built-in specie, a constant expression. */
+constexpr double builtin_parameter(int specie, Specie::DataId parameter)
+{
+    return specie_table::data[specie][parameter];
+}
+
+inline Specie builtin_specie(int index)
+{
+    Specie specie(specie_table::names[index]);
+
+    for (std::size_t i = 0; i != specie_table::parameters; ++i)
+        specie.data[i] = specie_table::data[index][i];
+
+    return specie;
+}
+
+/**
+ * The built-in specie @e name.
+ *
+ * @throw crop_model_unknown_specie if @e name is not built-in.
+ */
+inline Specie builtin_specie(const std::string &name)
+{
+    int index = builtin_specie_index(name.c_str());
+    if (index < 0)
+        throw crop_model_unknown_specie(name);
+
+    return builtin_specie(index);
+}
+
+/** All the built-in species, in the order of the file. */
+inline std::vector <Specie> builtin_species()
+{
+    std::vector <Specie> species;
+
+    for (std::size_t i = 0; i != specie_table::size; ++i)
+        species.push_back(builtin_specie(static_cast <int>(i)));
+
+    return species;
+}
+
+}
+
+#endif
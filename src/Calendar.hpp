@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef SAFIHR_MODEL_CALENDAR_HPP
+#define SAFIHR_MODEL_CALENDAR_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "Hash.hpp"
+
+namespace safihr {
+
+/**
+ * Convert a gregorian date into a julian day number (the same number
+ * as boost::gregorian::date::julian_day()).
+ */
+inline std::int32_t julian_day_number(int year, int month, int day)
+{
+    const int a = (14 - month) / 12;
+    const int y = year + 4800 - a;
+    const int m = month + 12 * a - 3;
+
+    return day + (153 * m + 2) / 5 + 365 * y + y / 4 - y / 100 + y / 400
+        - 32045;
+}
+
+/**
+ * Convert a julian day number into a gregorian date.
+ */
+inline void gregorian_date(std::int32_t jdn, int &year, int &month, int &day)
+{
+    const int a = jdn + 32044;
+    const int b = (4 * a + 3) / 146097;
+    const int c = a - (146097 * b) / 4;
+    const int d = (4 * c + 3) / 1461;
+    const int e = c - (1461 * d) / 4;
+    const int m = (5 * e + 2) / 153;
+
+    day = e - (153 * m + 2) / 5 + 1;
+    month = m + 3 - 12 * (m / 10);
+    year = 100 * b + d - 4800 + (m / 10);
+}
+
+inline bool is_leap_year(int year)
+{
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+inline int days_in_month(int year, int month)
+{
+    static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30,
+                                31 };
+
+    return (month == 2 && is_leap_year(year)) ? 29 : days[month - 1];
+}
+
+/**
+ * true if the year of the julian day number @e jdn is a leap year.
+ */
+inline bool is_leap_year_of(std::int32_t jdn)
+{
+    int year, month, day;
+    gregorian_date(jdn, year, month, day);
+
+    return is_leap_year(year);
+}
+
+/**
+ * Day of the year (1 to 366) of a julian day number.
+ */
+inline int day_of_year(std::int32_t jdn, bool &leap)
+{
+    int year, month, day;
+    gregorian_date(jdn, year, month, day);
+
+    leap = is_leap_year(year);
+    return jdn - julian_day_number(year, 1, 1) + 1;
+}
+
+/* Read one to @e width digits. */
+inline bool date_number(const char *&str, const char *last, int width,
+                        int &value)
+{
+    const char *first = str;
+
+    value = 0;
+    while (str != last && str - first < width && *str >= '0' && *str <= '9')
+        value = value * 10 + (*str++ - '0');
+
+    return str != first;
+}
+
+/**
+ * true if the date exists and is in the range of boost::gregorian::date
+ * (1400-01-01 to 9999-12-31).
+ */
+inline bool is_valid_date(int year, int month, int day)
+{
+    return year >= 1400 && year <= 9999 && month >= 1 && month <= 12 &&
+        day >= 1 && day <= days_in_month(year, month);
+}
+
+/**
+ * Parse a `dd/mm/yyyy' or an ISO `yyyy-mm-dd' date into a julian day
+ * number. Days and months have one or two digits, years four digits.
+ *
+ * @return false if the string is not a valid date.
+ */
+inline bool parse_date(const char *first, const char *last,
+                       std::int32_t &jdn)
+{
+    int year, month, day;
+
+    if (last - first > 4 && first[4] == '-') {
+        if (!date_number(first, last, 4, year) || first == last ||
+            *first++ != '-' || !date_number(first, last, 2, month) ||
+            first == last || *first++ != '-' ||
+            !date_number(first, last, 2, day))
+            return false;
+    } else {
+        if (!date_number(first, last, 2, day) || first == last ||
+            *first++ != '/' || !date_number(first, last, 2, month) ||
+            first == last || *first++ != '/' ||
+            !date_number(first, last, 4, year))
+            return false;
+    }
+
+    if (first != last || !is_valid_date(year, month, day))
+        return false;
+
+    jdn = julian_day_number(year, month, day);
+    return true;
+}
+
+/**
+ * A memo of parse_date for the files which repeat a few dates on many
+ * lines, like the sowing plans: a direct mapped table of the last
+ * dates parsed, indexed by a hash of the string. Invalid dates are not
+ * kept.
+ */
+class DateCache
+{
+public:
+    DateCache()
+    {
+        for (auto &entry : m_entries)
+            entry.size = 0;
+    }
+
+    bool parse(const char *first, const char *last, std::int32_t &jdn)
+    {
+        const std::size_t size = static_cast <std::size_t>(last - first);
+        if (size == 0 || size > max_size)
+            return parse_date(first, last, jdn);
+
+        Entry &entry = m_entries[
+            Hash().update(first, size).value() >> (64 - slot_bits)];
+
+        if (entry.size == size && !std::memcmp(entry.str, first, size)) {
+            jdn = entry.jdn;
+            return true;
+        }
+
+        if (!parse_date(first, last, jdn))
+            return false;
+
+        std::memcpy(entry.str, first, size);
+        entry.size = static_cast <unsigned char>(size);
+        entry.jdn = jdn;
+        return true;
+    }
+
+private:
+    static constexpr int slot_bits = 8;
+    static constexpr std::size_t max_size = 11;
+
+    struct Entry
+    {
+        char str[max_size];
+        unsigned char size;
+        std::int32_t jdn;
+    };
+
+    Entry m_entries[1 << slot_bits];
+};
+
+/**
+ * Format a julian day number like boost::gregorian::to_simple_string
+ * (`2002-Aug-05'). Negative numbers are unknown dates and are written
+ * `+infinity' like boost does for the -1 day number.
+ */
+inline std::string format_date(std::int32_t jdn)
+{
+    static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                    "Jul", "Aug", "Sep", "Oct", "Nov",
+                                    "Dec" };
+
+    if (jdn < 0)
+        return "+infinity";
+
+    int year, month, day;
+    gregorian_date(jdn, year, month, day);
+
+    char buffer[16];
+    buffer[0] = '0' + (year / 1000) % 10;
+    buffer[1] = '0' + (year / 100) % 10;
+    buffer[2] = '0' + (year / 10) % 10;
+    buffer[3] = '0' + year % 10;
+    buffer[4] = '-';
+    buffer[5] = months[month - 1][0];
+    buffer[6] = months[month - 1][1];
+    buffer[7] = months[month - 1][2];
+    buffer[8] = '-';
+    buffer[9] = '0' + day / 10;
+    buffer[10] = '0' + day % 10;
+
+    return std::string(buffer, 11);
+}
+
+/**
+ * Format a day stored as a double, like the day of emergence of the
+ * models: infinite, NaN and negative days are unknown dates.
+ */
+inline std::string format_date(double day)
+{
+    if (!(day >= 0.0 && day <= INT32_MAX))
+        return "+infinity";
+
+    return format_date(static_cast <std::int32_t>(day));
+}
+
+}
+
+#endif
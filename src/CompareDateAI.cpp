@@ -24,154 +24,189 @@
 
 #include <vle/devs/Executive.hpp>
 #include <vle/devs/ExecutiveDbg.hpp>
+#include <vle/utils/i18n.hpp>
 #include <vle/utils/Package.hpp>
-#include <vle/utils/Trace.hpp>
 #include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <utility>
 #include <vector>
 #include "AI.hpp"
 #include "Global.hpp"
+#include "Metrics.hpp"
+#include "ObservationPolicy.hpp"
+#include "PhenologyAggregates.hpp"
+#include "Plan.hpp"
+#include "ResultWriter.hpp"
+#include "Shard.hpp"
+#include "Trace.hpp"
 
 namespace safihr {
 
-struct data
-{
-    data(unsigned int id,
-         const std::string& name,
-         double surface1,
-         double surface2,
-         vle::devs::Time dlev,
-         vle::devs::Time dmin,
-         vle::devs::Time dmax,
-         vle::devs::Time duration)
-        : id(id), name(name), surface1(surface1), surface2(surface2),
-        dlev(dlev), dmin(dmin), dmax(dmax), duration(duration), result(-1.0)
-    {
-#ifndef DNDEBUG
-        if ((dmax - dmin) != duration)
-            throw ai_internal_failure(dmax, dmin, duration);
-#endif
-    }
+namespace {
 
-    unsigned int id;
-    std::string name;
-    double surface1;
-    double surface2;
-    vle::devs::Time dlev;
-    vle::devs::Time dmin;
-    vle::devs::Time dmax;
-    vle::devs::Time duration;
-    vle::devs::Time result;
-};
+Metrics metrics("CompareDateAI");
 
-std::ostream& operator<<(std::ostream& out, const data& d)
-{
-    return out << vle::fmt("%1%;%2%;%3%;%4%;%5%;%6%;%7%") % d.id % d.name %
-        vle::utils::DateTime::toJulianDayNumber(d.dmin) %
-        vle::utils::DateTime::toJulianDayNumber(d.dlev) %
-        vle::utils::DateTime::toJulianDayNumber(d.dmax) %
-        vle::utils::DateTime::toJulianDayNumber(d.result) %
-        (d.dmax - d.result);
-}
-
-std::ostream& operator<<(std::ostream& out, const std::vector <data> &d)
-{
-    out << "id_parcelle;libelle_occup;Date-semis;Date-Lev;Date-recolte-observee;"
-        "Date-recolte-simulee;distance\n";
-
-    std::copy(d.begin(), d.end(),
-              std::ostream_iterator <data>(out, "\n"));
-
-    return out;
 }
 
 class CompareDateAI : public vle::devs::Executive
 {
-    std::vector <data> date;
+    PlanTable plan;
+    std::vector <std::int32_t> dlev;   /* per row, -1 if unknown. */
+    std::vector <std::int32_t> result; /* per row, -1 if not harvested. */
+    std::vector <std::uint32_t> position; /* row of the parcel id. */
+    PhenologyAggregates phenology; /* parcel i is the row i. */
+    std::unique_ptr <ResultWriter> writer;
+    std::string output_filepath;
+    ObservationPolicy observation_policy;
+    std::string observable;
+    bool sort_output;
     vle::devs::Time current_time;
     size_t index;
 
-    void initialize_date(const std::string &filename)
+    vle::devs::Time dmin_at(size_t i) const
     {
-        std::ifstream file(filename);
-        if (!file.is_open())
-            throw ai_open_failure(filename);
-
-        file.imbue(std::locale::classic());
-
-        std::string line;
-        std::getline(file, line); /* read the header and forget it*/
-
-        uint i = 0;
-        while (file) {
-            if (!std::getline(file, line))
-                break;
-
-            try {
-                boost::algorithm::split_iterator <std::string::iterator> i, e;
-                i = make_split_iterator(
-                    line,
-                    token_finder(
-                        boost::algorithm::is_any_of(";"),
-                        boost::algorithm::token_compress_on));
-
-                std::string name = boost::copy_range <std::string>(*i++);
-                std::string sur1 = boost::copy_range <std::string>(*i++);
-                std::string sur2 = boost::copy_range <std::string>(*i++);
-                std::string dmin = boost::copy_range <std::string>(*i++);
-                std::string dmax = boost::copy_range <std::string>(*i++);
-                std::string dura = boost::copy_range <std::string>(*i++);
-
-                date.emplace_back(date.size(), name, safihr::stod(sur1),
-                                  safihr::stod(sur2), vle::devs::infinity,
-                                  ai_convert_date(dmin), ai_convert_date(dmax),
-                                  safihr::stod(dura));
-            } catch (const std::exception &e) {
-                (void)e;
-                throw ai_format_failure(i);
-            }
-            i++;
+        return static_cast <vle::devs::Time>(plan.dmin[plan.order[i]]);
+    }
+
+    /* Index in the order column of the first row sown after @e time. */
+    size_t next_index(size_t from, vle::devs::Time time) const
+    {
+        while (from < plan.order.size() && dmin_at(from) <= time)
+            ++from;
+
+        return from;
+    }
+
+    /**
+     * Read the observation policy from the `observable',
+     * `observe-ids', `observe-file', `observe-species',
+     * `observe-fraction' and `observe-seed' ports.
+     */
+    void initialize_observation(const vle::utils::Package &package,
+                                const vle::devs::InitEventList &evts)
+    {
+        if (evts.exist("observable"))
+            observable = evts.getString("observable");
+
+        if (evts.exist("observe-ids")) {
+            const vle::value::Set &ids = evts.getSet("observe-ids");
+            for (size_t i = 0, e = ids.size(); i != e; ++i)
+                observation_policy.add_id(ids.getInt(i));
+        }
+
+        if (evts.exist("observe-file"))
+            observation_policy.add_ids_from_file(
+                data_filepath(package, evts.getString("observe-file")));
+
+        if (evts.exist("observe-species")) {
+            const vle::value::Set &species = evts.getSet("observe-species");
+            for (size_t i = 0, e = species.size(); i != e; ++i)
+                observation_policy.add_specie(species.getString(i));
         }
+
+        if (evts.exist("observe-fraction"))
+            observation_policy.set_sample(
+                evts.getDouble("observe-fraction"),
+                evts.exist("observe-seed") ? evts.getInt("observe-seed") : 0);
     }
 
 public:
     CompareDateAI(const vle::devs::ExecutiveInit &init,
                   const vle::devs::InitEventList &evts)
-        : vle::devs::Executive(init, evts)
+        : vle::devs::Executive(init, evts),
+        output_filepath("simulation-outputs.csv"), observable("udev-tdev"),
+        sort_output(true)
     {
         vle::utils::Package package("safihr.cropmodel");
 
-        initialize_date(package.getDataFile(evts.getString("filename")));
+        if (evts.exist("output"))
+            output_filepath = evts.getString("output");
+
+        if (evts.exist("sort-output"))
+            sort_output = evts.getBoolean("sort-output");
+
+        initialize_observation(package, evts);
+
+        try {
+            Metrics::Scope scope(metrics, Metrics::parse);
+            read_plan(data_filepath(package, evts.getString("filename")),
+                      plan, evts.exist("threads") ? evts.getInt("threads") : 0);
+        } catch (const plan_open_failure&) {
+            throw ai_open_failure(evts.getString("filename"));
+        }
+
+        /* A shard simulates a part of the plan and writes its own
+         * result file, sorted to be merged by safihr-shard. The `shard'
+         * condition is `i/K', or `environment' to take the shard of
+         * SAFIHR_SHARD (set by safihr-shard). */
+        PlanShard shard;
+        if (evts.exist("shard")) {
+            shard = shard_option(evts.getString("shard"));
+        } else if (std::getenv("SAFIHR_SHARD")) {
+            std::cerr << "CompareDateAI: SAFIHR_SHARD is ignored without "
+                "a `shard' condition set to `environment'\n";
+        }
 
-        std::sort(date.begin(), date.end(),
-                  [] (const data& lhs,
-                      const data& rhs)
-                  {
-                      return lhs.dmin < rhs.dmin;
-                  });
+        if (shard.enabled()) {
+            std::cerr << "CompareDateAI: shard " << shard.index << '/'
+                      << shard.count << '\n';
 
-        DTraceModel(vle::fmt("AI need to build: %1% models") % date.size());
-        DTraceModel(vle::fmt("Table: %1%") % date);
+            PlanTable rows;
+            select_shard(plan, shard, rows);
+            plan = std::move(rows);
+
+            output_filepath = shard_filepath(output_filepath, shard);
+            sort_output = true;
+        }
+
+        dlev.assign(plan.size(), -1);
+        result.assign(plan.size(), -1);
+
+        std::uint32_t max_id = 0;
+        for (auto id : plan.id)
+            max_id = std::max(max_id, id);
+
+        position.assign(plan.size() ? max_id + 1 : 0, 0);
+        for (size_t row = 0, e = plan.size(); row != e; ++row)
+            position[plan.id[row]] = static_cast <std::uint32_t>(row);
+
+        /* Same specie ids as the plan. */
+        for (size_t id = 0, e = plan.species.size(); id != e; ++id)
+            phenology.add_specie(
+                plan.species.name(static_cast <std::uint16_t>(id)));
+
+        phenology.reserve(plan.size());
+        for (size_t row = 0, e = plan.size(); row != e; ++row)
+            phenology.add_parcel(plan.specie[row], plan.dmin[row]);
+
+        metrics.attach();
     }
 
     virtual ~CompareDateAI()
     {
+        metrics.detach();
     }
 
     virtual void finish()
     {
-        /* sort data vector with data.id member to restore input file format. */
-        std::sort(date.begin(), date.end(),
-                  [](const data& lhs, const data& rhs)
-                  {
-                      return lhs.id < rhs.id;
-                  });
-
-        std::ofstream result("simulation-outputs.csv");
-        if (result.is_open())
-            result << std::setprecision(std::numeric_limits <double>::digits10)
-                   << std::boolalpha
-                   << date
-                   << std::endl;
+        trace_flush();
+
+        if (!writer)
+            return;
+
+        /* Matured parcels are already written, append the others. */
+        for (size_t row = 0, e = plan.size(); row != e; ++row)
+            if (result[row] == -1)
+                writer->push(PlanResult{plan, row, dlev[row], result[row]});
+
+        writer->close();
+        writer.reset();
+
+        /* Restore the input file order with an external merge. */
+        if (sort_output)
+            sort_result_file(output_filepath);
     }
 
     virtual vle::devs::Time init(const vle::devs::Time &time)
@@ -179,49 +214,40 @@ public:
         current_time = time;
         index = 0;
 
-        if (time > date.front().dmin)
-            throw ai_internal_failure(time, date.front().dmin);
-
-        static std::vector <unsigned int> to_show({267, 268, 270, 271, 714,
-                                                  715, 718, 729, 730, 731,
-                                                  732, 733, 734});
-
-        std::for_each(date.begin(), date.end(),
-                      [=] (const data& d)
-                      {
-                      std::string modelname = std::to_string(d.id);
-                      if (std::binary_search(to_show.begin(), to_show.end(),
-                                             d.id)) {
-                      createModel(modelname,
-                                  {"in", "start"},
-                                  {"out"},
-                                  "dyncrop",
-                                  {"species"},
-                                  "udev-tdev");
-                      } else {
-                      createModel(modelname,
-                                  {"in", "start"},
-                                  {"out"},
-                                  "dyncrop",
-                                  {"species"},
-                                  "");
-                      }
-
-                      addConnection("agent", "start", modelname, "start");
-                      addConnection(modelname, "out", "agent", "in");
-                      addConnection("meteo", "out", modelname, "in");
-                      });
-
-        DTraceModel(vle::fmt("CompareDateAI init at %1%") % (date.front().dmin -
-                                                             time));
-
-        return date.front().dmin - time;
+        trace(TraceEvent::ai_built, 0, time, plan.size());
+
+        if (plan.size() != 0 && time > dmin_at(0))
+            throw ai_internal_failure(time, dmin_at(0));
+
+        /* An empty plan, or shard, still writes the header. */
+        writer.reset(new ResultWriter(output_filepath, plan_result_header));
+
+        if (plan.size() == 0)
+            return vle::devs::infinity;
+
+        for (auto row : plan.order) {
+            std::string modelname = std::to_string(plan.id[row]);
+            createModel(modelname,
+                        {"in", "start"},
+                        {"out"},
+                        "dyncrop",
+                        {"species"},
+                        observation_policy.observe(plan.id[row],
+                                                   plan.specie_name(row)) ?
+                        observable : std::string());
+
+            addConnection("agent", "start", modelname, "start");
+            addConnection(modelname, "out", "agent", "in");
+            addConnection("meteo", "out", modelname, "in");
+        }
+
+        return dmin_at(0) - time;
     }
 
     virtual vle::devs::Time timeAdvance() const
     {
-        if (!date.empty() && index < date.size())
-            return (*(date.begin() + index)).dmin - current_time;
+        if (index < plan.order.size())
+            return dmin_at(index) - current_time;
         else
             return vle::devs::infinity;
     }
@@ -229,54 +255,37 @@ public:
     virtual void output(const vle::devs::Time &time,
                         vle::devs::ExternalEventList &output) const
     {
-        (void)time;
+        if (index >= plan.order.size())
+            return;
 
-        DTraceModel(vle::fmt("CompareDateAI: output at %1%") % time);
+        size_t last = next_index(index, dmin_at(index));
 
-        if (date.empty() || index >= date.size())
-            return;
+        trace(TraceEvent::ai_start, 0, time, last - index, index);
+
+        for (size_t i = index; i != last; ++i) {
+            std::uint32_t row = plan.order[i];
+            vle::devs::ExternalEvent *ret =
+                new vle::devs::ExternalEvent("start");
+            ret->putAttribute("specie_name",
+                              new vle::value::String(plan.specie_name(row)));
+            ret->putAttribute("landunit_id",
+                              new vle::value::Integer(plan.id[row]));
+            output.push_back(ret);
+        }
 
-        auto low = std::lower_bound(date.begin() + index, date.end(),
-                                    (*(date.begin() + index)).dmin,
-                                    [] (const data& d, vle::devs::Time value)
-                                    {
-                                        return d.dmin <= value;
-                                    });
-
-        DTraceModel(vle::fmt("CompareDateAI: need to send %1% start message"
-                             " (%2%)") % (std::distance(date.begin() + index,
-                                                       low)) % index);
-
-        std::for_each(date.begin() + index, low,
-                      [&output] (const data& d)
-                      {
-                          vle::devs::ExternalEvent *ret =
-                              new vle::devs::ExternalEvent("start");
-                          ret->putAttribute("specie_name",
-                                            new vle::value::String(
-                                                d.name));
-                          ret->putAttribute("landunit_id",
-                                            new vle::value::Integer(
-                                                d.id));
-                          output.push_back(ret);
-                      });
+        metrics.events(last - index);
     }
 
     virtual void internalTransition(const vle::devs::Time &time)
     {
         current_time = time;
+        metrics.internal_transition();
 
-        if (!date.empty() && index < date.size()) {
-            auto low = std::lower_bound(date.begin() + index, date.end(),
-                                        current_time,
-                                        [] (const data& d, vle::devs::Time value)
-                                        {
-                                            return d.dmin <= value;
-                                        });
-
-            index += std::distance(date.begin() + index, low);
-            DTraceModel(vle::fmt("%1% internalTransition index=%2%") %
-                        getModelName() % index);
+        if (index < plan.order.size()) {
+            size_t last = next_index(index, current_time);
+            for (; index != last; ++index)
+                phenology.sow(plan.order[index],
+                              static_cast <std::int32_t>(time));
         }
     }
 
@@ -284,6 +293,7 @@ public:
                                     const vle::devs::Time &time)
     {
         current_time = time;
+        metrics.external_transition();
 
         for (auto &msg : msgs) {
             unsigned int landid =
@@ -291,17 +301,17 @@ public:
             std::string status = msg->attributes().getString("status");
             double day_lev = msg->attributes().getDouble("day_lev");
 
-            if (status == "maturity") {
-                auto it = std::find_if(date.begin(), date.end(),
-                                       [time, landid](const data& d)
-                                       {
-                                           return d.id == landid;
-                                       });
+            if (landid >= position.size())
+                continue;
 
-                it->dlev = day_lev;
+            std::uint32_t row = position[landid];
+            phenology.update(row, status_model(status), day_lev, time);
 
-                if (it != date.end() && it->result == -1)
-                    it->result = time;
+            if (status == "maturity" && result[row] == -1) {
+                dlev[row] = static_cast <std::int32_t>(day_lev);
+                result[row] = static_cast <std::int32_t>(time);
+                trace(TraceEvent::ai_maturity, landid, time, day_lev);
+                writer->push(PlanResult{plan, row, dlev[row], result[row]});
             }
         }
     }
@@ -309,6 +319,19 @@ public:
     virtual vle::value::Value * observation(
         const vle::devs::ObservationEvent &event) const
     {
+        metrics.observation();
+
+        std::vector <double> values;
+        if (phenology.observe(event.getPortName(), values)) {
+            if (values.size() == 1)
+                return new vle::value::Double(values.front());
+
+            vle::value::Tuple *ret = new vle::value::Tuple();
+            for (double value : values)
+                ret->add(value);
+            return ret;
+        }
+
         return vle::devs::Dynamics::observation(event);
     }
 };
@@ -0,0 +1,565 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <thread>
+#include <unordered_map>
+#include "Calendar.hpp"
+#include "CropEngine.hpp"
+#include "Hash.hpp"
+#include "SharedCache.hpp"
+
+namespace safihr {
+
+CropEngine::CropEngine(const std::vector <Specie> &species, double latitude)
+    : m_species(species), m_latitude(latitude)
+{
+    for (const auto &specie : m_species)
+        m_photoperiods.emplace_back(make_photoperiod(specie, latitude));
+}
+
+int CropEngine::find(const std::string &name) const
+{
+    if (name == "LIN")
+        return -1;
+
+    for (std::size_t i = 0, e = m_species.size(); i != e; ++i)
+        if (m_species[i].name == name)
+            return static_cast <int>(i);
+
+    throw crop_model_unknown_specie(name);
+}
+
+bool CropEngine::simulate(int specie, std::int32_t sowing,
+                          const double *tmoy, std::size_t size,
+                          std::int32_t begin, std::int32_t end,
+                          std::int32_t &dlev, std::int32_t &result,
+                          bool compact) const
+{
+    dlev = -1;
+    result = -1;
+
+    /* The crop model computes the day t with the temperature sent by
+     * the Meteo model at t - 1, the record t - 2 - begin. */
+    auto temperature = [tmoy, size, begin](std::int32_t t) -> double
+        {
+            std::int32_t i = t - 2 - begin;
+            return (i >= 0 && static_cast <std::size_t>(i) < size) ?
+                tmoy[i] : 0.0;
+        };
+
+    if (specie < 0) {
+        LinModel model;
+
+        for (std::int32_t t = sowing + 1; t + 1 <= end; ++t) {
+            if (model.compute(t, temperature(t)) == StatusModel::maturity) {
+                dlev = static_cast <std::int32_t>(model.day_lev);
+                result = t + 1;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    const Specie &sp = m_species[specie];
+    const Photoperiod &photoperiod = *m_photoperiods[specie];
+    GenericState state;
+    CompactGenericState compact_state;
+    const std::int32_t origin = sowing + 1;
+
+    bool leap;
+    int day = day_of_year(sowing + 1, leap);
+
+    for (std::int32_t t = sowing + 1; t + 1 <= end; ++t) {
+        StatusModel status = compact ?
+            generic_compute(sp, photoperiod, compact_state, origin, t,
+                            temperature(t), day, leap) :
+            generic_compute(sp, photoperiod, state, t, temperature(t), day,
+                            leap);
+
+        if (status == StatusModel::maturity) {
+            dlev = static_cast <std::int32_t>(
+                compact ? compact_state.day_lev(origin) : state.day_lev);
+            result = t + 1;
+            return true;
+        }
+
+        if (++day > (leap ? 366 : 365)) {
+            day = 1;
+            leap = is_leap_year_of(t + 1);
+        }
+    }
+
+    return false;
+}
+
+namespace {
+
+template <typename Function>
+void parallel_for(std::size_t size, unsigned threads, Function function)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast <unsigned>(
+        std::max <std::size_t>(1u, std::min <std::size_t>(
+                threads, size / 1024)));
+
+    if (threads == 1) {
+        function(0, size);
+        return;
+    }
+
+    std::vector <std::thread> workers;
+    std::vector <std::exception_ptr> errors(threads);
+    for (unsigned i = 0; i < threads; ++i) {
+        std::size_t first = size * i / threads;
+        std::size_t last = size * (i + 1) / threads;
+
+        workers.emplace_back([&function, &errors, i, first, last]()
+                             {
+                                 try {
+                                     function(first, last);
+                                 } catch (...) {
+                                     errors[i] = std::current_exception();
+                                 }
+                             });
+    }
+
+    for (auto &worker : workers)
+        worker.join();
+
+    for (auto &error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+}
+
+std::uint64_t CropEngine::scenario_hash(const ScenarioKey &key,
+                                        std::uint64_t weather_hash,
+                                        std::int32_t begin) const
+{
+    /* Change the version when the kernel results change. */
+    const std::uint32_t kernel_version = 1;
+    /* Change the version when the fields of the key change. */
+    const std::uint32_t key_version = 2;
+
+    Hash hash;
+    hash.update(kernel_version).update(key_version);
+
+    if (key.specie < 0) {
+        hash.update(std::string("LIN"));
+    } else {
+        const Specie &specie = m_species[key.specie];
+        hash.update(&specie.data[0], specie.data.size() * sizeof(double));
+    }
+
+    /* The results are absolute days and the kernel depends on the
+     * calendar: the sowing day and the day of the first weather record
+     * are both part of the key. */
+    return hash.update(key.latitude)
+        .update(weather_hash)
+        .update(begin)
+        .update(key.sowing)
+        .value();
+}
+
+void CropEngine::group(const PlanTable &plan, std::uint32_t station,
+                       std::int32_t begin, bool memoize,
+                       std::vector <ScenarioKey> &keys,
+                       std::vector <std::uint32_t> &scenario) const
+{
+    std::vector <int> species;
+    for (std::size_t i = 0, e = plan.species.size(); i != e; ++i)
+        species.push_back(find(plan.species.name(
+                    static_cast <std::uint16_t>(i))));
+
+    for (auto sowing : plan.dmin)
+        if (sowing < begin)
+            throw crop_model_failure(
+                (boost::format("Crop engine: sowing at `%1%' before the"
+                               " begin of the simulation `%2%'")
+                 % sowing % begin).str());
+
+    keys.clear();
+    scenario.resize(plan.size());
+
+    if (memoize) {
+        std::unordered_map <ScenarioKey, std::uint32_t, ScenarioKeyHash> ids;
+        ids.reserve(std::min <std::size_t>(plan.size(), 1u << 16));
+
+        for (std::size_t row = 0, e = plan.size(); row != e; ++row) {
+            ScenarioKey key { species[plan.specie[row]], plan.dmin[row],
+                    m_latitude, station };
+
+            auto it = ids.emplace(key, static_cast <std::uint32_t>(
+                    keys.size()));
+            if (it.second)
+                keys.push_back(key);
+
+            scenario[row] = it.first->second;
+        }
+    } else {
+        keys.reserve(plan.size());
+        for (std::size_t row = 0, e = plan.size(); row != e; ++row) {
+            keys.push_back(ScenarioKey { species[plan.specie[row]],
+                        plan.dmin[row], m_latitude, station });
+            scenario[row] = static_cast <std::uint32_t>(row);
+        }
+    }
+}
+
+void CropEngine::run(const PlanTable &plan, const WeatherSeries &weather,
+                     std::int32_t begin, std::int32_t end, EngineResult &out,
+                     const EngineOptions &options) const
+{
+    if (options.store && options.compact)
+        throw crop_model_failure("Crop engine: the result store only keeps"
+                                 " the results of the double state");
+
+    std::vector <ScenarioKey> keys;
+    std::vector <std::uint32_t> scenario;
+    group(plan, weather.station, begin, options.memoize, keys, scenario);
+
+    end = std::min(end, begin + static_cast <std::int32_t>(weather.size()));
+
+    std::vector <std::int32_t> dlev(keys.size()), result(keys.size());
+    std::vector <std::uint32_t> todo;
+    std::vector <std::uint64_t> hashes;
+    out.stored = 0;
+
+    if (options.store) {
+        const std::uint64_t weather_hash = weather.content_hash();
+
+        hashes.resize(keys.size());
+        for (std::size_t i = 0, e = keys.size(); i != e; ++i) {
+            ResultStore::Entry entry;
+            hashes[i] = scenario_hash(keys[i], weather_hash, begin);
+
+            /* The store only keeps matured scenarios: a maturity after
+             * the end of this simulation is not reached. */
+            if (options.store->find(hashes[i], entry)) {
+                ++out.stored;
+                dlev[i] = entry.result < end ? entry.dlev : -1;
+                result[i] = entry.result < end ? entry.result : -1;
+            } else {
+                todo.push_back(static_cast <std::uint32_t>(i));
+            }
+        }
+    } else {
+        todo.resize(keys.size());
+        for (std::size_t i = 0, e = keys.size(); i != e; ++i)
+            todo[i] = static_cast <std::uint32_t>(i);
+    }
+
+    parallel_for(todo.size(), options.threads,
+                 [&](std::size_t first, std::size_t last)
+                 {
+                     for (std::size_t j = first; j != last; ++j) {
+                         std::uint32_t i = todo[j];
+                         simulate(keys[i].specie, keys[i].sowing,
+                                  weather.tmoy.data(), weather.size(),
+                                  begin, end, dlev[i], result[i],
+                                  options.compact);
+                     }
+                 });
+
+    if (options.store) {
+        for (auto i : todo)
+            if (result[i] != -1)
+                options.store->insert(hashes[i],
+                                      ResultStore::Entry { dlev[i],
+                                              result[i] });
+
+        options.store->flush();
+    }
+
+    out.dlev.resize(plan.size());
+    out.result.resize(plan.size());
+    for (std::size_t row = 0, e = plan.size(); row != e; ++row) {
+        out.dlev[row] = dlev[scenario[row]];
+        out.result[row] = result[scenario[row]];
+    }
+
+    out.scenarios = keys.size();
+}
+
+void CropEngine::validate_compact(const PlanTable &plan,
+                                  const WeatherSeries &weather,
+                                  std::int32_t begin, std::int32_t end,
+                                  std::size_t sample, PrecisionReport &out,
+                                  unsigned threads) const
+{
+    std::vector <ScenarioKey> keys;
+    std::vector <std::uint32_t> scenario;
+    group(plan, weather.station, begin, true, keys, scenario);
+
+    end = std::min(end, begin + static_cast <std::int32_t>(weather.size()));
+
+    const std::size_t n = std::min(sample, keys.size());
+    std::vector <std::int32_t> dlev(2 * n), result(2 * n);
+
+    parallel_for(n, threads,
+                 [&](std::size_t first, std::size_t last)
+                 {
+                     for (std::size_t j = first; j != last; ++j) {
+                         const ScenarioKey &key = keys[j * keys.size() / n];
+                         for (int compact = 0; compact != 2; ++compact)
+                             simulate(key.specie, key.sowing,
+                                      weather.tmoy.data(), weather.size(),
+                                      begin, end, dlev[2 * j + compact],
+                                      result[2 * j + compact], compact);
+                     }
+                 });
+
+    out = PrecisionReport();
+    out.scenarios = n;
+
+    for (std::size_t j = 0; j != n; ++j) {
+        const std::int32_t *d = &dlev[2 * j];
+        const std::int32_t *r = &result[2 * j];
+
+        if (d[0] == d[1] && r[0] == r[1])
+            continue;
+
+        ++out.differ;
+
+        if ((d[0] == -1) != (d[1] == -1) || (r[0] == -1) != (r[1] == -1)) {
+            ++out.unmatched;
+            continue;
+        }
+
+        out.max_dlev_deviation = std::max(out.max_dlev_deviation,
+                                          std::abs(d[0] - d[1]));
+        out.max_result_deviation = std::max(out.max_result_deviation,
+                                            std::abs(r[0] - r[1]));
+    }
+}
+
+void CropEngine::run(const PlanTable &plan, const WeatherEnsemble &weather,
+                     std::int32_t begin, std::int32_t end,
+                     EnsembleResult &out, const EngineOptions &options) const
+{
+    std::vector <ScenarioKey> keys;
+    group(plan, 0, begin, options.memoize, keys, out.scenario);
+
+    end = std::min(end, begin + static_cast <std::int32_t>(weather.size()));
+
+    const std::size_t members = weather.members;
+    out.members = members;
+    out.scenarios = keys.size();
+    out.dlev.assign(keys.size() * members, -1);
+    out.result.assign(keys.size() * members, -1);
+
+    parallel_for(keys.size(), options.threads,
+                 [&](std::size_t first, std::size_t last)
+                 {
+                     for (std::size_t i = first; i != last; ++i)
+                         simulate(keys[i].specie, keys[i].sowing, weather,
+                                  begin, end, &out.dlev[i * members],
+                                  &out.result[i * members]);
+                 });
+}
+
+void CropEngine::simulate(int specie, std::int32_t sowing,
+                          const WeatherEnsemble &weather, std::int32_t begin,
+                          std::int32_t end, std::int32_t *dlev,
+                          std::int32_t *result) const
+{
+    const std::size_t members = weather.members;
+    const std::vector <double> zero(members, 0.0);
+
+    std::fill(dlev, dlev + members, -1);
+    std::fill(result, result + members, -1);
+
+    /* The K temperatures computed at day t, see simulate(). */
+    auto temperatures = [&weather, &zero, begin](std::int32_t t)
+        -> const double*
+        {
+            std::int32_t i = t - 2 - begin;
+            return (i >= 0 && static_cast <std::size_t>(i) < weather.size()) ?
+                weather.record(i) : zero.data();
+        };
+
+    if (specie < 0) {
+        std::vector <LinModel> models(members);
+        std::size_t matured = 0;
+
+        for (std::int32_t t = sowing + 1; t + 1 <= end && matured < members;
+             ++t) {
+            const double *tmoy = temperatures(t);
+            for (std::size_t k = 0; k != members; ++k) {
+                if (result[k] == -1 && models[k].compute(t, tmoy[k]) ==
+                    StatusModel::maturity) {
+                    dlev[k] = static_cast <std::int32_t>(models[k].day_lev);
+                    result[k] = t + 1;
+                    ++matured;
+                }
+            }
+        }
+
+        return;
+    }
+
+    const Specie &sp = m_species[specie];
+    const Photoperiod &photoperiod = *m_photoperiods[specie];
+    GenericLanes lanes(members, GenericState());
+
+    bool leap;
+    int day = day_of_year(sowing + 1, leap);
+
+    for (std::int32_t t = sowing + 1; t + 1 <= end; ++t) {
+        generic_compute_lanes(sp, photoperiod, lanes, t, temperatures(t),
+                              day, leap);
+
+        if ((t & 15) == 0 && lanes.matured())
+            break;
+
+        if (++day > (leap ? 366 : 365)) {
+            day = 1;
+            leap = is_leap_year_of(t + 1);
+        }
+    }
+
+    for (std::size_t k = 0; k != members; ++k) {
+        if (lanes.maturity[k] != infinity) {
+            dlev[k] = static_cast <std::int32_t>(lanes.day_lev[k]);
+            result[k] = static_cast <std::int32_t>(lanes.maturity[k]) + 1;
+        }
+    }
+}
+
+void CropEngine::sowing_table(const WeatherSeries &weather,
+                              std::int32_t begin, std::int32_t end,
+                              SowingTable &out, unsigned threads) const
+{
+    out.first = begin;
+    out.days = weather.size();
+    out.species.clear();
+    for (const auto &specie : m_species)
+        out.species.push_back(specie.name);
+
+    out.dlev.assign(m_species.size() * out.days, -1);
+    out.result.assign(m_species.size() * out.days, -1);
+
+    /* A task computes a year of sowing days of a specie. The tasks
+     * are taken in order by the workers, the first years (the longest
+     * to compute) first. */
+    const std::size_t year = 365;
+    const std::size_t chunks = (out.days + year - 1) / year;
+    const std::size_t tasks = chunks * m_species.size();
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast <unsigned>(
+        std::max <std::size_t>(1u, std::min <std::size_t>(threads, tasks)));
+
+    std::atomic <std::size_t> next(0);
+    auto work = [this, &weather, begin, end, &out, &next, tasks, year]()
+        {
+            for (std::size_t task = next++; task < tasks; task = next++) {
+                const std::size_t specie = task % m_species.size();
+                const std::size_t first = (task / m_species.size()) * year;
+                const std::size_t last = std::min(out.days, first + year);
+                const std::size_t offset = specie * out.days + first;
+
+                /* LIN is simulated by the LinModel, as in run. */
+                if (find(m_species[specie].name) < 0) {
+                    for (std::size_t day = first; day != last; ++day)
+                        simulate(-1, begin + static_cast <std::int32_t>(day),
+                                 weather.tmoy.data(), weather.size(), begin,
+                                 end, out.dlev[offset + day - first],
+                                 out.result[offset + day - first]);
+                    continue;
+                }
+
+                generic_sowing_days(
+                    m_species[specie], *m_photoperiods[specie],
+                    weather.tmoy.data(), weather.size(), begin, end,
+                    begin + static_cast <std::int32_t>(first),
+                    begin + static_cast <std::int32_t>(last),
+                    &out.dlev[offset], &out.result[offset]);
+            }
+        };
+
+    if (threads == 1) {
+        work();
+        return;
+    }
+
+    std::vector <std::thread> workers;
+    std::vector <std::exception_ptr> errors(threads);
+    for (unsigned i = 0; i < threads; ++i)
+        workers.emplace_back([&work, &errors, i]()
+                             {
+                                 try {
+                                     work();
+                                 } catch (...) {
+                                     errors[i] = std::current_exception();
+                                 }
+                             });
+
+    for (auto &worker : workers)
+        worker.join();
+
+    for (auto &error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+MemberStatistics::MemberStatistics(const std::int32_t *result,
+                                   std::size_t members)
+    : matured(0), min(-1.0), max(-1.0), mean(-1.0), stddev(0.0)
+{
+    double m2 = 0.0;
+
+    for (std::size_t k = 0; k != members; ++k) {
+        if (result[k] < 0)
+            continue;
+
+        const double day = result[k];
+        if (matured++ == 0) {
+            min = max = mean = day;
+            continue;
+        }
+
+        min = std::min(min, day);
+        max = std::max(max, day);
+
+        const double delta = day - mean;
+        mean += delta / matured;
+        m2 += delta * (day - mean);
+    }
+
+    if (matured > 1)
+        stddev = std::sqrt(m2 / matured);
+}
+
+}
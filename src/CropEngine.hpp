@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef SAFIHR_MODEL_CROPENGINE_HPP
+#define SAFIHR_MODEL_CROPENGINE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CropModel.hpp"
+#include "Plan.hpp"
+#include "ResultStore.hpp"
+#include "Weather.hpp"
+
+namespace safihr {
+
+/**
+ * The simulated emergence and maturity days of each plan row, -1 if
+ * not reached before the end of the simulation.
+ */
+struct EngineResult
+{
+    std::vector <std::int32_t> dlev;
+    std::vector <std::int32_t> result;
+    std::size_t scenarios; /* number of distinct scenarios. */
+    std::size_t stored; /* number of scenarios read from the store. */
+
+    EngineResult()
+        : scenarios(0), stored(0)
+    {}
+};
+
+/**
+ * The simulated emergence and maturity days of each member of each
+ * scenario of an ensemble run, -1 if not reached. The member @e k of
+ * the scenario @e s is at s * members + k and scenario[row] is the
+ * scenario of a plan row.
+ */
+struct EnsembleResult
+{
+    std::vector <std::uint32_t> scenario;
+    std::vector <std::int32_t> dlev;
+    std::vector <std::int32_t> result;
+    std::size_t members;
+    std::size_t scenarios;
+
+    EnsembleResult()
+        : members(0), scenarios(0)
+    {}
+
+    const std::int32_t* row_dlev(std::size_t row) const
+    {
+        return &dlev[scenario[row] * members];
+    }
+
+    const std::int32_t* row_result(std::size_t row) const
+    {
+        return &result[scenario[row] * members];
+    }
+};
+
+/**
+ * Statistics of the maturity days of the members of a scenario: the
+ * number of members reaching the maturity and the minimum, maximum,
+ * mean and standard deviation of their maturity days.
+ */
+struct MemberStatistics
+{
+    std::size_t matured;
+    double min;
+    double max;
+    double mean;
+    double stddev;
+
+    MemberStatistics(const std::int32_t *result, std::size_t members);
+};
+
+struct EngineOptions
+{
+    unsigned threads; /* 0 to use the number of hardware threads. */
+    bool memoize; /* false to simulate each row. */
+    bool compact; /* use the CompactGenericState. */
+    ResultStore *store; /* consulted before and updated after a run. */
+
+    EngineOptions()
+        : threads(0), memoize(true), compact(false), store(nullptr)
+    {}
+};
+
+/**
+ * Differences between the double and the compact states on a sample
+ * of scenarios: the number of scenarios with another emergence or
+ * maturity day, with a maturity reached by only one of the states and
+ * the maximal deviations in days.
+ */
+struct PrecisionReport
+{
+    std::size_t scenarios;
+    std::size_t differ;
+    std::size_t unmatched;
+    std::int32_t max_dlev_deviation;
+    std::int32_t max_result_deviation;
+
+    PrecisionReport()
+        : scenarios(0), differ(0), unmatched(0), max_dlev_deviation(0),
+        max_result_deviation(0)
+    {}
+};
+
+/**
+ * The emergence and maturity days of a sowing at each day of
+ * [first, first + days) for each specie of the catalog, -1 if not
+ * reached. The sowing day @e k of the specie @e s is at s * days + k.
+ */
+struct SowingTable
+{
+    std::int32_t first;
+    std::size_t days;
+    std::vector <std::string> species;
+    std::vector <std::int32_t> dlev;
+    std::vector <std::int32_t> result;
+
+    SowingTable()
+        : first(0), days(0)
+    {}
+};
+
+/**
+ * Parcels with the same specie, sowing day, latitude and weather
+ * station have the same trajectory: the engine simulates each distinct
+ * key once.
+ */
+struct ScenarioKey
+{
+    int specie;
+    std::int32_t sowing;
+    double latitude;
+    std::uint32_t station;
+
+    bool operator==(const ScenarioKey &other) const
+    {
+        return specie == other.specie && sowing == other.sowing &&
+            latitude == other.latitude && station == other.station;
+    }
+};
+
+struct ScenarioKeyHash
+{
+    std::size_t operator()(const ScenarioKey &key) const
+    {
+        std::size_t seed = std::hash <int>()(key.specie);
+        seed ^= std::hash <std::int32_t>()(key.sowing) + 0x9e3779b9 +
+            (seed << 6) + (seed >> 2);
+        seed ^= std::hash <double>()(key.latitude) + 0x9e3779b9 +
+            (seed << 6) + (seed >> 2);
+        seed ^= std::hash <std::uint32_t>()(key.station) + 0x9e3779b9 +
+            (seed << 6) + (seed >> 2);
+        return seed;
+    }
+};
+
+/**
+ * Simulate a sowing plan without the DEVS kernel. The engine reproduces
+ * the timing of the CompareDateAI, Meteo and GenericCropModel models:
+ * the Meteo model sends the record @e i at day begin + i + 1, a parcel
+ * sown at day @e s computes its first day at s + 1 and the AI model
+ * receives the maturity the day after the crop model reaches it.
+ */
+class CropEngine
+{
+public:
+    /**
+     * @param species The specie catalog.
+     * @param latitude The latitude of the parcels.
+     */
+    CropEngine(const std::vector <Specie> &species, double latitude);
+
+    /**
+     * Simulate all the rows of @e plan. Rows are grouped by
+     * ScenarioKey, each group is simulated once and its result is
+     * copied to all the rows of the group. If a ResultStore is
+     * provided, matured scenarios already in the store are not
+     * simulated and new ones are added.
+     *
+     * @param begin The julian day of the first weather record.
+     * @param end The julian day of the end of the simulation.
+     */
+    void run(const PlanTable &plan, const WeatherSeries &weather,
+             std::int32_t begin, std::int32_t end, EngineResult &out,
+             const EngineOptions &options = EngineOptions()) const;
+
+    /**
+     * Simulate all the rows of @e plan under each member of
+     * @e weather, the members of a scenario are computed together.
+     * The ResultStore of the options is not used.
+     */
+    void run(const PlanTable &plan, const WeatherEnsemble &weather,
+             std::int32_t begin, std::int32_t end, EnsembleResult &out,
+             const EngineOptions &options = EngineOptions()) const;
+
+    /**
+     * Simulate at most @e sample scenarios of @e plan, evenly spaced,
+     * with both states and compare the results.
+     */
+    void validate_compact(const PlanTable &plan,
+                          const WeatherSeries &weather, std::int32_t begin,
+                          std::int32_t end, std::size_t sample,
+                          PrecisionReport &out, unsigned threads = 0) const;
+
+    /**
+     * Compute the emergence and maturity days of a sowing at each day
+     * of [begin, begin + weather.size()) for each specie of the
+     * catalog (see generic_sowing_days; LIN is simulated day by day
+     * with the LinModel). The species and the years of sowing days are
+     * computed in parallel.
+     */
+    void sowing_table(const WeatherSeries &weather, std::int32_t begin,
+                      std::int32_t end, SowingTable &out,
+                      unsigned threads = 0) const;
+
+    /**
+     * The store key of a scenario: a hash of the specie parameters,
+     * the latitude, the weather content, the day of the first weather
+     * record and the sowing day.
+     */
+    std::uint64_t scenario_hash(const ScenarioKey &key,
+                                std::uint64_t weather_hash,
+                                std::int32_t begin) const;
+
+    /**
+     * Simulate a sowing of the specie @e specie (an index in the
+     * specie catalog or -1 for the LIN model) at day @e sowing.
+     *
+     * @param compact true to use the CompactGenericState.
+     *
+     * @return true if the maturity is reached before @e end.
+     */
+    bool simulate(int specie, std::int32_t sowing, const double *tmoy,
+                  std::size_t size, std::int32_t begin, std::int32_t end,
+                  std::int32_t &dlev, std::int32_t &result,
+                  bool compact = false) const;
+
+    /**
+     * Simulate a sowing under each member of @e weather. @e dlev and
+     * @e result receive a value per member.
+     */
+    void simulate(int specie, std::int32_t sowing,
+                  const WeatherEnsemble &weather, std::int32_t begin,
+                  std::int32_t end, std::int32_t *dlev,
+                  std::int32_t *result) const;
+
+    /**
+     * Index of the specie @e name in the catalog, -1 for the LIN model.
+     */
+    int find(const std::string &name) const;
+
+    const std::vector <Specie>& species() const
+    {
+        return m_species;
+    }
+
+    double latitude() const
+    {
+        return m_latitude;
+    }
+
+private:
+    /**
+     * Check the sowing days of @e plan and group its rows by
+     * ScenarioKey (or one scenario per row without @e memoize).
+     */
+    void group(const PlanTable &plan, std::uint32_t station,
+               std::int32_t begin, bool memoize,
+               std::vector <ScenarioKey> &keys,
+               std::vector <std::uint32_t> &scenario) const;
+
+    std::vector <Specie> m_species;
+    std::vector <std::shared_ptr <const Photoperiod> > m_photoperiods;
+    double m_latitude;
+};
+
+}
+
+#endif
@@ -0,0 +1,585 @@
+/*
+ * Copyright (C) 2013-2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include "Calendar.hpp"
+#include "CropModel.hpp"
+
+namespace safihr {
+
+std::ostream& operator<<(std::ostream& out, const Specie& specie)
+{
+    std::streamsize sz = out.precision(); /* keep the old precision
+                                           * value to restore it at
+                                           * the end of the stream.
+                                           */
+
+    return out << std::setprecision(std::numeric_limits <double>::digits10)
+               << "NAME " << specie.name
+               << " LEV_AMF " << specie.data[Specie::LEV_AMF]
+               << " AMF_LAX " << specie.data[Specie::AMF_LAX]
+               << " SEM_LEV " << specie.data[Specie::SEM_LEV]
+               << " LEV_MAT " << specie.data[Specie::LEV_MAT]
+               << " TBASE " << specie.data[Specie::TBASE]
+               << " TMAXDEV " << specie.data[Specie::TMAXDEV]
+               << " PBASE " << specie.data[Specie::PBASE]
+               << " POPT " << specie.data[Specie::POPT]
+               << " TFROID " << specie.data[Specie::TFROID]
+               << " AMPFROID " << specie.data[Specie::AMPFROID]
+               << " VBASE " << specie.data[Specie::VBASE]
+               << " VSAT " << specie.data[Specie::VSAT]
+               << " ADENS " << specie.data[Specie::ADENS]
+               << " CROIRAC " << specie.data[Specie::CROIRAC]
+               << " BDENS " << specie.data[Specie::BDENS]
+               << " LAICOMP " << specie.data[Specie::LAICOMP]
+               << " TCOUVMAX " << specie.data[Specie::TCOUVMAX]
+               << " PENTECOUVMAX " << specie.data[Specie::PENTECOUVMAX]
+               << " INFRECOUV " << specie.data[Specie::INFRECOUV]
+               << " HMAX " << specie.data[Specie::HMAX]
+               << " HBASE " << specie.data[Specie::HBASE]
+               << " GRAINES_REC " << specie.data[Specie::GRAINES_REC]
+               << "\n"
+               << std::setprecision(sz);
+}
+
+namespace {
+
+bool read_specie_line(const std::string &line, Specie &specie)
+{
+    std::vector <std::string> result;
+    boost::algorithm::split(result, line,
+                            boost::algorithm::is_any_of(";"),
+                            boost::algorithm::token_compress_on);
+
+    if (result.empty() || result.size() < specie.data.size() + 1)
+        return false;
+
+    specie.name = result[0];
+    std::transform(result.begin() + 1,
+                   result.begin() + 1 + specie.data.size(),
+                   std::begin(specie.data),
+                   [] (const std::string &str) -> double
+                   {
+                       if (str == "infinity")
+                           return infinity;
+                       else
+                           return safihr::stod(str);
+                   });
+
+    return true;
+}
+
+}
+
+SpecieFileReader::SpecieFileReader(const std::string &filename)
+    : file(filename)
+{
+    if (!file.is_open())
+        throw crop_model_file_open_failure(filename);
+
+    file.imbue(std::locale::classic());
+}
+
+Specie SpecieFileReader::get(const std::string &speciename)
+{
+    unsigned int line_id = 1;
+    std::string line;
+
+    std::getline(file, line); /* Forget the header of the
+                               * file. */
+
+    if (file.eof() || file.fail())
+        throw crop_model_file_failure(line_id);
+
+    do {
+        line_id++;
+        std::getline(file, line);
+
+        if (file.fail())
+            break;
+
+        try {
+            if (boost::algorithm::starts_with(line, speciename) &&
+                line.size() > speciename.size() &&
+                line[speciename.size()] == ';') {
+                Specie specie;
+
+                if (!read_specie_line(line, specie))
+                    throw crop_model_file_failure(line_id);
+
+                return specie;
+            }
+        } catch (const std::exception &e) {
+            (void)e;
+            throw crop_model_file_failure(line_id);
+        }
+    } while (!file.eof());
+
+    throw crop_model_unknown_specie(speciename);
+}
+
+std::vector <Specie> SpecieFileReader::get_all()
+{
+    std::vector <Specie> species;
+    unsigned int line_id = 1;
+    std::string line;
+
+    std::getline(file, line); /* Forget the header of the
+                               * file. */
+
+    if (file.eof() || file.fail())
+        throw crop_model_file_failure(line_id);
+
+    while (std::getline(file, line)) {
+        line_id++;
+
+        if (line.empty() || line == "\r")
+            continue;
+
+        try {
+            Specie specie;
+
+            if (!read_specie_line(line, specie))
+                throw crop_model_file_failure(line_id);
+
+            species.emplace_back(std::move(specie));
+        } catch (const std::exception &e) {
+            (void)e;
+            throw crop_model_file_failure(line_id);
+        }
+    }
+
+    return species;
+}
+
+StatusModel LinModel::compute(double time, double tmoy)
+{
+    sum += tmoy - 5;
+
+    switch (status) {
+    case StatusModel::unavailable:
+    case StatusModel::maturity:
+        break;
+    case StatusModel::sown:
+        if (sum >= 50.0) {
+            status = StatusModel::raised;
+            Model::day_lev = time;
+            sum = 0.0;
+        }
+        break;
+    case StatusModel::raised:
+        if (sum >= 500.0) {
+            status = StatusModel::flowering;
+            sum = 0.0;
+        }
+        break;
+    case StatusModel::flowering:
+        if (sum >= 400) {
+            status = StatusModel::maturity;
+            sum = 0.0;
+        }
+        break;
+    }
+
+    return status;
+}
+
+namespace {
+
+void initialize_photoperiod(const Specie &specie, double latitude,
+                            double *fp, double nbday)
+{
+    const std::size_t end = static_cast <std::size_t>(nbday);
+
+    if (specie.data[Specie::PBASE] != infinity) {
+        double lat = M_PI * latitude / 180.0;
+        double jjulian = 1;
+
+        for (std::size_t i = 0; i < end; ++i) {
+            double dec = std::asin(
+                0.3978 * std::sin(
+                    (2.0 * M_PI * (jjulian - 80.0) / nbday) +
+                    ((0.0335 * (std::sin(2.0 * M_PI * jjulian) -
+                                std::sin(2.0 * M_PI * 80.0))) / nbday)));
+
+            double ph = 24.0 *
+                (std::acos(
+                    ((-0.10453 / std::cos(lat)) *
+                     std::cos(dec)) - (std::tan(lat) *
+                                       std::tan(dec)))) / M_PI;
+
+            fp[i] = std::max(0.0,
+                             (ph - specie.data[Specie::PBASE]) /
+                             (specie.data[Specie::POPT] -
+                              specie.data[Specie::PBASE]));
+            ++jjulian;
+        }
+    } else {
+        std::fill(fp, fp + end, 1.0);
+    }
+}
+
+}
+
+constexpr std::size_t Photoperiod::table_size;
+
+Photoperiod::Photoperiod(const Specie &specie, double latitude)
+{
+    auto table = std::make_shared <std::vector <double> >(table_size);
+    compute(specie, latitude, table->data());
+
+    m_table = table->data();
+    m_owner = table;
+}
+
+void Photoperiod::compute(const Specie &specie, double latitude,
+                          double *table)
+{
+    initialize_photoperiod(specie, latitude, table, 365.0);
+    initialize_photoperiod(specie, latitude, table + 365, 366.0);
+}
+
+StatusModel generic_compute(const Specie &specie,
+                            const Photoperiod &photoperiod,
+                            GenericState &state,
+                            double time, double tmoy,
+                            int day_of_year, bool leap)
+{
+    const double *data = &specie.data[0];
+
+    double tdev = (tmoy >= data[Specie::TMAXDEV]) ?
+        std::max(0.0, data[Specie::TMAXDEV] - data[Specie::TBASE]) :
+        std::max(0.0, tmoy - data[Specie::TBASE]);
+
+    state.tdev_sum += tdev;
+
+    if (state.tdev_sum >= data[Specie::SEM_LEV] &&
+        state.day_lev == infinity) {
+        state.day_lev = time;
+        state.status = StatusModel::raised;
+    }
+
+    double jvi = (data[Specie::TFROID] == infinity) ? 0.0 :
+        std::max(0.0, (1.0 - (((data[Specie::TFROID] - tmoy) /
+                               data[Specie::AMPFROID])
+                              * ((data[Specie::TFROID] - tmoy) /
+                                 data[Specie::AMPFROID]))));
+
+    double old_vdd = state.vdd;
+    state.vdd = time < state.day_lev ? 0.0 : old_vdd + jvi;
+
+    if (state.status == StatusModel::raised) {
+        double fv = data[Specie::VBASE] == 1.0 ? 1.0 :
+            std::max(0.0,
+                     std::min(1.0,
+                              ((old_vdd - data[Specie::VBASE]) /
+                               (data[Specie::VSAT] - data[Specie::VBASE]))));
+
+        state.udev += tdev * fv * photoperiod.get(day_of_year, leap);
+
+        if (state.udev > data[Specie::LEV_MAT])
+            state.status = StatusModel::maturity;
+    }
+
+    return state.status;
+}
+
+StatusModel generic_compute(const Specie &specie,
+                            const Photoperiod &photoperiod,
+                            CompactGenericState &state, std::int32_t origin,
+                            double time, double tmoy,
+                            int day_of_year, bool leap)
+{
+    GenericState expanded = state.expand(origin);
+
+    generic_compute(specie, photoperiod, expanded, time, tmoy, day_of_year,
+                    leap);
+
+    state.store(expanded, origin);
+
+    return expanded.status;
+}
+
+void generic_compute_lanes(const Specie &specie,
+                           const Photoperiod &photoperiod,
+                           GenericLanes &lanes, double time,
+                           const double *tmoy, int day_of_year, bool leap)
+{
+    const double *data = &specie.data[0];
+    const double tbase = data[Specie::TBASE];
+    const double tmaxdev = data[Specie::TMAXDEV];
+    const double tdev_max = std::max(0.0, tmaxdev - tbase);
+    const double sem_lev = data[Specie::SEM_LEV];
+    const double lev_mat = data[Specie::LEV_MAT];
+    const double tfroid = data[Specie::TFROID];
+    const double ampfroid = data[Specie::AMPFROID];
+    const bool no_froid = tfroid == infinity;
+    const double vbase = data[Specie::VBASE];
+    const double vsat = data[Specie::VSAT];
+    const bool no_vernalization = vbase == 1.0;
+    const double raised = static_cast <double>(StatusModel::raised);
+    const double mature = static_cast <double>(StatusModel::maturity);
+    const double photo = photoperiod.get(day_of_year, leap);
+
+    double *tdev_sum = lanes.tdev_sum.data();
+    double *day_lev = lanes.day_lev.data();
+    double *vdd = lanes.vdd.data();
+    double *udev = lanes.udev.data();
+    double *status = lanes.status.data();
+    double *mat = lanes.maturity.data();
+
+    /* Both sides of the conditions are computed and the stores are
+     * min/max of monotonic values (the status only grows, dates are set
+     * once from infinity) so the loop body has no branch. */
+    for (std::size_t l = 0, n = lanes.size(); l < n; ++l) {
+        const double t = tmoy[l];
+        const double above = std::max(0.0, t - tbase);
+        const double tdev = (t >= tmaxdev) ? tdev_max : above;
+
+        const double sum = tdev_sum[l] + tdev;
+        tdev_sum[l] = sum;
+
+        const bool lev = (sum >= sem_lev) & (day_lev[l] == infinity);
+        day_lev[l] = std::min(day_lev[l], lev ? time : infinity);
+        status[l] = std::max(status[l], lev ? raised : 0.0);
+
+        const double froid = std::max(
+            0.0, (1.0 - (((tfroid - t) / ampfroid)
+                         * ((tfroid - t) / ampfroid))));
+        const double jvi = no_froid ? 0.0 : froid;
+
+        const double old_vdd = vdd[l];
+        const double vdd_sum = old_vdd + jvi;
+        vdd[l] = time < day_lev[l] ? 0.0 : vdd_sum;
+
+        const bool is_raised = status[l] == raised;
+        const double vernalization = std::max(
+            0.0, std::min(1.0, ((old_vdd - vbase) / (vsat - vbase))));
+        const double fv = no_vernalization ? 1.0 : vernalization;
+
+        const double grown = udev[l] + tdev * fv * photo;
+        const double u = is_raised ? grown : udev[l];
+        udev[l] = u;
+
+        const bool done = is_raised & (u > lev_mat);
+        status[l] = std::max(status[l], done ? mature : 0.0);
+        mat[l] = std::min(mat[l], done ? time : infinity);
+    }
+}
+
+GenericModel::GenericModel(double time, const Specie &specie,
+                           double latitude)
+    : Model(StatusModel::sown), specie(specie), latitude(latitude),
+    photoperiod(std::make_shared <Photoperiod>(specie, latitude))
+{
+    (void)time;
+}
+
+GenericModel::GenericModel(double time, const Specie &specie,
+                           double latitude,
+                           std::shared_ptr <const Photoperiod> photoperiod)
+    : Model(StatusModel::sown), specie(specie), latitude(latitude),
+    photoperiod(photoperiod)
+{
+    (void)time;
+}
+
+StatusModel GenericModel::compute(double time, double tmoy)
+{
+    bool leap;
+    int day = day_of_year(static_cast <std::int32_t>(time), leap);
+
+    generic_compute(specie, *photoperiod, state, time, tmoy, day, leap);
+
+    Model::status = state.status;
+    Model::day_lev = state.day_lev;
+
+    return Model::status;
+}
+
+StatusModel CompactGenericModel::compute(double time, double tmoy)
+{
+    if (origin < 0)
+        origin = static_cast <std::int32_t>(time);
+
+    bool leap;
+    int day = day_of_year(static_cast <std::int32_t>(time), leap);
+
+    generic_compute(*specie, *photoperiod, state, origin, time, tmoy, day,
+                    leap);
+
+    Model::status = static_cast <StatusModel>(state.status);
+    Model::day_lev = state.day_lev(origin);
+
+    return Model::status;
+}
+
+namespace {
+
+/* Bound of the rounding error of a difference of prefix sums. */
+bool sowing_near(double sum, double threshold)
+{
+    return std::abs(sum - threshold) <= 1e-6 * (1.0 + std::abs(threshold));
+}
+
+}
+
+void generic_sowing_days(const Specie &specie,
+                         const Photoperiod &photoperiod, const double *tmoy,
+                         std::size_t size, std::int32_t begin,
+                         std::int32_t end, std::int32_t first,
+                         std::int32_t last, std::int32_t *dlev,
+                         std::int32_t *result)
+{
+    const double *data = &specie.data[0];
+    const double sem_lev = data[Specie::SEM_LEV];
+    const double lev_mat = data[Specie::LEV_MAT];
+    const double vbase = data[Specie::VBASE];
+    const double vsat = data[Specie::VSAT];
+
+    /* The day origin + i, computed with the record origin + i - 2 -
+     * begin as in CropEngine::simulate. */
+    const std::int32_t origin = first + 1;
+    const std::size_t days = end > origin ?
+        static_cast <std::size_t>(end - origin) : 0;
+
+    std::vector <double> tdev(days), photo(days), jvi(days);
+    std::vector <double> tdev_sum(days + 1, 0.0), udev_sum(days + 1, 0.0);
+
+    for (std::size_t i = 0; i != days; ++i) {
+        const std::int32_t t = origin + static_cast <std::int32_t>(i);
+        const std::int32_t record = t - 2 - begin;
+        const double temp = (record >= 0 &&
+                             static_cast <std::size_t>(record) < size) ?
+            tmoy[record] : 0.0;
+
+        bool leap;
+        int day = day_of_year(t, leap);
+
+        tdev[i] = (temp >= data[Specie::TMAXDEV]) ?
+            std::max(0.0, data[Specie::TMAXDEV] - data[Specie::TBASE]) :
+            std::max(0.0, temp - data[Specie::TBASE]);
+        photo[i] = photoperiod.get(day, leap);
+        jvi[i] = (data[Specie::TFROID] == infinity) ? 0.0 :
+            std::max(0.0, (1.0 - (((data[Specie::TFROID] - temp) /
+                                   data[Specie::AMPFROID])
+                                  * ((data[Specie::TFROID] - temp) /
+                                     data[Specie::AMPFROID]))));
+
+        tdev_sum[i + 1] = tdev_sum[i] + tdev[i];
+        udev_sum[i + 1] = udev_sum[i] + tdev[i] * photo[i];
+    }
+
+    /* The first day i >= from with sum(tdev[from..i]) >= sem_lev, days
+     * if none. */
+    auto emergence = [&](std::size_t from) -> std::size_t
+        {
+            const double base = tdev_sum[from];
+            std::size_t i = std::lower_bound(
+                tdev_sum.begin() + from + 1, tdev_sum.end(), base + sem_lev)
+                - tdev_sum.begin() - 1;
+
+            bool exact = !sowing_near(tdev_sum[std::min(i + 1, days)] - base,
+                                      sem_lev) &&
+                !sowing_near(tdev_sum[i] - base, sem_lev);
+
+            if (exact && (i == days ||
+                          tdev_sum[i + 1] - base >= sem_lev) &&
+                (i == from || tdev_sum[i] - base < sem_lev))
+                return i;
+
+            double sum = 0.0;
+            for (i = from; i != days; ++i) {
+                sum += tdev[i];
+                if (sum >= sem_lev)
+                    break;
+            }
+            return i;
+        };
+
+    /* The maturity day after an emergence at @e lev, days if none. */
+    auto maturity = [&](std::size_t lev) -> std::size_t
+        {
+            double vdd = 0.0, udev = 0.0;
+
+            for (std::size_t i = lev; i != days; ++i) {
+                const double old_vdd = vdd;
+                vdd = old_vdd + jvi[i];
+
+                const double fv = vbase == 1.0 ? 1.0 :
+                    std::max(0.0, std::min(1.0, ((old_vdd - vbase) /
+                                                 (vsat - vbase))));
+
+                /* fv stays 1: the remaining sum is a prefix sum. */
+                if (fv == 1.0 && (vbase == 1.0 || vsat > vbase)) {
+                    const double base = udev_sum[i] - udev;
+                    std::size_t j = std::upper_bound(
+                        udev_sum.begin() + i + 1, udev_sum.end(),
+                        base + lev_mat) - udev_sum.begin() - 1;
+
+                    if (!sowing_near(udev_sum[std::min(j + 1, days)] - base,
+                                     lev_mat) &&
+                        !sowing_near(udev_sum[j] - base, lev_mat) &&
+                        (j == days || udev_sum[j + 1] - base > lev_mat) &&
+                        (j == i || udev_sum[j] - base <= lev_mat))
+                        return j;
+                }
+
+                udev += tdev[i] * fv * photo[i];
+                if (udev > lev_mat)
+                    return i;
+            }
+
+            return days;
+        };
+
+    std::vector <std::size_t> maturities(days, days + 1); /* unknown. */
+
+    for (std::int32_t sowing = first; sowing < last; ++sowing) {
+        const std::size_t k = static_cast <std::size_t>(sowing - first);
+        dlev[k] = -1;
+        result[k] = -1;
+
+        if (k >= days)
+            continue;
+
+        const std::size_t lev = emergence(k);
+        if (lev == days)
+            continue;
+
+        if (maturities[lev] == days + 1)
+            maturities[lev] = maturity(lev);
+
+        if (maturities[lev] != days) {
+            dlev[k] = origin + static_cast <std::int32_t>(lev);
+            result[k] = origin + static_cast <std::int32_t>(maturities[lev])
+                + 1;
+        }
+    }
+}
+
+}
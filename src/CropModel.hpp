@@ -0,0 +1,516 @@
+/*
+ * Copyright (C) 2013-2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SAFIHR_MODEL_CROPMODEL_HPP
+#define SAFIHR_MODEL_CROPMODEL_HPP
+
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <valarray>
+#include <vector>
+#include "Global.hpp"
+
+namespace safihr {
+
+struct crop_model_internal_failure : std::runtime_error
+{
+    explicit crop_model_internal_failure()
+        : std::runtime_error("Crop model: internal error, contact developer")
+    {}
+};
+
+struct crop_model_failure : std::runtime_error
+{
+    explicit crop_model_failure(const std::string &msg)
+        : std::runtime_error(msg)
+    {}
+};
+
+struct crop_model_file_open_failure : std::runtime_error
+{
+    explicit crop_model_file_open_failure(const std::string &filepath)
+        : std::runtime_error(
+            (boost::format("Crop model: fail to open data `%1%' file")
+             % filepath).str())
+    {}
+};
+
+struct crop_model_file_failure : std::runtime_error
+{
+    explicit crop_model_file_failure(unsigned int line)
+        : std::runtime_error(
+            (boost::format("Crop model: fail to read data at line %1%")
+             % line).str())
+    {}
+};
+
+struct crop_model_unknown_specie : std::runtime_error
+{
+    explicit crop_model_unknown_specie(const std::string &speciename)
+        : std::runtime_error(
+            (boost::format("Crop model: unknown specie `%1%'")
+             % speciename).str())
+    {}
+};
+
+constexpr double infinity = std::numeric_limits <double>::infinity();
+
+struct Specie
+{
+    std::string name;
+    std::valarray <double> data;
+
+    enum DataId {
+        LEV_AMF = 0,
+        AMF_LAX,
+        SEM_LEV,
+        LEV_MAT,
+        TBASE,
+        TMAXDEV,
+        PBASE,
+        POPT,
+        TFROID,
+        AMPFROID,
+        VBASE,
+        VSAT,
+        ADENS,
+        CROIRAC,
+        BDENS,
+        LAICOMP,
+        TCOUVMAX,
+        PENTECOUVMAX,
+        INFRECOUV,
+        HMAX,
+        HBASE,
+        GRAINES_REC
+    };
+
+    Specie(const std::string &name)
+        : name(name), data(0.0, 22)
+    {}
+
+    Specie()
+        : name(), data(0.0, 22)
+    {}
+};
+
+std::ostream& operator<<(std::ostream& out, const Specie& specie);
+
+struct SpecieFileReader
+{
+    std::ifstream file;
+
+    SpecieFileReader(const std::string &filename);
+
+    Specie get(const std::string &speciename);
+
+    /**
+     * Read all the species of the file.
+     */
+    std::vector <Specie> get_all();
+};
+
+struct Model
+{
+    StatusModel status;
+    double day_lev;
+
+    Model(StatusModel status)
+        : status(status), day_lev(infinity)
+    {}
+
+    virtual ~Model()
+    {}
+
+    virtual std::string name() const = 0;
+
+    /**
+     * Restart the model at the sowing of a new season of the same
+     * specie. The allocated state is kept.
+     */
+    virtual void reset() = 0;
+
+    /**
+     * Compute a day of the model.
+     *
+     * @param time The julian day.
+     * @param tmoy The average temperature.
+     */
+    virtual StatusModel compute(double time, double tmoy) = 0;
+};
+
+struct LinModel : Model
+{
+    double sum;
+
+    LinModel()
+        : Model(StatusModel::sown), sum(0.0)
+    {}
+
+    virtual ~LinModel()
+    {}
+
+    virtual std::string name() const
+    {
+        return "LIN";
+    }
+
+    virtual void reset() override
+    {
+        status = StatusModel::sown;
+        day_lev = infinity;
+        sum = 0.0;
+    }
+
+    virtual StatusModel compute(double time, double tmoy) override;
+};
+
+/**
+ * Photoperiod factors of a specie at a latitude for classic and leap
+ * years, indexed by the day of the year minus one. They only depend
+ * on the specie and the latitude and can be shared by all the models.
+ *
+ * The factors are a table of 365 + 366 values, owned by the object or
+ * by an other storage (see SharedCache.hpp) kept alive by @e owner.
+ */
+class Photoperiod
+{
+public:
+    static constexpr std::size_t table_size = 365 + 366;
+
+    Photoperiod(const Specie &specie, double latitude);
+
+    Photoperiod(const double *table, std::shared_ptr <const void> owner)
+        : m_table(table), m_owner(std::move(owner))
+    {}
+
+    /** Compute the table_size factors of @e specie at @e latitude. */
+    static void compute(const Specie &specie, double latitude,
+                        double *table);
+
+    double get(int day_of_year, bool leap) const
+    {
+        return m_table[day_of_year - 1 + (leap ? 365 : 0)];
+    }
+
+    const double* table() const
+    {
+        return m_table;
+    }
+
+private:
+    const double *m_table;
+    std::shared_ptr <const void> m_owner;
+};
+
+/**
+ * The state variables of the generic model.
+ */
+struct GenericState
+{
+    StatusModel status;
+    double day_lev;
+    double tdev_sum;
+    double udev;
+    double vdd;
+
+    GenericState()
+        : status(StatusModel::sown), day_lev(infinity), tdev_sum(0.0),
+        udev(0.0), vdd(0.0)
+    {}
+};
+
+/**
+ * Compute a day of the generic model: the kernel shared by the
+ * GenericModel and the headless engines.
+ *
+ * @param day_of_year The day of the year of @e time (1 to 366).
+ * @param leap true if the year of @e time is a leap year.
+ */
+StatusModel generic_compute(const Specie &specie,
+                            const Photoperiod &photoperiod,
+                            GenericState &state,
+                            double time, double tmoy,
+                            int day_of_year, bool leap);
+
+/**
+ * The state of the generic model in 16 bytes: float accumulators, the
+ * day of emergence as an offset from the first computed day and the
+ * status in a byte. The day is computed in double precision and the
+ * state is rounded when stored.
+ */
+struct CompactGenericState
+{
+    static const std::uint16_t no_lev = 0xffff;
+
+    float tdev_sum;
+    float udev;
+    float vdd;
+    std::uint16_t lev; /* day_lev - origin, no_lev before emergence. */
+    std::uint8_t status;
+
+    CompactGenericState()
+        : tdev_sum(0.0f), udev(0.0f), vdd(0.0f), lev(no_lev),
+        status(static_cast <std::uint8_t>(StatusModel::sown))
+    {}
+
+    double day_lev(std::int32_t origin) const
+    {
+        return lev == no_lev ? infinity : origin + static_cast <double>(lev);
+    }
+
+    GenericState expand(std::int32_t origin) const
+    {
+        GenericState state;
+        state.status = static_cast <StatusModel>(status);
+        state.day_lev = day_lev(origin);
+        state.tdev_sum = tdev_sum;
+        state.udev = udev;
+        state.vdd = vdd;
+        return state;
+    }
+
+    void store(const GenericState &state, std::int32_t origin)
+    {
+        if (state.day_lev != infinity && state.day_lev - origin >= no_lev)
+            throw crop_model_failure("Crop model: emergence too far from"
+                                     " the sowing for the compact state");
+
+        status = static_cast <std::uint8_t>(state.status);
+        lev = state.day_lev == infinity ? no_lev :
+            static_cast <std::uint16_t>(state.day_lev - origin);
+        tdev_sum = static_cast <float>(state.tdev_sum);
+        udev = static_cast <float>(state.udev);
+        vdd = static_cast <float>(state.vdd);
+    }
+};
+
+static_assert(sizeof(CompactGenericState) == 16,
+              "CompactGenericState must fit in 16 bytes");
+
+/**
+ * Compute a day of the generic model with a compact state. @e origin
+ * is the first day computed by the model.
+ */
+StatusModel generic_compute(const Specie &specie,
+                            const Photoperiod &photoperiod,
+                            CompactGenericState &state, std::int32_t origin,
+                            double time, double tmoy,
+                            int day_of_year, bool leap);
+
+/**
+ * The states of several generic models of the same specie, the lanes,
+ * stored variable by variable. The status is stored as a double and
+ * @e maturity is the day each lane reaches the maturity (infinity
+ * before).
+ */
+struct GenericLanes
+{
+    std::vector <double> tdev_sum;
+    std::vector <double> day_lev;
+    std::vector <double> vdd;
+    std::vector <double> udev;
+    std::vector <double> status;
+    std::vector <double> maturity;
+
+    GenericLanes(std::size_t lanes, const GenericState &state)
+        : tdev_sum(lanes, state.tdev_sum), day_lev(lanes, state.day_lev),
+        vdd(lanes, state.vdd), udev(lanes, state.udev),
+        status(lanes, static_cast <double>(state.status)),
+        maturity(lanes, infinity)
+    {}
+
+    std::size_t size() const
+    {
+        return status.size();
+    }
+
+    /** true if all the lanes reached the maturity. */
+    bool matured() const
+    {
+        return std::find_if(maturity.begin(), maturity.end(),
+                            [](double day)
+                            {
+                                return day == infinity;
+                            }) == maturity.end();
+    }
+};
+
+/**
+ * Compute the day @e time of all the lanes, the lane @e i with the
+ * temperature @e tmoy[i]: the generic_compute kernel in one loop over
+ * the lanes.
+ */
+void generic_compute_lanes(const Specie &specie,
+                           const Photoperiod &photoperiod,
+                           GenericLanes &lanes, double time,
+                           const double *tmoy, int day_of_year, bool leap);
+
+/**
+ * The emergence and maturity days of the sowings at each day of
+ * [first, last), as CropEngine::simulate computes them (-1 if the
+ * maturity is not reached before @e end), in O(days) plus the
+ * vernalization phases instead of a simulation per sowing day.
+ *
+ * The thermal sums are prefix sums shared by all the sowing days, and
+ * after the emergence the state only depends on the emergence day: the
+ * maturity is computed once per emergence day. Near a threshold, where
+ * the rounding of the prefix sums could change the day, the sum is
+ * computed again in the order of the model so the results are exact.
+ */
+void generic_sowing_days(const Specie &specie,
+                         const Photoperiod &photoperiod, const double *tmoy,
+                         std::size_t size, std::int32_t begin,
+                         std::int32_t end, std::int32_t first,
+                         std::int32_t last, std::int32_t *dlev,
+                         std::int32_t *result);
+
+/**
+ * A generic model with a compact state. The specie and its photoperiod
+ * are shared: the specie must outlive the model.
+ */
+struct CompactGenericModel : Model
+{
+    const Specie *specie;
+    std::shared_ptr <const Photoperiod> photoperiod;
+    std::int32_t origin; /* first computed day, -1 before. */
+    CompactGenericState state;
+
+    CompactGenericModel(const Specie &specie,
+                        std::shared_ptr <const Photoperiod> photoperiod)
+        : Model(StatusModel::sown), specie(&specie),
+        photoperiod(photoperiod), origin(-1)
+    {}
+
+    virtual ~CompactGenericModel()
+    {}
+
+    virtual std::string name() const
+    {
+        return specie->name;
+    }
+
+    virtual void reset() override
+    {
+        state = CompactGenericState();
+        origin = -1;
+        status = StatusModel::sown;
+        day_lev = infinity;
+    }
+
+    /** Restart the model with another specie. */
+    void reset(const Specie &other,
+               std::shared_ptr <const Photoperiod> other_photoperiod)
+    {
+        specie = &other;
+        photoperiod = other_photoperiod;
+        reset();
+    }
+
+    virtual StatusModel compute(double time, double tmoy) override;
+
+    double udev() const
+    {
+        return state.udev;
+    }
+
+    double tdev_sum() const
+    {
+        return state.tdev_sum;
+    }
+
+    double vdd() const
+    {
+        return state.vdd;
+    }
+};
+
+struct GenericModel : Model
+{
+    Specie specie;
+    double latitude;
+    std::shared_ptr <const Photoperiod> photoperiod;
+    GenericState state;
+
+    GenericModel(double time, const Specie &specie, double latitude);
+
+    GenericModel(double time, const Specie &specie, double latitude,
+                 std::shared_ptr <const Photoperiod> photoperiod);
+
+    virtual ~GenericModel()
+    {}
+
+    virtual std::string name() const
+    {
+        return specie.name;
+    }
+
+    virtual void reset() override
+    {
+        state = GenericState();
+        status = state.status;
+        day_lev = state.day_lev;
+    }
+
+    /**
+     * Restart the model with another specie. The specie parameters are
+     * copied into the existing storage.
+     */
+    void reset(const Specie &other,
+               std::shared_ptr <const Photoperiod> other_photoperiod)
+    {
+        specie.name = other.name;
+        specie.data = other.data;
+        photoperiod = other_photoperiod;
+        reset();
+    }
+
+    virtual StatusModel compute(double time, double tmoy) override;
+
+    double udev() const
+    {
+        return state.udev;
+    }
+
+    double tdev_sum() const
+    {
+        return state.tdev_sum;
+    }
+
+    double vdd() const
+    {
+        return state.vdd;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,580 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "BuiltinSpecies.hpp"
+#include "CropEngine.hpp"
+#include "Global.hpp"
+
+namespace {
+
+/* A request line longer than this closes the connection. */
+const std::size_t max_line = 4096;
+
+/* Stop reading the requests of a client while its answers are not
+ * sent. */
+const std::size_t max_pending = 1u << 20;
+
+/* Size of a read: with max_line, the bound of the input buffer of a
+ * client. */
+const std::size_t read_size = 65536;
+
+/* Engines kept, the least recently used is removed. */
+const std::size_t max_latitudes = 64;
+
+/* Bound of the answer cache, emptied when reached. */
+const std::size_t max_results = 1u << 20;
+
+volatile sig_atomic_t stop = 0;
+
+void on_signal(int)
+{
+    stop = 1;
+}
+
+void usage()
+{
+    std::cout <<
+        "safihr-cropserver: maturity predictions over a Unix domain socket\n\n"
+        "  --weather file     the weather file (date;tmin;tmax;tmoy)\n"
+        "  --species file     the specie parameters, read again when the\n"
+        "                     file changes [built-in species]\n"
+        "  --socket path      the socket [safihr-cropserver.sock]\n"
+        "  --latitude value   the default latitude [48.48]\n\n"
+        "Each request is a line `specie;sowing[;latitude]' where sowing is\n"
+        "a dd/mm/yyyy date or a julian day. Each request is answered, in\n"
+        "order, by a line `specie;sowing;emergence;maturity' or\n"
+        "`error;message'.\n";
+}
+
+struct Options
+{
+    std::string weather;
+    std::string species;
+    std::string socket;
+    double latitude;
+
+    Options()
+        : socket("safihr-cropserver.sock"), latitude(48.48)
+    {}
+};
+
+/**
+ * Read a latitude in degrees.
+ *
+ * @throw std::runtime_error if it is not a number of [-90, 90].
+ */
+double parse_latitude(const std::string &str)
+{
+    double latitude = safihr::stod(str);
+
+    if (!std::isfinite(latitude) || std::abs(latitude) > 90.0)
+        throw std::runtime_error("latitude `" + str +
+                                 "' outside of [-90, 90]");
+
+    return latitude;
+}
+
+bool parse(int argc, char *argv[], Options &opts)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+
+        if (arg == "-h" || arg == "--help")
+            return false;
+
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for `" << arg << "'\n";
+            return false;
+        }
+
+        std::string value(argv[++i]);
+
+        if (arg == "--weather")
+            opts.weather = value;
+        else if (arg == "--species")
+            opts.species = value;
+        else if (arg == "--socket")
+            opts.socket = value;
+        else if (arg == "--latitude")
+            opts.latitude = parse_latitude(value);
+        else {
+            std::cerr << "unknown option `" << arg << "'\n";
+            return false;
+        }
+    }
+
+    if (opts.weather.empty()) {
+        std::cerr << "--weather is mandatory\n";
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Identity of a file: changes when the file is written or replaced.
+ */
+struct FileStamp
+{
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+
+    FileStamp()
+        : device(0), inode(0), size(0), mtime()
+    {}
+
+    bool operator==(const FileStamp &other) const
+    {
+        return device == other.device && inode == other.inode &&
+            size == other.size && mtime.tv_sec == other.mtime.tv_sec &&
+            mtime.tv_nsec == other.mtime.tv_nsec;
+    }
+};
+
+bool file_stamp(const std::string &filepath, FileStamp &stamp)
+{
+    struct stat st;
+    if (::stat(filepath.c_str(), &st) != 0)
+        return false;
+
+    stamp.device = st.st_dev;
+    stamp.inode = st.st_ino;
+    stamp.size = st.st_size;
+    stamp.mtime = st.st_mtim;
+
+    return true;
+}
+
+/**
+ * The warm state of the server: the weather series, the specie catalog,
+ * one CropEngine (the photoperiod tables) per latitude and the answers
+ * already computed. The answers use the timing of the compare
+ * experiment with the weather series starting at its first record.
+ */
+class Predictor
+{
+public:
+    Predictor(const Options &opts)
+        : m_filepath(opts.species), m_uses(0), m_latitude(opts.latitude)
+    {
+        safihr::read_weather(opts.weather, m_weather);
+
+        if (m_filepath.empty()) {
+            m_species = safihr::builtin_species();
+            return;
+        }
+
+        FileStamp stamp;
+        if (!file_stamp(m_filepath, stamp))
+            throw std::runtime_error("can not open `" + m_filepath + "'");
+
+        load(stamp);
+    }
+
+    /**
+     * Read the specie file again if it changed. If the new file can not
+     * be read, the previous catalog is kept until the next change. The
+     * built-in species never change.
+     */
+    void refresh()
+    {
+        FileStamp stamp;
+        if (m_filepath.empty() || !file_stamp(m_filepath, stamp) || stamp == m_stamp)
+            return;
+
+        try {
+            load(stamp);
+            std::cerr << "safihr-cropserver: " << m_species.size()
+                      << " species read from `" << m_filepath << "'\n";
+        } catch (const std::exception &e) {
+            m_stamp = stamp;
+            std::cerr << "safihr-cropserver: " << e.what()
+                      << ", the previous species are kept\n";
+        }
+    }
+
+    /** Answer a request line, without the end of line. */
+    std::string answer(const std::string &line)
+    {
+        std::vector <std::string> fields(1);
+        for (char c : line) {
+            if (c == ';')
+                fields.emplace_back();
+            else if (c != '\r')
+                fields.back() += c;
+        }
+
+        if (fields.size() < 2 || fields.size() > 3)
+            return "error;expected `specie;sowing[;latitude]'";
+
+        try {
+            const std::string &name = fields[0];
+            std::int32_t sowing;
+            if (!safihr::parse_date(fields[1].c_str(),
+                                    fields[1].c_str() + fields[1].size(),
+                                    sowing))
+                sowing = safihr::stoi(fields[1]);
+
+            double latitude = fields.size() == 3 ?
+                parse_latitude(fields[2]) : m_latitude;
+
+            std::pair <std::int32_t, std::int32_t> result =
+                predict(name, sowing, latitude);
+
+            return name + ';' + safihr::format_date(sowing) + ';' +
+                safihr::format_date(result.first) + ';' +
+                safihr::format_date(result.second);
+        } catch (const std::exception &e) {
+            return std::string("error;") + e.what();
+        }
+    }
+
+private:
+    void load(const FileStamp &stamp)
+    {
+        std::vector <safihr::Specie> species =
+            safihr::SpecieFileReader(m_filepath).get_all();
+
+        if (species.empty())
+            throw std::runtime_error("no specie in `" + m_filepath + "'");
+
+        m_species.swap(species);
+        m_engines.clear();
+        m_results.clear();
+        m_stamp = stamp;
+    }
+
+    /* The engine of a latitude (checked by parse_latitude). */
+    const safihr::CropEngine& engine(double latitude)
+    {
+        ++m_uses;
+
+        auto it = m_engines.find(latitude);
+        if (it != m_engines.end()) {
+            it->second.used = m_uses;
+            return *it->second.engine;
+        }
+
+        if (m_engines.size() >= max_latitudes) {
+            auto oldest = std::min_element(
+                m_engines.begin(), m_engines.end(),
+                [](const std::pair <const double, LatitudeEngine> &lhs,
+                   const std::pair <const double, LatitudeEngine> &rhs)
+                {
+                    return lhs.second.used < rhs.second.used;
+                });
+            m_engines.erase(oldest);
+        }
+
+        LatitudeEngine entry { std::unique_ptr <safihr::CropEngine>(
+                new safihr::CropEngine(m_species, latitude)), m_uses };
+
+        return *m_engines.emplace(latitude, std::move(entry))
+            .first->second.engine;
+    }
+
+    std::pair <std::int32_t, std::int32_t> predict(const std::string &name,
+                                                   std::int32_t sowing,
+                                                   double latitude)
+    {
+        const std::int32_t begin = m_weather.begin;
+        const std::int32_t end = begin + static_cast <std::int32_t>(
+            m_weather.size());
+
+        if (sowing < begin || sowing >= end)
+            throw std::runtime_error("sowing outside of the weather series");
+
+        const safihr::CropEngine &eng = engine(latitude);
+        safihr::ScenarioKey key { eng.find(name), sowing, latitude, 0 };
+
+        auto it = m_results.find(key);
+        if (it != m_results.end())
+            return it->second;
+
+        std::pair <std::int32_t, std::int32_t> result;
+        eng.simulate(key.specie, sowing, m_weather.tmoy.data(),
+                     m_weather.size(), begin, end, result.first,
+                     result.second);
+
+        if (m_results.size() >= max_results)
+            m_results.clear();
+
+        m_results.emplace(key, result);
+
+        return result;
+    }
+
+    struct LatitudeEngine
+    {
+        std::unique_ptr <safihr::CropEngine> engine;
+        std::uint64_t used;
+    };
+
+    safihr::WeatherSeries m_weather;
+    std::string m_filepath;
+    FileStamp m_stamp;
+    std::vector <safihr::Specie> m_species;
+    std::map <double, LatitudeEngine> m_engines;
+    std::uint64_t m_uses;
+    std::unordered_map <safihr::ScenarioKey,
+                        std::pair <std::int32_t, std::int32_t>,
+                        safihr::ScenarioKeyHash> m_results;
+    double m_latitude;
+};
+
+struct Client
+{
+    int fd;
+    std::string in;
+    std::string out;
+    bool closing;
+};
+
+void set_nonblocking(int fd)
+{
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+/**
+ * Open the listening socket. A stale socket file is removed but a
+ * socket used by a running server is not.
+ */
+int listen_socket(const std::string &path)
+{
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("socket path `" + path + "' is too long");
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+    const struct sockaddr *address =
+        reinterpret_cast <const struct sockaddr*>(&addr);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw std::runtime_error(std::strerror(errno));
+
+    if (::connect(fd, address, sizeof(addr)) == 0) {
+        ::close(fd);
+        throw std::runtime_error("socket `" + path + "' is already in use");
+    }
+
+    ::unlink(path.c_str());
+
+    if (::bind(fd, address, sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN)) {
+        std::string error(std::strerror(errno));
+        ::close(fd);
+        throw std::runtime_error("socket `" + path + "': " + error);
+    }
+
+    set_nonblocking(fd);
+
+    return fd;
+}
+
+/**
+ * Read the available requests of a client and append their answers
+ * to its output buffer, until max_pending bytes of answers wait to be
+ * sent. The requests are answered after each read so the input buffer
+ * never exceeds max_line + read_size bytes; a longer request closes
+ * the connection.
+ */
+void receive(Client &client, Predictor &predictor)
+{
+    char buffer[read_size];
+
+    while (!client.closing && client.out.size() < max_pending) {
+        ssize_t size = ::read(client.fd, buffer, sizeof(buffer));
+        if (size < 0 && errno == EINTR)
+            continue;
+
+        if (size <= 0) {
+            if (size == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                client.closing = true;
+            break;
+        }
+
+        client.in.append(buffer, size);
+
+        std::string::size_type first = 0, last;
+        while ((last = client.in.find('\n', first)) != std::string::npos) {
+            client.out += predictor.answer(client.in.substr(first,
+                                                            last - first));
+            client.out += '\n';
+            first = last + 1;
+        }
+        client.in.erase(0, first);
+
+        if (client.in.size() > max_line) {
+            client.out += "error;request too long\n";
+            client.in.clear();
+            client.closing = true;
+        }
+    }
+}
+
+/** @return false if the client is gone. */
+bool send(Client &client)
+{
+    while (!client.out.empty()) {
+        ssize_t size = ::send(client.fd, client.out.data(), client.out.size(),
+                              MSG_NOSIGNAL);
+        if (size < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        client.out.erase(0, size);
+    }
+
+    return true;
+}
+
+void serve(int listener, Predictor &predictor)
+{
+    std::vector <Client> clients;
+    std::vector <struct pollfd> fds;
+
+    while (!stop) {
+        fds.clear();
+        fds.push_back(pollfd { listener, POLLIN, 0 });
+        for (const auto &client : clients) {
+            short events = client.out.empty() ? 0 : POLLOUT;
+            if (!client.closing && client.out.size() < max_pending)
+                events |= POLLIN;
+            fds.push_back(pollfd { client.fd, events, 0 });
+        }
+
+        if (::poll(fds.data(), fds.size(), 1000) < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error(std::strerror(errno));
+        }
+
+        predictor.refresh();
+
+        for (std::size_t i = 0, e = clients.size(); i != e; ++i) {
+            Client &client = clients[i];
+            short revents = fds[i + 1].revents;
+
+            if (revents & (POLLIN | POLLHUP))
+                receive(client, predictor);
+
+            if ((revents & POLLERR) || !send(client)) {
+                client.closing = true;
+                client.out.clear();
+            }
+        }
+
+        for (auto it = clients.begin(); it != clients.end();) {
+            if (it->closing && it->out.empty()) {
+                ::close(it->fd);
+                it = clients.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = ::accept(listener, nullptr, nullptr)) >= 0) {
+                set_nonblocking(fd);
+                clients.push_back(Client { fd, std::string(), std::string(),
+                            false });
+            }
+        }
+    }
+
+    for (const auto &client : clients)
+        ::close(client.fd);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+
+    if (!parse(argc, argv, opts)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+    ::signal(SIGPIPE, SIG_IGN);
+
+    int listener = -1;
+
+    try {
+        Predictor predictor(opts);
+        listener = listen_socket(opts.socket);
+
+        std::cerr << "safihr-cropserver: listening on `" << opts.socket
+                  << "'\n";
+
+        serve(listener, predictor);
+    } catch (const std::exception &e) {
+        std::cerr << "safihr-cropserver: " << e.what() << '\n';
+        if (listener >= 0) {
+            ::close(listener);
+            ::unlink(opts.socket.c_str());
+        }
+        return EXIT_FAILURE;
+    }
+
+    ::close(listener);
+    ::unlink(opts.socket.c_str());
+
+    return EXIT_SUCCESS;
+}
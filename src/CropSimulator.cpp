@@ -0,0 +1,541 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "BuiltinSpecies.hpp"
+#include "CropEngine.hpp"
+#include "Hash.hpp"
+#include "Manifest.hpp"
+#include "ResultWriter.hpp"
+#include "Shard.hpp"
+
+namespace {
+
+void usage()
+{
+    std::cout <<
+        "safihr-cropsim: headless simulation of a sowing plan\n\n"
+        "  --weather file     the weather file (date;tmin;tmax;tmoy)\n"
+        "  --plan file        the sowing plan\n"
+        "  --species file     the specie parameters [built-in species]\n"
+        "  --latitude value   the latitude of the parcels [48.48]\n"
+        "  --begin date       the begin of the simulation, dd/mm/yyyy or\n"
+        "                     julian day [first weather date]\n"
+        "  --duration days    the duration of the simulation\n"
+        "                     [number of weather records]\n"
+        "  --output file      the result file [simulation-outputs.csv]\n"
+        "  --threads n        the number of threads [hardware threads]\n"
+        "  --no-memoize       simulate each parcel even if another parcel\n"
+        "                     has the same specie and sowing day\n"
+        "  --store file       the result store: already simulated\n"
+        "                     scenarios are read from it, new ones are\n"
+        "                     added\n"
+        "  --compact          use the compact state (float accumulators)\n"
+        "  --validate n       simulate n scenarios with the double and\n"
+        "                     the compact states, report the deviations\n"
+        "                     and exit\n"
+        "  --manifest file    incremental run: only the rows changed\n"
+        "                     since the run described by the manifest\n"
+        "                     are simulated, the others are copied from\n"
+        "                     the previous output; the manifest is then\n"
+        "                     updated\n"
+        "  --shard i/K        simulate the parcels whose identifier modulo\n"
+        "                     K is i into `output.i-of-K', or the shard\n"
+        "                     of SAFIHR_SHARD with `environment' (see\n"
+        "                     safihr-shard)\n\n"
+        "Weather ensembles:\n"
+        "  --member file      an other weather file, simulated as an\n"
+        "                     other member of the ensemble\n"
+        "  --offsets list     temperature offsets, each weather file gives\n"
+        "                     a member per offset (-1,0,1) [0]\n"
+        "  --statistics       write the statistics of the members by\n"
+        "                     parcel instead of a row per member\n";
+}
+
+struct Options
+{
+    std::string weather;
+    std::string plan;
+    std::string species;
+    std::string output;
+    std::string begin;
+    std::string store;
+    std::string manifest;
+    std::string shard;
+    std::vector <std::string> members;
+    std::vector <double> offsets;
+    double latitude;
+    long duration;
+    long validate;
+    unsigned threads;
+    bool memoize;
+    bool compact;
+    bool statistics;
+
+    Options()
+        : output("simulation-outputs.csv"), latitude(48.48), duration(-1),
+        validate(0), threads(0), memoize(true), compact(false),
+        statistics(false)
+    {}
+
+    bool ensemble() const
+    {
+        return !members.empty() || !offsets.empty();
+    }
+};
+
+std::vector <double> parse_offsets(const std::string &str)
+{
+    std::vector <double> offsets;
+    std::string::size_type first = 0, last;
+
+    do {
+        last = str.find(',', first);
+        offsets.push_back(safihr::stod(str.substr(first, last - first)));
+        first = last + 1;
+    } while (last != std::string::npos);
+
+    return offsets;
+}
+
+bool parse(int argc, char *argv[], Options &opts)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+
+        if (arg == "-h" || arg == "--help")
+            return false;
+
+        if (arg == "--no-memoize") {
+            opts.memoize = false;
+            continue;
+        }
+
+        if (arg == "--compact") {
+            opts.compact = true;
+            continue;
+        }
+
+        if (arg == "--statistics") {
+            opts.statistics = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for `" << arg << "'\n";
+            return false;
+        }
+
+        std::string value(argv[++i]);
+
+        if (arg == "--weather")
+            opts.weather = value;
+        else if (arg == "--plan")
+            opts.plan = value;
+        else if (arg == "--species")
+            opts.species = value;
+        else if (arg == "--output")
+            opts.output = value;
+        else if (arg == "--begin")
+            opts.begin = value;
+        else if (arg == "--store")
+            opts.store = value;
+        else if (arg == "--manifest")
+            opts.manifest = value;
+        else if (arg == "--shard")
+            opts.shard = value;
+        else if (arg == "--member")
+            opts.members.push_back(value);
+        else if (arg == "--offsets")
+            opts.offsets = parse_offsets(value);
+        else if (arg == "--latitude")
+            opts.latitude = safihr::stod(value);
+        else if (arg == "--duration")
+            opts.duration = safihr::stoi(value);
+        else if (arg == "--validate")
+            opts.validate = safihr::stoi(value);
+        else if (arg == "--threads")
+            opts.threads = safihr::stoi(value);
+        else {
+            std::cerr << "unknown option `" << arg << "'\n";
+            return false;
+        }
+    }
+
+    if (opts.weather.empty() || opts.plan.empty()) {
+        std::cerr << "--weather and --plan are mandatory\n";
+        return false;
+    }
+
+    if (opts.statistics && !opts.ensemble()) {
+        std::cerr << "--statistics needs --member or --offsets\n";
+        return false;
+    }
+
+    if (opts.compact && !opts.store.empty()) {
+        std::cerr << "--store can not be used with --compact\n";
+        return false;
+    }
+
+    if (opts.ensemble() && !opts.store.empty()) {
+        std::cerr << "--store can not be used with an ensemble\n";
+        return false;
+    }
+
+    /* As the CompareDateAI, SAFIHR_SHARD is only read on request. */
+    const char *env = std::getenv("SAFIHR_SHARD");
+    if (opts.shard.empty() && env && *env)
+        std::cerr << "safihr-cropsim: SAFIHR_SHARD is ignored without "
+            "--shard environment\n";
+
+    if (!opts.shard.empty() && !opts.manifest.empty()) {
+        std::cerr << "--manifest can not be used with --shard\n";
+        return false;
+    }
+
+    if (opts.ensemble() && !opts.manifest.empty()) {
+        std::cerr << "--manifest can not be used with an ensemble\n";
+        return false;
+    }
+
+    return true;
+}
+
+constexpr const char *member_result_header = "id_parcelle;libelle_occup;"
+    "Date-semis;membre;Date-Lev;Date-recolte-simulee";
+
+constexpr const char *member_statistics_header = "id_parcelle;"
+    "libelle_occup;Date-semis;membres-recolte;Date-recolte-min;"
+    "Date-recolte-moyenne;Date-recolte-max;ecart-type";
+
+/** A row of the result of a member of an ensemble. */
+struct MemberResult
+{
+    const safihr::PlanTable &plan;
+    std::size_t row;
+    std::size_t member;
+    std::int32_t dlev;
+    std::int32_t result;
+};
+
+std::ostream& operator<<(std::ostream &out, const MemberResult &r)
+{
+    return out << r.plan.id[r.row] << ';' << r.plan.specie_name(r.row) << ';'
+               << safihr::format_date(r.plan.dmin[r.row]) << ';' << r.member
+               << ';' << safihr::format_date(r.dlev) << ';'
+               << safihr::format_date(r.result);
+}
+
+/** A row of the statistics of the members of an ensemble. */
+struct MemberStatisticsRow
+{
+    const safihr::PlanTable &plan;
+    std::size_t row;
+    safihr::MemberStatistics stats;
+};
+
+std::ostream& operator<<(std::ostream &out, const MemberStatisticsRow &r)
+{
+    auto date = [](double day)
+        {
+            return safihr::format_date(static_cast <std::int32_t>(
+                                           std::floor(day + 0.5)));
+        };
+
+    return out << r.plan.id[r.row] << ';' << r.plan.specie_name(r.row) << ';'
+               << safihr::format_date(r.plan.dmin[r.row]) << ';'
+               << r.stats.matured << ';' << date(r.stats.min) << ';'
+               << date(r.stats.mean) << ';' << date(r.stats.max) << ';'
+               << r.stats.stddev;
+}
+
+/**
+ * Simulate the plan under the weather ensemble and write a row per
+ * member or the statistics of the members of each row.
+ */
+void run_ensemble(const Options &opts, const safihr::WeatherSeries &weather,
+                  const safihr::PlanTable &plan,
+                  const safihr::CropEngine &engine, std::int32_t begin,
+                  std::int32_t end)
+{
+    std::vector <safihr::WeatherSeries> series(1, weather);
+    for (const auto &filepath : opts.members) {
+        series.emplace_back();
+        safihr::read_weather(filepath, series.back());
+    }
+
+    safihr::WeatherEnsemble ensemble;
+    safihr::make_ensemble(series, opts.offsets.empty() ?
+                          std::vector <double>(1, 0.0) : opts.offsets,
+                          ensemble);
+
+    auto start = std::chrono::steady_clock::now();
+
+    safihr::EngineOptions options;
+    options.threads = opts.threads;
+    options.memoize = opts.memoize;
+
+    safihr::EnsembleResult result;
+    engine.run(plan, ensemble, begin, end, result, options);
+
+    auto simulated = std::chrono::steady_clock::now();
+
+    if (opts.statistics) {
+        safihr::ResultWriter writer(opts.output, member_statistics_header);
+
+        for (std::size_t row = 0, e = plan.size(); row != e; ++row)
+            writer.push(MemberStatisticsRow {
+                    plan, row, safihr::MemberStatistics(
+                        result.row_result(row), result.members) });
+    } else {
+        safihr::ResultWriter writer(opts.output, member_result_header);
+
+        for (std::size_t row = 0, e = plan.size(); row != e; ++row) {
+            const std::int32_t *dlev = result.row_dlev(row);
+            const std::int32_t *maturity = result.row_result(row);
+
+            for (std::size_t k = 0; k != result.members; ++k)
+                writer.push(MemberResult { plan, row, k, dlev[k],
+                            maturity[k] });
+        }
+    }
+
+    typedef std::chrono::duration <double> seconds;
+    std::cerr << plan.size() << " parcels (" << result.scenarios
+              << " scenarios) x " << result.members << " members, simulation "
+              << seconds(simulated - start).count() << "s\n";
+}
+
+/** A row of a previous output copied with a new identifier. */
+struct ReusedResult
+{
+    std::uint32_t id;
+    const std::string &line;
+};
+
+std::ostream& operator<<(std::ostream &out, const ReusedResult &r)
+{
+    std::string::size_type pos = r.line.find(';');
+
+    out << r.id;
+    return out.write(r.line.data() + pos, r.line.size() - pos);
+}
+
+/**
+ * Read the rows of a result file, without the header. Return false if
+ * the file can not be read or a row has no identifier.
+ */
+bool read_result_rows(const std::string &filepath,
+                      std::vector <std::string> &rows)
+{
+    std::ifstream file(filepath);
+    if (!file.is_open())
+        return false;
+
+    std::string line;
+    if (!std::getline(file, line))
+        return false;
+
+    rows.clear();
+    while (std::getline(file, line)) {
+        if (line.find(';') == std::string::npos)
+            return false;
+        rows.emplace_back(std::move(line));
+    }
+
+    return true;
+}
+
+std::int32_t parse_begin(const std::string &str)
+{
+    std::int32_t jdn;
+
+    if (safihr::parse_date(str.c_str(), str.c_str() + str.size(), jdn))
+        return jdn;
+
+    return safihr::stoi(str);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+
+    if (!parse(argc, argv, opts)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+
+        safihr::WeatherSeries weather;
+        safihr::read_weather(opts.weather, weather);
+
+        safihr::PlanTable plan;
+        safihr::read_plan(opts.plan, plan, opts.threads);
+
+        const safihr::PlanShard shard = opts.shard.empty() ?
+            safihr::PlanShard() : safihr::shard_option(opts.shard);
+
+        if (shard.enabled()) {
+            safihr::PlanTable rows;
+            safihr::select_shard(plan, shard, rows);
+            plan = std::move(rows);
+            opts.output = safihr::shard_filepath(opts.output, shard);
+        }
+
+        safihr::CropEngine engine(
+            opts.species.empty() ? safihr::builtin_species() :
+            safihr::SpecieFileReader(opts.species).get_all(), opts.latitude);
+
+        std::int32_t begin = opts.begin.empty() ? weather.begin :
+            parse_begin(opts.begin);
+        std::int32_t end = begin + (opts.duration < 0 ?
+                                    static_cast <std::int32_t>(weather.size())
+                                    : opts.duration);
+
+        if (opts.validate > 0) {
+            safihr::PrecisionReport report;
+            engine.validate_compact(plan, weather, begin, end, opts.validate,
+                                    report, opts.threads);
+
+            std::cout << "compact state: " << report.scenarios
+                      << " scenarios, " << report.differ << " differ, "
+                      << report.unmatched << " matured by one state only,"
+                      << " max emergence deviation "
+                      << report.max_dlev_deviation << " days, max maturity"
+                      << " deviation " << report.max_result_deviation
+                      << " days\n";
+            return EXIT_SUCCESS;
+        }
+
+        if (opts.ensemble()) {
+            run_ensemble(opts, weather, plan, engine, begin, end);
+            return EXIT_SUCCESS;
+        }
+
+        auto loaded = std::chrono::steady_clock::now();
+
+        std::unique_ptr <safihr::ResultStore> store;
+        if (!opts.store.empty())
+            store.reset(new safihr::ResultStore(opts.store));
+
+        safihr::EngineOptions options;
+        options.threads = opts.threads;
+        options.memoize = opts.memoize;
+        options.compact = opts.compact;
+        options.store = store.get();
+
+        /*
+         * An incremental run reuses the rows of the previous output when
+         * the manifest shows that their inputs did not change.
+         */
+        safihr::RunManifest manifest, previous;
+        std::vector <std::string> previous_rows;
+        std::vector <std::int64_t> reuse(plan.size(), -1);
+
+        if (!opts.manifest.empty()) {
+            std::uint64_t setup = safihr::Hash()
+                .update(weather.content_hash()).update(begin).update(end)
+                .update(opts.latitude).update(opts.compact).value();
+
+            safihr::make_manifest(plan, engine.species(), setup, opts.output,
+                                  manifest);
+
+            if (safihr::read_manifest(opts.manifest, previous) &&
+                previous.output == opts.output &&
+                read_result_rows(opts.output, previous_rows) &&
+                previous_rows.size() == previous.rows.size())
+                reuse = manifest.reuse(previous, plan);
+        }
+
+        std::vector <std::uint32_t> rows;
+        for (std::size_t row = 0, e = plan.size(); row != e; ++row)
+            if (reuse[row] < 0)
+                rows.push_back(static_cast <std::uint32_t>(row));
+
+        safihr::PlanTable changed;
+        const bool partial = rows.size() != plan.size();
+        if (partial)
+            safihr::select_rows(plan, rows, changed);
+        const safihr::PlanTable &simulated_plan = partial ? changed : plan;
+
+        safihr::EngineResult result;
+        engine.run(simulated_plan, weather, begin, end, result, options);
+
+        auto simulated = std::chrono::steady_clock::now();
+
+        {
+            safihr::ResultWriter writer(opts.output,
+                                        safihr::plan_result_header);
+
+            for (std::size_t row = 0, k = 0, e = plan.size(); row != e;
+                 ++row) {
+                if (reuse[row] >= 0) {
+                    writer.push(ReusedResult {
+                            plan.id[row], previous_rows[reuse[row]] });
+                } else {
+                    writer.push(safihr::PlanResult {
+                            simulated_plan, k, result.dlev[k],
+                            result.result[k] });
+                    ++k;
+                }
+            }
+        }
+
+        if (!opts.manifest.empty())
+            safihr::write_manifest(opts.manifest, manifest);
+
+        auto written = std::chrono::steady_clock::now();
+
+        typedef std::chrono::duration <double> seconds;
+        double simulation = seconds(simulated - loaded).count();
+
+        std::cerr << plan.size() << " parcels (" << result.scenarios
+                  << " scenarios, " << result.stored << " from store, "
+                  << plan.size() - rows.size() << " from manifest), read "
+                  << seconds(loaded - start).count() << "s, simulation "
+                  << simulation << "s ("
+                  << (simulation > 0.0 ? rows.size() / simulation : 0.0)
+                  << " parcels/s), write "
+                  << seconds(written - simulated).count() << "s\n";
+    } catch (const std::exception &e) {
+        std::cerr << "safihr-cropsim: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
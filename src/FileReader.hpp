@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef SAFIHR_MODEL_FILEREADER_HPP
+#define SAFIHR_MODEL_FILEREADER_HPP
+
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include "Calendar.hpp"
+#include "Global.hpp"
+
+namespace safihr {
+
+struct file_generator_open : std::runtime_error
+{
+    explicit file_generator_open(const std::string &filepath)
+        : std::runtime_error(
+            (boost::format("can not open file `%1%'") % filepath).str())
+    {}
+};
+
+struct file_generator_format : std::runtime_error
+{
+    explicit file_generator_format(int line)
+        : std::runtime_error(
+            (boost::format("fail to read line `%1%'") % line).str())
+    {}
+};
+
+class FileReader
+{
+public:
+    std::ifstream m_input;
+    std::int32_t m_date; /* julian day number. */
+    double m_tn;
+    double m_tmin;
+    double m_tmax;
+    double m_tmoy;
+    unsigned long m_line;
+
+    FileReader()
+        : m_date(0), m_tn(1.0), m_tmin(0.0), m_tmax(0.0), m_tmoy(0.0), m_line(1)
+    {}
+
+    ~FileReader()
+    {}
+
+    void open(const std::string &filepath)
+    {
+        if (m_input.is_open())
+            close();
+
+        m_input.open(filepath.c_str());
+
+        if (!m_input)
+            throw file_generator_open(filepath);
+
+        m_input.imbue(std::locale::classic());
+
+        read_header();
+    }
+
+    void close()
+    {
+        m_input.close();
+
+        m_date = 0;
+        m_tn = 1.0;
+        m_tmin = 0.0;
+        m_tmax = 0.0;
+        m_tmoy = 0.0;
+        m_line = 1;
+    }
+
+    bool next()
+    {
+        std::string line;
+
+        if (not std::getline(m_input, line))
+            return false;
+
+        ++m_line;
+
+        boost::algorithm::split_iterator <std::string::iterator> i, e;
+        i = make_split_iterator(line, token_finder(
+                                    boost::algorithm::is_any_of(";"),
+                                    boost::algorithm::token_compress_on));
+
+        try {
+            auto date = *i++;
+            const char *str = line.c_str();
+            if (!parse_date(str + (date.begin() - line.begin()),
+                            str + (date.end() - line.begin()), m_date))
+                throw file_generator_format(m_line);
+
+            m_tmin = safihr::stod(boost::copy_range <std::string>(*i++));
+            m_tmax = safihr::stod(boost::copy_range <std::string>(*i++));
+            m_tmoy = safihr::stod(boost::copy_range <std::string>(*i++));
+        } catch (const std::exception &e) {
+            (void)e;
+            throw file_generator_format(m_line);
+        }
+
+        return true;
+    }
+
+private:
+    void read_header()
+    {
+        std::string line;
+        if (not std::getline(m_input, line))
+            throw file_generator_format(0);
+    }
+};
+
+}
+
+#endif
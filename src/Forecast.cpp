@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Calendar.hpp"
+#include "Forecast.hpp"
+
+namespace safihr {
+
+namespace {
+
+/* Years with less records are not used as lanes. */
+const int minimum_records = 300;
+
+/* Calendar slot (0 to 365) of a day, Feb 29 is always the slot 59. */
+int calendar_slot(int month, int day)
+{
+    return julian_day_number(2000, month, day) -
+        julian_day_number(2000, 1, 1);
+}
+
+}
+
+Forecast::Forecast(const WeatherSeries &weather)
+{
+    if (weather.date.empty())
+        throw forecast_failure(0);
+
+    int first, last, month, day;
+    gregorian_date(weather.date.front(), first, month, day);
+    gregorian_date(weather.date.back(), last, month, day);
+
+    const int years = last - first + 1;
+    std::vector <double> slots(years * 366,
+                               std::numeric_limits <double>::quiet_NaN());
+    std::vector <int> records(years, 0);
+
+    for (std::size_t i = 0, e = weather.size(); i != e; ++i) {
+        int year;
+        gregorian_date(weather.date[i], year, month, day);
+        if (year < first || year > last)
+            continue;
+
+        slots[(year - first) * 366 + calendar_slot(month, day)] =
+            weather.tmoy[i];
+        records[year - first]++;
+    }
+
+    /* Missing days and Feb 29 of classic years take the value of the
+     * previous day. */
+    auto known = std::find_if(slots.begin(), slots.end(),
+                              [](double value)
+                              {
+                                  return !std::isnan(value);
+                              });
+    double previous = known == slots.end() ? 0.0 : *known;
+    for (auto &value : slots) {
+        if (std::isnan(value))
+            value = previous;
+        previous = value;
+    }
+
+    for (int y = 0; y + 1 < years; ++y)
+        if (records[y] >= minimum_records &&
+            records[y + 1] >= minimum_records)
+            m_years.push_back(first + y);
+
+    if (m_years.empty())
+        throw forecast_failure(years);
+
+    const std::size_t n = m_years.size();
+    m_tmoy.resize(window * n);
+    for (std::size_t lane = 0; lane != n; ++lane) {
+        const double *src = &slots[(m_years[lane] - first) * 366];
+        for (int slot = 0; slot != window; ++slot)
+            m_tmoy[slot * n + lane] = src[slot];
+    }
+}
+
+void Forecast::run(const Specie &specie, const Photoperiod &photoperiod,
+                   const GenericState &state, double time,
+                   std::vector <double> &maturity) const
+{
+    const std::size_t n = m_years.size();
+
+    if (state.status == StatusModel::maturity) {
+        maturity.assign(n, time);
+        return;
+    }
+
+    GenericLanes lanes(n, state);
+
+    const std::int32_t begin = static_cast <std::int32_t>(time);
+    int year0, month, day;
+    gregorian_date(begin, year0, month, day);
+
+    int year = year0;
+    bool leap = is_leap_year(year);
+    int doy = begin - julian_day_number(year, 1, 1) + 1;
+
+    for (std::int32_t t = begin; ; ++t) {
+        const int slot = 366 * (year - year0) + doy - 1 +
+            ((!leap && doy >= 60) ? 1 : 0);
+        if (slot >= window)
+            break;
+
+        generic_compute_lanes(specie, photoperiod, lanes, t,
+                              &m_tmoy[slot * n], doy, leap);
+
+        if ((t & 15) == 0 && lanes.matured())
+            break;
+
+        if (++doy > (leap ? 366 : 365)) {
+            ++year;
+            doy = 1;
+            leap = is_leap_year(year);
+        }
+    }
+
+    maturity.swap(lanes.maturity);
+}
+
+void Forecast::quantiles(const std::vector <double> &maturity,
+                         const std::vector <double> &probabilities,
+                         std::vector <double> &out)
+{
+    std::vector <double> sorted(maturity);
+    std::sort(sorted.begin(), sorted.end());
+
+    out.clear();
+    for (double p : probabilities) {
+        if (sorted.empty()) {
+            out.push_back(infinity);
+            continue;
+        }
+
+        double pos = std::max(0.0, std::min(1.0, p)) * (sorted.size() - 1);
+        std::size_t lo = static_cast <std::size_t>(pos);
+        double frac = pos - lo;
+
+        if (frac == 0.0 || sorted[lo + 1] == infinity)
+            out.push_back(frac == 0.0 ? sorted[lo] : infinity);
+        else
+            out.push_back(sorted[lo] + frac * (sorted[lo + 1] - sorted[lo]));
+    }
+}
+
+}
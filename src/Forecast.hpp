@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SAFIHR_MODEL_FORECAST_HPP
+#define SAFIHR_MODEL_FORECAST_HPP
+
+#include <boost/format.hpp>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include "CropModel.hpp"
+#include "Weather.hpp"
+
+namespace safihr {
+
+struct forecast_failure : std::runtime_error
+{
+    explicit forecast_failure(std::size_t years)
+        : std::runtime_error(
+            (boost::format("Forecast: need two consecutive years of weather"
+                           " (%1% years found)") % years).str())
+    {}
+};
+
+/**
+ * Maturity forecast from the climatology of a weather series. Each
+ * historical year Y of the series is a lane: the rest of the season is
+ * simulated with the weather of Y and Y + 1 taken at the same calendar
+ * days. All the lanes are computed together, day by day, with the
+ * state of the lanes stored in arrays and a branch free loop over the
+ * lanes.
+ */
+class Forecast
+{
+public:
+    /** Slots of a two years window, each year has 366 calendar days. */
+    static const int window = 2 * 366;
+
+    explicit Forecast(const WeatherSeries &weather);
+
+    /** Number of lanes (historical years). */
+    std::size_t lanes() const
+    {
+        return m_years.size();
+    }
+
+    /** The historical year of a lane. */
+    int year(std::size_t lane) const
+    {
+        return m_years[lane];
+    }
+
+    /**
+     * Run the generic model from @e state for each lane. @e time is
+     * the next day to compute, like GenericModel::compute. @e maturity
+     * receives for each lane the day the model reaches the maturity or
+     * infinity if it is not reached in the two years window.
+     */
+    void run(const Specie &specie, const Photoperiod &photoperiod,
+             const GenericState &state, double time,
+             std::vector <double> &maturity) const;
+
+    /**
+     * Quantiles of the forecast: @e probabilities are in [0, 1] and
+     * the values are linearly interpolated. Lanes without maturity
+     * count as infinity.
+     */
+    static void quantiles(const std::vector <double> &maturity,
+                          const std::vector <double> &probabilities,
+                          std::vector <double> &out);
+
+private:
+    std::vector <int> m_years;
+    std::vector <double> m_tmoy; /* [slot * lanes + lane]. */
+};
+
+}
+
+#endif
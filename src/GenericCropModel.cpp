@@ -24,402 +24,105 @@
 
 #include <vle/devs/Dynamics.hpp>
 #include <vle/devs/DynamicsDbg.hpp>
-#include <vle/utils/DateTime.hpp>
+#include <vle/utils/i18n.hpp>
 #include <vle/utils/Package.hpp>
-#include <vle/utils/Trace.hpp>
-#include <boost/algorithm/string.hpp>
-#include <boost/numeric/conversion/cast.hpp>
-#include <memory>
 #include <algorithm>
-#include <valarray>
-#include <fstream>
-#include <iomanip>
-#include <cmath>
-#include <exception>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+#include "BuiltinSpecies.hpp"
+#include "CropModel.hpp"
 #include "Global.hpp"
+#include "Metrics.hpp"
+#include "SharedCache.hpp"
+#include "Trace.hpp"
 
 namespace safihr {
 
-struct crop_model_internal_failure : std::runtime_error
-{
-    explicit crop_model_internal_failure()
-        : std::runtime_error("Crop model: internal error, contact developer")
-    {}
-};
+namespace {
 
-struct crop_model_failure : std::runtime_error
-{
-    explicit crop_model_failure(const std::string &msg)
-        : std::runtime_error(msg)
-    {}
-};
-
-struct crop_model_file_open_failure : std::runtime_error
-{
-    explicit crop_model_file_open_failure(const std::string &filepath)
-        : std::runtime_error(
-            (vle::fmt("Crop model: fail to open data `%1%' file")
-             % filepath).str())
-    {}
-};
+Metrics metrics("GenericCropModel");
 
-struct crop_model_file_failure : std::runtime_error
-{
-    explicit crop_model_file_failure(uint line)
-        : std::runtime_error(
-            (vle::fmt("Crop model: fail to read data at line %1%")
-             % line).str())
-    {}
-};
-
-struct crop_model_unknown_specie : std::runtime_error
-{
-    explicit crop_model_unknown_specie(const std::string &speciename)
-        : std::runtime_error(
-            (vle::fmt("Crop model: unknown specie `%1%'") % speciename).str())
-    {}
-};
-
-constexpr double infinity = std::numeric_limits <double>::infinity();
-
-struct Specie
-{
-    std::string name;
-    std::valarray <double> data;
-
-    enum DataId {
-        LEV_AMF = 0,
-        AMF_LAX,
-        SEM_LEV,
-        LEV_MAT,
-        TBASE,
-        TMAXDEV,
-        PBASE,
-        POPT,
-        TFROID,
-        AMPFROID,
-        VBASE,
-        VSAT,
-        ADENS,
-        CROIRAC,
-        BDENS,
-        LAICOMP,
-        TCOUVMAX,
-        PENTECOUVMAX,
-        INFRECOUV,
-        HMAX,
-        HBASE,
-        GRAINES_REC
-    };
-
-    Specie(const std::string &name)
-        : name(name), data(0.0, 22)
-    {}
-
-    Specie()
-        : name(), data(0.0, 22)
-    {}
-};
-
-std::ostream& operator<<(std::ostream& out, const Specie& specie)
-{
-    std::streamsize sz = out.precision(); /* keep the old precision
-                                           * value to restore it at
-                                           * the end of the stream.
-                                           */
-
-    return out << std::setprecision(std::numeric_limits <double>::digits10)
-               << "NAME " << specie.name
-               << " LEV_AMF " << specie.data[Specie::LEV_AMF]
-               << " AMF_LAX " << specie.data[Specie::AMF_LAX]
-               << " SEM_LEV " << specie.data[Specie::SEM_LEV]
-               << " LEV_MAT " << specie.data[Specie::LEV_MAT]
-               << " TBASE " << specie.data[Specie::TBASE]
-               << " TMAXDEV " << specie.data[Specie::TMAXDEV]
-               << " PBASE " << specie.data[Specie::PBASE]
-               << " POPT " << specie.data[Specie::POPT]
-               << " TFROID " << specie.data[Specie::TFROID]
-               << " AMPFROID " << specie.data[Specie::AMPFROID]
-               << " VBASE " << specie.data[Specie::VBASE]
-               << " VSAT " << specie.data[Specie::VSAT]
-               << " ADENS " << specie.data[Specie::ADENS]
-               << " CROIRAC " << specie.data[Specie::CROIRAC]
-               << " BDENS " << specie.data[Specie::BDENS]
-               << " LAICOMP " << specie.data[Specie::LAICOMP]
-               << " TCOUVMAX " << specie.data[Specie::TCOUVMAX]
-               << " PENTECOUVMAX " << specie.data[Specie::PENTECOUVMAX]
-               << " INFRECOUV " << specie.data[Specie::INFRECOUV]
-               << " HMAX " << specie.data[Specie::HMAX]
-               << " HBASE " << specie.data[Specie::HBASE]
-               << "GRAINES_REC " << specie.data[Specie::GRAINES_REC]
-               << "\n"
-               << std::setprecision(sz);
-        ;
-}
-
-struct SpecieFileReader
-{
-    std::ifstream file;
-
-    SpecieFileReader(const std::string &filename)
-        : file(filename)
-    {
-        if (!file.is_open())
-            throw crop_model_file_open_failure(filename);
-
-        file.imbue(std::locale::classic());
-    }
-
-    Specie get(const std::string &speciename)
-    {
-        uint line_id = 1;
-        std::string line;
-
-        std::getline(file, line); /* Forget the header of the
-                                   * file. */
-
-        if (file.eof() || file.fail())
-            throw crop_model_file_failure(line_id);
-
-        do {
-            line_id++;
-            std::getline(file, line);
-
-            if (file.fail())
-                break;
-
-            try {
-                std::vector <std::string> result;
-                boost::algorithm::split(result, line,
-                                        boost::algorithm::is_any_of(";"),
-                                        boost::algorithm::token_compress_on);
-
-                if (result.at(0) == speciename) {
-                    Specie specie(speciename);
-
-                    std::transform(result.begin() + 1,
-                                   result.end(),
-                                   std::begin(specie.data),
-                                   [] (const std::string &str) -> double
-                                   {
-                                       if (str == "infinity")
-                                           return infinity;
-                                       else
-                                           return safihr::stod(str);
-                                   });
-
-                    DTraceModel((vle::fmt("%1%") % specie).str());
-
-                    //assert(specie.data[Specie::SEM_LEV] == 150);
-                    //assert(specie.data[Specie::LEV_MAT] == 1232);
-                    //assert(specie.data[Specie::TBASE] == 0);
-                    //assert(specie.data[Specie::TMAXDEV] == 28);
-                    //assert(specie.data[Specie::TFROID] == 6.5);
-                    //assert(specie.data[Specie::PBASE] == 6.3);
-
-                    return specie;
-                }
-            } catch (const std::exception &e) {
-                (void)e;
-                throw crop_model_file_failure(line_id);
-            }
-        } while (!file.eof());
-
-        throw crop_model_unknown_specie(speciename);
-    }
-};
-
-struct Model
-{
-    StatusModel status;
-    vle::devs::Time day_lev;
-
-    Model(StatusModel status)
-        : status(status), day_lev(vle::devs::infinity)
-    {}
-
-    virtual ~Model()
-    {}
-
-    virtual std::string name() const = 0;
-
-    virtual StatusModel compute(vle::devs::Time time, double tmoy) = 0;
-};
-
-struct LinModel : Model
+/**
+ * The species read by the models of the plugin with their photoperiod
+ * tables. A specie is read and its photoperiod computed once for all
+ * the parcels and all the seasons. An empty filepath selects the
+ * built-in species.
+ */
+class SpecieCache
 {
-    double sum;
-
-    LinModel()
-        : Model(StatusModel::sown), sum(0.0)
-    {}
-
-    virtual ~LinModel()
-    {}
-
-    virtual std::string name() const
-    {
-        return "LIN";
-    }
-
-    virtual StatusModel compute(vle::devs::Time time, double tmoy) override
+public:
+    struct Entry
     {
-        (void)time;
-
-        sum += tmoy - 5;
-
-        switch (status) {
-        case StatusModel::unavailable:
-        case StatusModel::maturity:
-            break;
-        case StatusModel::sown:
-            if (sum >= 50.0) {
-                status = StatusModel::raised;
-                Model::day_lev = time;
-                sum = 0.0;
-            }
-            break;
-        case StatusModel::raised:
-            if (sum >= 500.0) {
-                status = StatusModel::flowering;
-                sum = 0.0;
-            }
-            break;
-        case StatusModel::flowering:
-            if (sum >= 400) {
-                status = StatusModel::maturity;
-                sum = 0.0;
-            }
-            break;
-        }
-
-        return status;
-    }
-};
+        Specie specie;
+        std::shared_ptr <const Photoperiod> photoperiod; /* null for LIN. */
+    };
 
-struct GenericModel : Model
-{
-    const Specie specie;
-    double latitude;
-    double tdev_sum;
-    std::valarray <double> fp;
-    std::valarray <double> fp_leapyear;
-    double udev;
-    double vdd;
-
-    void initialize(std::valarray <double> &fp, vle::devs::Time nbday)
+    std::uint16_t find(const std::string &filepath, const std::string &name,
+                       double latitude)
     {
-        fp.resize(boost::numeric_cast <size_t>(nbday));
-
-        if (specie.data[Specie::PBASE] != infinity) {
-            double lat = M_PI * latitude / 180.0;
-            double jjulian = 1;
-
-            for (uint i = 0, end = fp.size(); i < end; ++i) {
-                double dec = std::asin(
-                    0.3978 * std::sin(
-                        (2.0 * M_PI * (jjulian - 80.0) / nbday) +
-                        ((0.0335 * (std::sin(2.0 * M_PI * jjulian) -
-                                    std::sin(2.0 * M_PI * 80.0))) / nbday)));
-
-                double ph = 24.0 *
-                    (std::acos(
-                        ((-0.10453 / std::cos(lat)) *
-                         std::cos(dec)) - (std::tan(lat) *
-                                           std::tan(dec)))) / M_PI;
-
-                fp[i] = std::max(0.0,
-                                 (ph - specie.data[Specie::PBASE]) /
-                                 (specie.data[Specie::POPT] -
-                                  specie.data[Specie::PBASE]));
-                ++jjulian;
-            }
+        std::lock_guard <std::mutex> lock(m_mutex);
+
+        auto key = std::make_tuple(filepath, name, latitude);
+        auto it = m_ids.find(key);
+        if (it != m_ids.end())
+            return it->second;
+
+        Entry entry;
+        if (name == "LIN") {
+            entry.specie.name = name;
+        } else if (filepath.empty()) {
+            entry.specie = builtin_specie(name);
+            entry.photoperiod = make_photoperiod(entry.specie, latitude);
         } else {
-            fp = 1;
+            Metrics::Scope scope(metrics, Metrics::parse);
+            entry.specie = SpecieFileReader(filepath).get(name);
+            entry.photoperiod = make_photoperiod(entry.specie, latitude);
         }
-    }
-
-    GenericModel(vle::devs::Time time, const Specie &specie, double latitude)
-        : Model(StatusModel::sown), specie(specie), latitude(latitude),
-        tdev_sum(0.0), udev(0.0), vdd(0.0)
-    {
-        (void)time;
 
-        initialize(fp, 365.0);
-        initialize(fp_leapyear, 366.0);
+        std::uint16_t id = static_cast <std::uint16_t>(m_entries.size());
+        m_entries.emplace_back(std::move(entry));
+        m_ids.emplace(key, id);
 
-        udev = 0.0;
-        vdd = 0.0;
-        tdev_sum = 0.0;
+        return id;
     }
 
-    virtual std::string name() const
+    const Entry& get(std::uint16_t id) const
     {
-        return specie.name;
-    }
-
-    virtual StatusModel compute(vle::devs::Time time, double tmoy) override
-    {
-        if (vle::utils::DateTime::dayOfYear(time) == 1) {
-            if (vle::utils::DateTime::isLeapYear(time))
-                std::swap(fp, fp_leapyear);
-            else if (vle::utils::DateTime::isLeapYear(time - 1.0))
-                std::swap(fp, fp_leapyear);
-        }
+        std::lock_guard <std::mutex> lock(m_mutex);
 
-        double tdev = (tmoy >= specie.data[Specie::TMAXDEV]) ?
-            //specie.data[Specie::TMAXDEV] :
-            std::max(0.0, specie.data[Specie::TMAXDEV]
-                     - specie.data[Specie::TBASE]) :
-            std::max(0.0, tmoy - specie.data[Specie::TBASE]);
-
-        tdev_sum += tdev;
-
-        if (tdev_sum >= specie.data[Specie::SEM_LEV] && Model::day_lev ==
-            vle::devs::infinity) {
-            Model::day_lev = time;
-            status = StatusModel::raised;
+        return m_entries[id];
+    }
 
-            DTraceModel((vle::fmt("[%1%] is lev\n") % specie.name).str());
-        }
+private:
+    std::deque <Entry> m_entries; /* stable references. */
+    std::map <std::tuple <std::string, std::string, double>,
+              std::uint16_t> m_ids;
+    mutable std::mutex m_mutex;
+};
 
-        double jvi = (specie.data[Specie::TFROID] == infinity) ? 0.0 :
-            std::max(0.0, (1.0 - (((specie.data[Specie::TFROID] - tmoy) /
-                                   specie.data[Specie::AMPFROID])
-                                  * ((specie.data[Specie::TFROID] - tmoy) /
-                                     specie.data[Specie::AMPFROID]))));
-
-        double old_vdd = vdd;
-        vdd = time < Model::day_lev ? 0.0 : old_vdd + jvi;
-
-        if (status == StatusModel::raised) {
-            double fv = specie.data[Specie::VBASE] == 1.0 ? 1.0 :
-                std::max(0.0,
-                         std::min(1.0,
-                                  ((old_vdd - specie.data[Specie::VBASE]) /
-                                   (specie.data[Specie::VSAT]
-                                    - specie.data[Specie::VBASE]))));
-
-            udev += tdev * fv * fp[vle::utils::DateTime::dayOfYear(time)];
-
-            DTraceModel(vle::fmt("%1%: vdd=%2% jvi=%3% udev=%4%"
-                                 " fv=%5% fp=%6% (day=%7%\n") % specie.name %
-                        vdd % jvi % udev % fv %
-                        fp[vle::utils::DateTime::dayOfYear(time)] %
-                        vle::utils::DateTime::dayOfYear(time));
-
-            if (udev > specie.data[Specie::LEV_MAT]) {
-                status = StatusModel::maturity;
-                DTraceModel((vle::fmt("[%1%] harvestable %2% > %3%") %
-                             specie.name % udev %
-                             specie.data[Specie::LEV_MAT]).str());
-            }
-        }
+SpecieCache species;
 
-        return status;
-    }
+/**
+ * A completed season of a parcel: julian days of sowing, emergence
+ * and harvest (the day the maturity is reported).
+ */
+struct Season
+{
+    std::int32_t sowing;
+    std::int32_t lev;
+    std::int32_t harvest;
+    std::uint16_t specie;
 };
 
+}
+
 class GenericCropModel : public vle::devs::Dynamics
 {
     std::shared_ptr <Model> m_model;
@@ -431,6 +134,70 @@ class GenericCropModel : public vle::devs::Dynamics
     StatusModel previous_status, new_status;
     bool is_sown;
     std::string m_paramfilename;
+    std::uint32_t m_id;
+    bool m_numeric_name;
+    bool m_compact;
+    std::vector <Season> m_seasons;
+    Season m_season;
+
+    /**
+     * Start a season. The model of the previous season is restarted if
+     * the specie is the same, otherwise its storage is reused when
+     * possible.
+     */
+    void sow(const vle::devs::Time &time, const std::string &name)
+    {
+        std::uint16_t id = species.find(m_paramfilename, name, m_latitude);
+        const SpecieCache::Entry &entry = species.get(id);
+
+        if (m_model && m_model->name() == name) {
+            m_model->reset();
+        } else if (!entry.photoperiod) {
+            m_model = std::make_shared <LinModel>();
+        } else if (m_compact) {
+            if (CompactGenericModel *compact =
+                dynamic_cast <CompactGenericModel*>(m_model.get()))
+                compact->reset(entry.specie, entry.photoperiod);
+            else
+                m_model = std::make_shared <CompactGenericModel>(
+                    entry.specie, entry.photoperiod);
+        } else if (GenericModel *generic =
+                   dynamic_cast <GenericModel*>(m_model.get())) {
+            generic->reset(entry.specie, entry.photoperiod);
+        } else {
+            m_model = std::make_shared <GenericModel>(
+                time, entry.specie, m_latitude, entry.photoperiod);
+        }
+
+        m_season.sowing = static_cast <std::int32_t>(time);
+        m_season.lev = -1;
+        m_season.harvest = -1;
+        m_season.specie = id;
+
+        previous_status = StatusModel::unavailable;
+        new_status = StatusModel::unavailable;
+        m_last_date = time;
+        m_next_date = time + 1.0;
+        m_sigma = m_next_date - m_last_date;
+        is_sown = true;
+
+        trace(TraceEvent::crop_specie, m_id, time, name);
+        trace(TraceEvent::crop_sown, m_id, time, m_latitude);
+    }
+
+    /**
+     * The maturity is reported, store the season and wait for the next
+     * sowing without any internal transition.
+     */
+    void harvest(const vle::devs::Time &time)
+    {
+        m_season.lev = static_cast <std::int32_t>(m_model->day_lev);
+        m_season.harvest = static_cast <std::int32_t>(time);
+        m_seasons.push_back(m_season);
+
+        is_sown = false;
+        m_sigma = vle::devs::infinity;
+    }
 
 public:
     GenericCropModel(const vle::devs::DynamicsInit &dinit,
@@ -440,19 +207,32 @@ public:
         m_next_date(vle::devs::infinity),
         m_sigma(vle::devs::infinity)
     {
+        vle::utils::Package package("safihr.cropmodel");
+
         m_latitude = evts.getDouble("latitude");
-        m_paramfilename = evts.getString("filename");
+        if (evts.exist("filename"))
+            m_paramfilename = data_filepath(package,
+                                            evts.getString("filename"));
+        m_compact = evts.exist("compact") && evts.getBoolean("compact");
+
+        metrics.attach();
     }
 
     virtual ~GenericCropModel()
-    {}
+    {
+        metrics.detach();
+    }
 
-    virtual vle::devs::Time init(const vle::devs::Time &time)
+    virtual void finish()
     {
-        (void)time;
+        trace_flush();
+    }
 
-        DTraceModel(vle::fmt("GenericCropModel %1% builded\n") %
-                    getModelName());
+    virtual vle::devs::Time init(const vle::devs::Time &time)
+    {
+        m_id = std::strtoul(getModelName().c_str(), nullptr, 10);
+        m_numeric_name = std::to_string(m_id) == getModelName();
+        trace(TraceEvent::crop_built, m_id, time);
 
         previous_status = StatusModel::unavailable;
         new_status = StatusModel::unavailable;
@@ -482,16 +262,51 @@ public:
                               new vle::value::Double(m_model->day_lev));
             ret->putAttribute("status",
                               new vle::value::String(to_string(new_status)));
+            ret->putAttribute("season",
+                              new vle::value::Integer(m_seasons.size()));
 
             output.push_back(ret);
+            metrics.events(1);
         }
     }
 
+    /** Trace the state of a generic model after a computed day. */
+    void trace_day(const vle::devs::Time &time) const
+    {
+        if (const GenericModel *mdl =
+            dynamic_cast <const GenericModel*>(m_model.get()))
+            trace(TraceEvent::crop_day, m_id, time, mdl->vdd(), mdl->udev(),
+                  m_tmoy);
+        else if (const CompactGenericModel *compact =
+                 dynamic_cast <const CompactGenericModel*>(m_model.get()))
+            trace(TraceEvent::crop_day, m_id, time, compact->vdd(),
+                  compact->udev(), m_tmoy);
+    }
+
     virtual void internalTransition(const vle::devs::Time &time)
     {
+        metrics.internal_transition();
+
         if (is_sown) {
+            /* The maturity was sent by the output function. */
+            if (new_status == StatusModel::maturity) {
+                harvest(time);
+                return;
+            }
+
             previous_status = new_status;
-            new_status = m_model->compute(time, m_tmoy);
+
+            {
+                Metrics::Scope scope(metrics, Metrics::compute);
+                new_status = m_model->compute(time, m_tmoy);
+            }
+
+            if (trace_config().enabled)
+                trace_day(time);
+
+            if (previous_status != new_status)
+                trace(TraceEvent::crop_status, m_id, time,
+                      static_cast <double>(new_status), m_model->day_lev);
 
             m_last_date = time;
             m_sigma = 1.0;
@@ -502,6 +317,8 @@ public:
     virtual void externalTransition(const vle::devs::ExternalEventList &msgs,
                                     const vle::devs::Time &time)
     {
+        metrics.external_transition();
+
         if (!is_sown) {
             auto it = msgs.begin();
             do {
@@ -517,27 +334,14 @@ public:
                     uint landunit_id =
                         (*it)->attributes().getInt("landunit_id");
 
-                    if (getModelName() == std::to_string(landunit_id)) {
-                        if (specie_name == "LIN") {
-                            m_model = std::shared_ptr <Model>(new LinModel());
-                        } else {
-                            vle::utils::Package package("safihr.cropmodel");
-                            SpecieFileReader filereader(
-                                package.getDataFile(m_paramfilename));
-                            m_model = std::shared_ptr <Model>(
-                                new GenericModel(time,
-                                                 filereader.get(specie_name),
-                                                 m_latitude));
-                        }
-
-                        m_last_date = time;
-                        m_next_date = time + 1.0;
-                        m_sigma = m_next_date - m_last_date;
-                        is_sown = true;
-
-                        DTraceModel((vle::fmt("Parcelle %1% is started with"
-                                              " %2%\n")
-                                     % landunit_id % specie_name).str());
+                    if (m_numeric_name && m_id == landunit_id) {
+                        sow(time, specie_name);
+
+                        /* Sown after the weather of the day, which is
+                         * forwarded by the AI. */
+                        if ((*it)->attributes().exist("tmoy"))
+                            m_tmoy = (*it)->attributes().getDouble("tmoy");
+                        break;
                     }
                     ++it;
                 }
@@ -570,6 +374,8 @@ public:
     virtual vle::value::Value * observation(
         const vle::devs::ObservationEvent &event) const
     {
+        metrics.observation();
+
         if (is_sown) {
             if (event.onPort("name"))
                 return new vle::value::String(m_model->name());
@@ -578,13 +384,40 @@ public:
                 return new vle::value::String(to_string(new_status));
         }
 
+        if (event.onPort("seasons"))
+            return new vle::value::Integer(m_seasons.size());
+
+        if (event.onPort("history")) {
+            vle::value::Set *history = new vle::value::Set();
+            for (const auto &season : m_seasons) {
+                vle::value::Set *item = new vle::value::Set();
+                item->add(new vle::value::String(
+                              species.get(season.specie).specie.name));
+                item->add(new vle::value::Double(season.sowing));
+                item->add(new vle::value::Double(season.lev));
+                item->add(new vle::value::Double(season.harvest));
+                history->add(item);
+            }
+            return history;
+        }
+
         const GenericModel* mdl = dynamic_cast <GenericModel*>(m_model.get());
         if (mdl) {
             if (event.onPort("udev"))
-                return new vle::value::Double(mdl->udev);
+                return new vle::value::Double(mdl->udev());
+
+            if (event.onPort("tdev"))
+                return new vle::value::Double(mdl->tdev_sum());
+        }
+
+        const CompactGenericModel* compact =
+            dynamic_cast <CompactGenericModel*>(m_model.get());
+        if (compact) {
+            if (event.onPort("udev"))
+                return new vle::value::Double(compact->udev());
 
             if (event.onPort("tdev"))
-                return new vle::value::Double(mdl->tdev_sum);
+                return new vle::value::Double(compact->tdev_sum());
         }
 
         return vle::devs::Dynamics::observation(event);
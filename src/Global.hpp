@@ -27,7 +27,10 @@
 
 #include <exception>
 #include <string>
-#include <vle/utils/i18n.hpp>
+#include <stdexcept>
+#include <locale.h>
+#include <stdlib.h>
+#include <boost/format.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/cast.hpp>
 
@@ -44,7 +47,7 @@ struct global_conversion_error : std::runtime_error
 {
     global_conversion_error(const std::string &str)
         : std::runtime_error(
-            (vle::fmt("Fail to convert `%1%' in a number") % str).str())
+            (boost::format("Fail to convert `%1%' in a number") % str).str())
     {}
 };
 
@@ -68,6 +71,52 @@ inline std::string to_string(StatusModel status)
     }
 };
 
+/**
+ * The status named @e str (see to_string).
+ *
+ * @throw global_unknown_model_status.
+ */
+inline StatusModel status_model(const std::string &str)
+{
+    if (str == "raised")
+        return StatusModel::raised;
+    if (str == "maturity")
+        return StatusModel::maturity;
+    if (str == "flowering")
+        return StatusModel::flowering;
+    if (str == "sown")
+        return StatusModel::sown;
+    if (str == "unavailable")
+        return StatusModel::unavailable;
+
+    throw global_unknown_model_status();
+}
+
+/**
+ * The path of a data file: absolute paths are used as is, other names
+ * are searched in the data directory of the package.
+ */
+template <typename Package>
+std::string data_filepath(const Package &package, const std::string &name)
+{
+    if (!name.empty() && name[0] == '/')
+        return name;
+
+    return package.getDataFile(name);
+}
+
+/**
+ * strtod in the C locale, whatever LC_NUMERIC of the process is (a VLE
+ * GUI may use a locale with a decimal comma).
+ */
+inline double strtod_c(const char *str, char **end)
+{
+    static const locale_t c_locale = ::newlocale(LC_NUMERIC_MASK, "C",
+                                                 static_cast <locale_t>(0));
+
+    return ::strtod_l(str, end, c_locale);
+}
+
 inline double stod(const std::string &str)
 {
     try {
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef SAFIHR_MODEL_HASH_HPP
+#define SAFIHR_MODEL_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace safihr {
+
+/**
+ * 32 bits FNV-1a hash of a null terminated string with @e seed as
+ * offset basis (2166136261 for the standard hash). Used by the perfect
+ * hash of the built-in species.
+ */
+constexpr std::uint32_t string_hash(const char *str, std::uint32_t seed)
+{
+    return *str ? string_hash(str + 1,
+                              (seed ^ static_cast <unsigned char>(*str))
+                              * 16777619u)
+        : seed;
+}
+
+/**
+ * 64 bits FNV-1a hash, used for content hashes of inputs and
+ * scenarios.
+ */
+class Hash
+{
+    std::uint64_t m_value;
+
+public:
+    Hash()
+        : m_value(UINT64_C(0xcbf29ce484222325))
+    {}
+
+    Hash& update(const void *data, std::size_t size)
+    {
+        const unsigned char *str = static_cast <const unsigned char*>(data);
+
+        for (std::size_t i = 0; i != size; ++i) {
+            m_value ^= str[i];
+            m_value *= UINT64_C(0x100000001b3);
+        }
+
+        return *this;
+    }
+
+    template <typename T>
+    Hash& update(const T &value)
+    {
+        return update(&value, sizeof(value));
+    }
+
+    Hash& update(const std::string &str)
+    {
+        update(str.size());
+        return update(str.data(), str.size());
+    }
+
+    std::uint64_t value() const
+    {
+        return m_value;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SAFIHR_MODEL_MANIFEST_HPP
+#define SAFIHR_MODEL_MANIFEST_HPP
+
+#include <boost/format.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "CropModel.hpp"
+#include "Hash.hpp"
+#include "Plan.hpp"
+
+namespace safihr {
+
+struct manifest_failure : std::runtime_error
+{
+    explicit manifest_failure(const std::string &filepath, std::size_t line)
+        : std::runtime_error(
+            (boost::format("Manifest: fail to read line `%1%' of `%2%'")
+             % line % filepath).str())
+    {}
+};
+
+/**
+ * The inputs of a run of a plan: a hash of everything shared by the
+ * rows (weather, period, latitude, options), a hash of the parameters
+ * of each specie and a hash of each plan row, in file order. Comparing
+ * the manifests of two runs gives the rows to simulate again.
+ *
+ * The file is a text file of `kind;key;hash' lines written beside the
+ * output of the run.
+ */
+struct RunManifest
+{
+    std::string output;
+    std::uint64_t setup;
+    std::map <std::string, std::uint64_t> species;
+    std::vector <std::uint64_t> rows;
+
+    RunManifest()
+        : setup(0)
+    {}
+
+    /**
+     * For each row of @e plan (described by this manifest), the row of
+     * the @e previous run with the same content and an unchanged specie,
+     * or -1 if the row must be simulated again.
+     */
+    std::vector <std::int64_t> reuse(const RunManifest &previous,
+                                     const PlanTable &plan) const
+    {
+        std::vector <std::int64_t> ret(rows.size(), -1);
+
+        if (previous.setup != setup)
+            return ret;
+
+        /* 0 for the species without parameters (LIN). */
+        auto hash = [](const RunManifest &manifest, const std::string &name)
+            {
+                auto it = manifest.species.find(name);
+                return it == manifest.species.end() ? UINT64_C(0) :
+                    it->second;
+            };
+
+        std::vector <bool> changed(plan.species.size());
+        for (std::size_t i = 0, e = changed.size(); i != e; ++i) {
+            const std::string &name = plan.species.name(
+                static_cast <std::uint16_t>(i));
+            changed[i] = hash(*this, name) != hash(previous, name);
+        }
+
+        std::unordered_map <std::uint64_t, std::int64_t> old;
+        for (std::size_t i = 0, e = previous.rows.size(); i != e; ++i)
+            old.emplace(previous.rows[i], static_cast <std::int64_t>(i));
+
+        for (std::size_t row = 0, e = rows.size(); row != e; ++row) {
+            if (changed[plan.specie[row]])
+                continue;
+
+            auto it = old.find(rows[row]);
+            if (it != old.end())
+                ret[row] = it->second;
+        }
+
+        return ret;
+    }
+};
+
+/* Follows the kernel_version of CropEngine::scenario_hash. */
+constexpr std::uint32_t manifest_version = 1;
+
+inline std::uint64_t specie_hash(const Specie &specie)
+{
+    return Hash().update(specie.name)
+        .update(&specie.data[0], specie.data.size() * sizeof(double))
+        .value();
+}
+
+/** A hash of the content of a plan row, its identifier excepted. */
+inline std::uint64_t plan_row_hash(const PlanTable &plan, std::size_t row)
+{
+    return Hash().update(plan.specie_name(row))
+        .update(plan.surface1[row])
+        .update(plan.surface2[row])
+        .update(plan.dmin[row])
+        .update(plan.dmax[row])
+        .update(plan.duration[row])
+        .value();
+}
+
+/**
+ * Build the manifest of a run of @e plan with the @e species catalog.
+ * @e setup is a hash of the inputs shared by all the rows.
+ */
+inline void make_manifest(const PlanTable &plan,
+                          const std::vector <Specie> &species,
+                          std::uint64_t setup, const std::string &output,
+                          RunManifest &manifest)
+{
+    manifest.output = output;
+    manifest.setup = Hash().update(manifest_version).update(setup).value();
+
+    manifest.species.clear();
+    for (const auto &specie : species)
+        manifest.species[specie.name] = specie_hash(specie);
+
+    manifest.rows.resize(plan.size());
+    for (std::size_t row = 0, e = plan.size(); row != e; ++row)
+        manifest.rows[row] = plan_row_hash(plan, row);
+}
+
+/**
+ * Read a manifest.
+ *
+ * @return false if the file does not exist.
+ * @throw manifest_failure if the file is malformed.
+ */
+inline bool read_manifest(const std::string &filepath, RunManifest &manifest)
+{
+    std::ifstream file(filepath);
+    if (!file.is_open())
+        return false;
+
+    manifest = RunManifest();
+
+    std::string line;
+    std::size_t id = 0;
+    while (std::getline(file, line)) {
+        ++id;
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::string::size_type first = line.find(';');
+        std::string::size_type last = line.rfind(';');
+        if (first == std::string::npos)
+            throw manifest_failure(filepath, id);
+
+        std::string kind = line.substr(0, first);
+        std::string key = first == last ? std::string() :
+            line.substr(first + 1, last - first - 1);
+
+        char *end = nullptr;
+        const char *value = line.c_str() + last + 1;
+        std::uint64_t hash = std::strtoull(value, &end, 16);
+        if (end == value || *end != '\0')
+            throw manifest_failure(filepath, id);
+
+        if (kind == "setup")
+            manifest.setup = hash;
+        else if (kind == "output")
+            manifest.output = key;
+        else if (kind == "specie")
+            manifest.species[key] = hash;
+        else if (kind == "row")
+            manifest.rows.push_back(hash);
+        else
+            throw manifest_failure(filepath, id);
+    }
+
+    return true;
+}
+
+/**
+ * Write a manifest into a temporary file renamed at the end, a reader
+ * never sees a partial manifest.
+ */
+inline void write_manifest(const std::string &filepath,
+                           const RunManifest &manifest)
+{
+    const std::string tmp = filepath + ".tmp";
+
+    {
+        std::ofstream file(tmp, std::ios::out | std::ios::trunc);
+        if (!file.is_open())
+            throw std::runtime_error("Manifest: can not write `" + tmp + "'");
+
+        auto hex = [](std::uint64_t value)
+            {
+                return (boost::format("%016x") % value).str();
+            };
+
+        file << "# safihr-cropsim manifest\n"
+             << "setup;" << hex(manifest.setup) << '\n'
+             << "output;" << manifest.output << ";0\n";
+
+        for (const auto &specie : manifest.species)
+            file << "specie;" << specie.first << ';' << hex(specie.second)
+                 << '\n';
+
+        for (auto row : manifest.rows)
+            file << "row;" << hex(row) << '\n';
+
+        if (!file)
+            throw std::runtime_error("Manifest: can not write `" + tmp + "'");
+    }
+
+    if (std::rename(tmp.c_str(), filepath.c_str()) != 0)
+        throw std::runtime_error("Manifest: can not write `" + filepath +
+                                 "'");
+}
+
+}
+
+#endif
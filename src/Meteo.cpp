@@ -24,128 +24,98 @@
 
 #include <vle/devs/Dynamics.hpp>
 #include <vle/devs/DynamicsDbg.hpp>
+#include <vle/utils/i18n.hpp>
 #include <vle/utils/Package.hpp>
-#include <boost/algorithm/string.hpp>
-#include <fstream>
-#include <string>
+#include <algorithm>
 #include <exception>
+#include <memory>
+#include <string>
+#include <thread>
 #include "Global.hpp"
+#include "Metrics.hpp"
+#include "PrefetchReader.hpp"
+#include "SharedCache.hpp"
 
 namespace safihr {
 
-struct file_generator_open : std::runtime_error
-{
-    explicit file_generator_open(const std::string &filepath)
-        : std::runtime_error(
-            (vle::fmt("can not open file `%1%'") % filepath).str())
-    {}
-};
-
-struct file_generator_format : std::runtime_error
-{
-    explicit file_generator_format(int line)
-        : std::runtime_error(
-            (vle::fmt("fail to read line `%1%'") % line).str())
-    {}
-};
-
-class FileReader
-{
-public:
-    std::ifstream m_input;
-    std::string m_date;
-    double m_tn;
-    double m_tmin;
-    double m_tmax;
-    double m_tmoy;
-    ulong m_line;
-
-    FileReader()
-        : m_tn(1.0), m_tmin(0.0), m_tmax(0.0), m_tmoy(0.0), m_line(1)
-    {}
-
-    ~FileReader()
-    {}
-
-    void open(const std::string &filepath)
-    {
-        if (m_input.is_open())
-            close();
-
-        m_input.open(filepath.c_str());
-
-        if (!m_input)
-            throw file_generator_open(filepath);
+namespace {
 
-        m_input.imbue(std::locale::classic());
-
-        read_header();
-    }
+Metrics metrics("Meteo");
 
-    void close()
-    {
-        m_input.close();
+}
 
-        m_tn = 1.0;
-        m_tmin = 0.0;
-        m_tmax = 0.0;
-        m_tmoy = 0.0;
-        m_line = 1;
-    }
+/**
+ * Send the records of a weather file, one per day. The file is read
+ * and parsed by a background thread (see PrefetchReader) at most
+ * `prefetch' records ahead of the simulation. The default is 256, or 0
+ * (no thread) on a single core. With the shared cache enabled, the
+ * parsed file is mapped from the cache instead. The `date' observation
+ * port gives the julian day of the current record.
+ */
+class Meteo : public vle::devs::Dynamics
+{
+    std::unique_ptr <PrefetchReader> m_gen;
+    std::shared_ptr <const SharedArray> m_shared; /* see shared_weather. */
+    std::size_t m_record;
+    WeatherDay m_current;
+    bool m_is_started;
 
     bool next()
     {
-        std::string line;
+        if (!m_shared) {
+            bool ret = m_gen->next();
+            m_current = m_gen->current();
+            return ret;
+        }
 
-        if (not std::getline(m_input, line))
-            return false;
+        const std::size_t records = m_shared->size() / 4;
+        const double *data = m_shared->data();
 
-        ++m_line;
-
-        boost::algorithm::split_iterator <std::string::iterator> i, e;
-        i = make_split_iterator(line, token_finder(
-                                    boost::algorithm::is_any_of(";"),
-                                    boost::algorithm::token_compress_on));
-
-        try {
-            m_date = boost::copy_range <std::string>(*i++);
-            m_tmin = safihr::stod(boost::copy_range <std::string>(*i++));
-            m_tmax = safihr::stod(boost::copy_range <std::string>(*i++));
-            m_tmoy = safihr::stod(boost::copy_range <std::string>(*i++));
-        } catch (const std::exception &e) {
-            (void)e;
-            throw file_generator_format(m_line);
+        if (m_record == records) {
+            m_current.line = records + 1;
+            return false;
         }
 
+        m_current = WeatherDay { data[m_record], data[records + m_record],
+                                 data[2 * records + m_record], m_record + 2,
+                                 static_cast <std::int32_t>(
+                                     data[3 * records + m_record]) };
+        ++m_record;
         return true;
     }
 
-private:
-    void read_header()
-    {
-        std::string line;
-        if (not std::getline(m_input, line))
-            throw file_generator_format(0);
-    }
-};
-
-class Meteo : public vle::devs::Dynamics
-{
-    FileReader m_gen;
-    bool m_is_started;
-
 public:
     Meteo(const vle::devs::DynamicsInit &init,
                   const vle::devs::InitEventList &evts)
-        : vle::devs::Dynamics(init, evts)
+        : vle::devs::Dynamics(init, evts), m_record(0),
+        m_current { 0.0, 0.0, 0.0, 1, 0 }
     {
         vle::utils::Package package("safihr.cropmodel");
 
-        m_gen.open(package.getDataFile(evts.getString("filename")));
+        long prefetch = std::thread::hardware_concurrency() > 1 ? 256 : 0;
+        if (evts.exist("prefetch"))
+            prefetch = std::max(0L, static_cast <long>(
+                                    evts.getInt("prefetch")));
+
+        {
+            Metrics::Scope scope(metrics, Metrics::parse);
+            std::string filepath = data_filepath(package,
+                                                 evts.getString("filename"));
+
+            if (shared_cache_enabled())
+                m_shared = shared_weather(filepath);
+            else
+                m_gen.reset(new PrefetchReader(
+                        filepath, static_cast <std::size_t>(prefetch)));
+        }
+
+        metrics.attach();
     }
 
     virtual ~Meteo()
-    {}
+    {
+        metrics.detach();
+    }
 
     virtual vle::devs::Time init(const vle::devs::Time &time)
     {
@@ -160,7 +130,7 @@ public:
     {
         (void)time;
 
-        return m_gen.m_tn;
+        return 1.0;
     }
 
     virtual void internalTransition(const vle::devs::Time &time)
@@ -168,9 +138,11 @@ public:
         (void)time;
 
         m_is_started = true;
+        metrics.internal_transition();
 
-        if (!m_gen.next())
-            throw file_generator_format(m_gen.m_line);
+        Metrics::Scope scope(metrics, Metrics::parse);
+        if (!next())
+            throw file_generator_format(m_current.line);
     }
 
     virtual void output(const vle::devs::Time &time,
@@ -182,25 +154,31 @@ public:
             vle::devs::ExternalEvent *ret = new vle::devs::ExternalEvent("out");
             vle::value::Map &msg = ret->attributes();
 
-            msg.addDouble("tmin", m_gen.m_tmin);
-            msg.addDouble("tmax", m_gen.m_tmax);
-            msg.addDouble("tmoy", m_gen.m_tmoy);
+            msg.addDouble("tmin", m_current.tmin);
+            msg.addDouble("tmax", m_current.tmax);
+            msg.addDouble("tmoy", m_current.tmoy);
 
             output.push_back(ret);
+            metrics.events(1);
         }
     }
 
     virtual vle::value::Value * observation(
         const vle::devs::ObservationEvent &event) const
     {
+        metrics.observation();
+
         if (event.onPort("tmin"))
-            return new vle::value::Double(m_gen.m_tmin);
+            return new vle::value::Double(m_current.tmin);
 
         if (event.onPort("tmax"))
-            return new vle::value::Double(m_gen.m_tmax);
+            return new vle::value::Double(m_current.tmax);
 
         if (event.onPort("tmoy"))
-            return new vle::value::Double(m_gen.m_tmoy);
+            return new vle::value::Double(m_current.tmoy);
+
+        if (event.onPort("date"))
+            return new vle::value::Double(m_current.date);
 
         return vle::devs::Dynamics::observation(event);
     }
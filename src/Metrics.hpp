@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SAFIHR_MODEL_METRICS_HPP
+#define SAFIHR_MODEL_METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace safihr {
+
+/**
+ * Runtime counters of a dynamics type. One instance is shared by all
+ * the models of a type; the counters are relaxed atomics so models may
+ * be run from several threads.
+ *
+ * The counters are enabled with the SAFIHR_METRICS environment
+ * variable: `1' or `-' writes the report on the standard error, any
+ * other value is the path of a file where the report is appended. When
+ * disabled, each counter costs a predictable branch. The report is a
+ * JSON line written when the last model of the type is destroyed, i.e.
+ * at the end of the experiment.
+ */
+class Metrics
+{
+public:
+    enum Timer { parse, compute };
+
+    explicit Metrics(const char *name)
+        : m_name(name), m_enabled(false), m_live(0)
+    {
+        const char *env = std::getenv("SAFIHR_METRICS");
+
+        if (env && *env && std::strcmp(env, "0") != 0) {
+            m_enabled = true;
+            m_output = env;
+        }
+
+        reset();
+    }
+
+    bool enabled() const
+    {
+        return m_enabled;
+    }
+
+    /** A new model of the type is built. */
+    void attach()
+    {
+        if (m_enabled) {
+            m_live.fetch_add(1, std::memory_order_relaxed);
+            m_instances.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /** A model is destroyed, the last one writes the report. */
+    void detach()
+    {
+        if (m_enabled && m_live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            write();
+            reset();
+        }
+    }
+
+    void internal_transition()
+    {
+        if (m_enabled)
+            m_internal.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void external_transition()
+    {
+        if (m_enabled)
+            m_external.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void events(std::size_t count)
+    {
+        if (m_enabled)
+            m_events.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void observation()
+    {
+        if (m_enabled)
+            m_observations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Adds the lifetime of the object to the parse or compute time of
+     * the type. The clock is not read when the counters are disabled.
+     */
+    class Scope
+    {
+        Metrics &m_metrics;
+        Timer m_timer;
+        std::chrono::steady_clock::time_point m_start;
+
+    public:
+        Scope(Metrics &metrics, Timer timer)
+            : m_metrics(metrics), m_timer(timer)
+        {
+            if (m_metrics.m_enabled)
+                m_start = std::chrono::steady_clock::now();
+        }
+
+        ~Scope()
+        {
+            if (m_metrics.m_enabled) {
+                auto ns = std::chrono::duration_cast <
+                    std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - m_start).count();
+
+                (m_timer == parse ? m_metrics.m_parse_ns :
+                 m_metrics.m_compute_ns).fetch_add(
+                     static_cast <std::uint64_t>(ns),
+                     std::memory_order_relaxed);
+            }
+        }
+    };
+
+    /** The report of the type as a JSON object. */
+    std::string json() const
+    {
+        std::ostringstream os;
+        os.imbue(std::locale::classic());
+        os << "{\"dynamics\": \"" << m_name
+           << "\", \"instances\": " << m_instances.load()
+           << ", \"internal_transitions\": " << m_internal.load()
+           << ", \"external_transitions\": " << m_external.load()
+           << ", \"events\": " << m_events.load()
+           << ", \"observations\": " << m_observations.load()
+           << ", \"parse_seconds\": " << m_parse_ns.load() * 1e-9
+           << ", \"compute_seconds\": " << m_compute_ns.load() * 1e-9
+           << "}";
+
+        return os.str();
+    }
+
+private:
+    const char *m_name;
+    std::string m_output;
+    bool m_enabled;
+    std::atomic <std::uint64_t> m_live;
+    std::atomic <std::uint64_t> m_instances;
+    std::atomic <std::uint64_t> m_internal;
+    std::atomic <std::uint64_t> m_external;
+    std::atomic <std::uint64_t> m_events;
+    std::atomic <std::uint64_t> m_observations;
+    std::atomic <std::uint64_t> m_parse_ns;
+    std::atomic <std::uint64_t> m_compute_ns;
+
+    void reset()
+    {
+        m_instances = 0;
+        m_internal = 0;
+        m_external = 0;
+        m_events = 0;
+        m_observations = 0;
+        m_parse_ns = 0;
+        m_compute_ns = 0;
+    }
+
+    void write() const
+    {
+        if (m_output == "1" || m_output == "-") {
+            std::cerr << json() << '\n';
+        } else {
+            std::ofstream file(m_output, std::ios::out | std::ios::app);
+            if (file.is_open())
+                file << json() << '\n';
+            else
+                std::cerr << "Metrics: can not open `" << m_output << "'\n";
+        }
+    }
+};
+
+}
+
+#endif
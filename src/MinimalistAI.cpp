@@ -25,19 +25,28 @@
 #include <vle/devs/Dynamics.hpp>
 #include <vle/devs/DynamicsDbg.hpp>
 #include <vle/utils/DateTime.hpp>
+#include <vle/utils/i18n.hpp>
 #include <vle/utils/Package.hpp>
-#include <vle/utils/Trace.hpp>
 #include <boost/date_time.hpp>
 #include <boost/numeric/conversion/cast.hpp>
 #include <boost/algorithm/string.hpp>
 #include <algorithm>
-#include <map>
 #include <vector>
 #include <exception>
 #include "AI.hpp"
+#include "Metrics.hpp"
+#include "PhenologyAggregates.hpp"
+#include "SowingPlanner.hpp"
+#include "Trace.hpp"
 
 namespace safihr {
 
+namespace {
+
+Metrics metrics("MinimalistAI");
+
+}
+
 struct MinimalistAISpecie
 {
     MinimalistAISpecie(const std::string &name,
@@ -73,12 +82,26 @@ std::ostream& operator<<(std::ostream& out,
     return out;
 }
 
+/**
+ * The MinimalistAI sows the parcels of the `filename' file, the
+ * landunit @e i + 1 is the @e i-th parcel in the order of the dmin.
+ * Without `rules' condition, the parcels are sown on their dmin. With
+ * a rules file (see SowingPlanner::read_rules) and the weather on the
+ * `meteo' input port, they are sown on the first day of [dmin, dmax]
+ * where the rule of their specie holds.
+ *
+ * The status messages of the crop models update the phenology
+ * aggregates of the species, observed on the `SPECIE' and
+ * `SPECIE.field' ports (see PhenologyAggregates::observe).
+ */
 class MinimalistAI : public vle::devs::Dynamics
 {
     std::vector <MinimalistAISpecie> date;
-    std::map <std::string, long int> lev;
+    PhenologyAggregates phenology; /* parcel i is the landunit i + 1. */
     vle::devs::Time current_time;
-    uint landunit_id;
+    SowingPlanner planner;
+    std::vector <std::uint32_t> ready; /* landunits sown by the rules. */
+    double tmoy; /* the last weather record. */
 
     void initialize_date(const std::string &filename)
     {
@@ -91,6 +114,7 @@ class MinimalistAI : public vle::devs::Dynamics
         std::string line;
         std::getline(file, line); /* read the header and forget it*/
 
+        DateCache dates;
         uint i = 0;
         while (file) {
             if (!std::getline(file, line))
@@ -105,11 +129,16 @@ class MinimalistAI : public vle::devs::Dynamics
                         boost::algorithm::token_compress_on));
 
                 std::string name = boost::copy_range <std::string>(*i++);
-                std::string begin = boost::copy_range <std::string>(*i++);
-                std::string end = boost::copy_range <std::string>(*i++);
+                auto begin = *i++;
+                auto end = *i++;
+                const char *str = line.c_str();
+                std::int32_t dmin, dmax;
 
-                vle::devs::Time dmin = ai_convert_date(begin);
-                vle::devs::Time dmax = ai_convert_date(end);
+                if (!dates.parse(str + (begin.begin() - line.begin()),
+                                 str + (begin.end() - line.begin()), dmin) ||
+                    !dates.parse(str + (end.begin() - line.begin()),
+                                 str + (end.end() - line.begin()), dmax))
+                    throw ai_date_failure(line);
 
                 date.emplace_back(name, dmin, dmax);
             } catch (const std::exception &e) {
@@ -124,11 +153,19 @@ public:
     MinimalistAI(const vle::devs::DynamicsInit &init,
                  const vle::devs::InitEventList &evts)
         : vle::devs::Dynamics(init, evts), current_time(vle::devs::infinity),
-          landunit_id(1)
+        tmoy(0.0)
     {
         vle::utils::Package package("safihr.cropmodel");
 
-        initialize_date(package.getDataFile(evts.getString("filename")));
+        {
+            Metrics::Scope scope(metrics, Metrics::parse);
+            initialize_date(data_filepath(package,
+                                          evts.getString("filename")));
+
+            if (evts.exist("rules"))
+                planner.read_rules(data_filepath(package,
+                                                 evts.getString("rules")));
+        }
 
         std::sort(date.begin(), date.end(),
                   [] (const MinimalistAISpecie& lhs,
@@ -137,103 +174,139 @@ public:
                       return lhs.dmin < rhs.dmin;
                   });
 
-        DTraceModel(vle::fmt("AI Scheduller: %1%") % date);
+        for (std::size_t i = 0, e = date.size(); i != e; ++i) {
+            planner.add(i + 1, date[i].name,
+                        static_cast <std::int32_t>(date[i].dmin),
+                        static_cast <std::int32_t>(date[i].dmax));
+
+            trace(TraceEvent::ai_specie, i + 1, date[i].dmin, date[i].name);
+            trace(TraceEvent::ai_schedule, i + 1, date[i].dmin, date[i].dmax);
+        }
+
+        phenology.reserve(date.size());
+        for (const auto &specie : date)
+            phenology.add_parcel(phenology.add_specie(specie.name),
+                                 static_cast <std::int32_t>(specie.dmin));
+
+        metrics.attach();
     }
 
     virtual ~MinimalistAI()
-    {}
+    {
+        metrics.detach();
+    }
+
+    virtual void finish()
+    {
+        trace_flush();
+    }
 
     virtual vle::devs::Time init(const vle::devs::Time &time)
     {
         current_time = time;
 
-        if (time > date.front().dmin)
+        if (!date.empty() && time > date.front().dmin)
             throw ai_internal_failure(time, date.front().dmin);
 
-        return date.front().dmin - time;
+        return timeAdvance();
     }
 
     virtual vle::devs::Time timeAdvance() const
     {
-        if (!date.empty())
-            return date.front().dmin - current_time;
-        else
-            return vle::devs::infinity;
+        return ready.empty() ? planner.next_day() - current_time : 0.0;
     }
 
+    /*
+     * On a day of the planner, the parcels due that day are sent with
+     * the weather of the day, as the crop models drop the weather until
+     * they are sown. The parcels sown by a rule are sent after the
+     * weather of the day, which is forwarded with them.
+     */
     virtual void output(const vle::devs::Time &time,
                         vle::devs::ExternalEventList &output) const
     {
-        (void)time;
-
-        if (date.empty())
-            return;
-
-        auto low = std::lower_bound(date.begin(), date.end(),
-                                    date.front().dmin,
-                                    [] (const MinimalistAISpecie& specie,
-                                        vle::devs::Time value)
-                                    {
-                                        return specie.dmin <= value;
-                                    });
-
-        uint landunit = landunit_id;
-        std::for_each(date.begin(), low,
-                      [&output, &landunit] (const MinimalistAISpecie& specie)
-                      {
-                          vle::devs::ExternalEvent *ret =
-                              new vle::devs::ExternalEvent("start");
-                          ret->putAttribute("specie_name",
-                                            new vle::value::String(
-                                                specie.name));
-                          ret->putAttribute("landunit_id",
-                                            new vle::value::Integer(
-                                                landunit++));
-                          output.push_back(ret);
-                      });
+        std::vector <std::uint32_t> due;
+        if (ready.empty())
+            planner.due(static_cast <std::int32_t>(time), due);
+
+        for (auto landunit : ready.empty() ? due : ready) {
+            vle::devs::ExternalEvent *ret =
+                new vle::devs::ExternalEvent("start");
+            ret->putAttribute("specie_name",
+                              new vle::value::String(date[landunit - 1].name));
+            ret->putAttribute("landunit_id",
+                              new vle::value::Integer(landunit));
+            if (!ready.empty())
+                ret->putAttribute("tmoy", new vle::value::Double(tmoy));
+            output.push_back(ret);
+        }
+
+        metrics.events(ready.empty() ? due.size() : ready.size());
     }
 
     virtual void internalTransition(const vle::devs::Time &time)
     {
         current_time = time;
+        metrics.internal_transition();
+
+        /* The landunits sown by the rules are sent, otherwise the due
+         * landunits of the day: the rules wait for the weather record
+         * of the day. */
+        std::vector <std::uint32_t> sown;
+        if (ready.empty())
+            planner.open(static_cast <std::int32_t>(time), sown);
+        else
+            sown.swap(ready);
 
-        if (!date.empty()) {
-            auto low = std::lower_bound(date.begin(), date.end(),
-                                        current_time,
-                                        [] (const MinimalistAISpecie& specie,
-                                            vle::devs::Time value)
-                                        {
-                                            return specie.dmin <= value;
-                                        });
-
-            landunit_id += std::distance(date.begin(), low);
-
-            date.erase(date.begin(), low);
-        }
+        for (auto landunit : sown)
+            phenology.sow(landunit - 1, static_cast <std::int32_t>(time));
     }
 
     virtual void externalTransition(const vle::devs::ExternalEventList &msgs,
                                     const vle::devs::Time &time)
     {
         current_time = time;
+        metrics.external_transition();
+
+        bool weather = false;
 
         for (auto &msg : msgs) {
-            if (msg->attributes().exist("lev"))
-                lev[msg->attributes().getString("specie")] = 1;
-            else if (msg->attributes().exist("harvest"))
-                lev[msg->attributes().getString("specie")] = 2;
-            else
-                lev[msg->attributes().getString("specie")] = 0;
+            if (msg->onPort("meteo")) {
+                tmoy = msg->attributes().getDouble("tmoy");
+                planner.weather(tmoy);
+                weather = true;
+                continue;
+            }
+
+            const vle::value::Map &attributes = msg->attributes();
+            unsigned int landunit =
+                safihr::stoi(attributes.getString("landunit_id"));
+
+            if (landunit >= 1 && landunit <= phenology.size())
+                phenology.update(landunit - 1,
+                                 status_model(attributes.getString("status")),
+                                 attributes.getDouble("day_lev"), time);
         }
+
+        if (weather)
+            planner.advance(static_cast <std::int32_t>(time), ready);
     }
 
     virtual vle::value::Value * observation(
         const vle::devs::ObservationEvent &event) const
     {
-        auto found = lev.find(event.getPortName());
+        metrics.observation();
 
-        if (found != lev.end())
-            return new vle::value::Integer(found->second);
+        std::vector <double> values;
+        if (phenology.observe(event.getPortName(), values)) {
+            if (values.size() == 1)
+                return new vle::value::Double(values.front());
+
+            vle::value::Tuple *ret = new vle::value::Tuple();
+            for (double value : values)
+                ret->add(value);
+            return ret;
+        }
 
         return vle::devs::Dynamics::observation(event);
     }
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef SAFIHR_MODEL_OBSERVATIONPOLICY_HPP
+#define SAFIHR_MODEL_OBSERVATIONPOLICY_HPP
+
+#include <boost/format.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+
+namespace safihr {
+
+struct observation_policy_failure : std::runtime_error
+{
+    explicit observation_policy_failure(const std::string &msg)
+        : std::runtime_error(
+            (boost::format("Observation policy: %1%") % msg).str())
+    {}
+};
+
+/**
+ * Select the parcels that get an observable. A parcel is observed if
+ * its identifier is in the identifier set, if its specie is in the
+ * specie set or if it is drawn by the random sample. The random sample
+ * is a hash of the identifier and the seed: it does not depend on the
+ * order of the parcels and does not need any state.
+ */
+class ObservationPolicy
+{
+    std::unordered_set <unsigned int> m_ids;
+    std::unordered_set <std::string> m_species;
+    double m_fraction;
+    std::uint64_t m_seed;
+
+    /* splitmix64 finalizer. */
+    static std::uint64_t mix(std::uint64_t x)
+    {
+        x += UINT64_C(0x9e3779b97f4a7c15);
+        x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+        return x ^ (x >> 31);
+    }
+
+public:
+    ObservationPolicy()
+        : m_fraction(0.0), m_seed(0)
+    {}
+
+    /** @throw observation_policy_failure if @e id is negative. */
+    void add_id(long id)
+    {
+        if (id < 0 || static_cast <unsigned long>(id) >
+            std::numeric_limits <unsigned int>::max())
+            throw observation_policy_failure(
+                (boost::format("bad identifier `%1%'") % id).str());
+
+        m_ids.insert(static_cast <unsigned int>(id));
+    }
+
+    void add_specie(const std::string &name)
+    {
+        m_species.insert(name);
+    }
+
+    /**
+     * Read identifiers from a file. Identifiers are separated by
+     * spaces, new lines or semicolons.
+     *
+     * @throw observation_policy_failure if the file can not be opened or
+     * if a token is not an unsigned integer identifier.
+     */
+    void add_ids_from_file(const std::string &filepath)
+    {
+        std::ifstream file(filepath);
+        if (!file.is_open())
+            throw observation_policy_failure(
+                (boost::format("can not open `%1%'") % filepath).str());
+
+        std::string line;
+        for (unsigned long number = 1; std::getline(file, line); ++number) {
+            std::string::size_type first = 0;
+            while ((first = line.find_first_not_of(" \t\r;", first)) !=
+                   std::string::npos) {
+                std::string::size_type last =
+                    line.find_first_of(" \t\r;", first);
+                const std::string token = line.substr(first, last - first);
+
+                char *end;
+                unsigned long id = std::strtoul(token.c_str(), &end, 10);
+                if (token.find_first_not_of("0123456789") !=
+                    std::string::npos ||
+                    id > std::numeric_limits <unsigned int>::max())
+                    throw observation_policy_failure(
+                        (boost::format("`%1%' line %2%: bad identifier `%3%'")
+                         % filepath % number % token).str());
+
+                m_ids.insert(static_cast <unsigned int>(id));
+                first = last;
+            }
+        }
+    }
+
+    void set_sample(double fraction, std::uint64_t seed)
+    {
+        if (!(fraction >= 0.0 && fraction <= 1.0))
+            throw observation_policy_failure(
+                (boost::format("bad sample fraction `%1%'") % fraction).str());
+
+        m_fraction = fraction;
+        m_seed = seed;
+    }
+
+    bool empty() const
+    {
+        return m_ids.empty() && m_species.empty() && m_fraction <= 0.0;
+    }
+
+    bool observe(unsigned int id, const std::string &specie) const
+    {
+        if (m_ids.find(id) != m_ids.end())
+            return true;
+
+        if (m_fraction > 0.0) {
+            /* Keep the 53 high bits to build a double in [0, 1). */
+            double x = static_cast <double>(mix(id ^ mix(m_seed)) >> 11) *
+                (1.0 / 9007199254740992.0);
+            if (x < m_fraction)
+                return true;
+        }
+
+        return !m_species.empty() && m_species.find(specie) != m_species.end();
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef SAFIHR_MODEL_PHENOLOGYAGGREGATES_HPP
+#define SAFIHR_MODEL_PHENOLOGYAGGREGATES_HPP
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Calendar.hpp"
+#include "Global.hpp"
+#include "Plan.hpp"
+
+namespace safihr {
+
+/**
+ * Count, mean and variance of a serie updated one value at a time
+ * (Welford).
+ */
+struct RunningMean
+{
+    RunningMean()
+        : count(0), mean(0.0), m2(0.0)
+    {}
+
+    void push(double value)
+    {
+        ++count;
+        double delta = value - mean;
+        mean += delta / count;
+        m2 += delta * (value - mean);
+    }
+
+    double variance() const
+    {
+        return count > 1 ? m2 / (count - 1) : 0.0;
+    }
+
+    std::uint64_t count;
+    double mean;
+    double m2;
+};
+
+/**
+ * Per specie phenology summaries updated as the status messages of the
+ * crop models arrive: the number of parcels in each status, the
+ * histograms of the emergence and maturity days (day of the year) and
+ * the running means of the delays from sowing to emergence and to
+ * maturity. A parcel is counted in one status at a time, each message
+ * moves it from its previous status to the new one in O(1). A harvested
+ * parcel stays counted at maturity until it is sown again.
+ *
+ * Parcels are dense indices given by the caller, species are interned
+ * once so an update never looks up a name.
+ */
+class PhenologyAggregates
+{
+public:
+    static const std::size_t statuses = 5;
+    static const std::size_t days = 366;
+
+    struct Summary
+    {
+        Summary()
+            : emergence(days, 0), maturity(days, 0)
+        {
+            status.fill(0);
+        }
+
+        std::array <std::uint32_t, statuses> status;
+        std::vector <std::uint32_t> emergence; /* by day of year - 1. */
+        std::vector <std::uint32_t> maturity;
+        RunningMean emergence_delay;
+        RunningMean maturity_delay;
+    };
+
+    std::uint16_t add_specie(const std::string &name)
+    {
+        std::uint16_t id = m_species.intern(name);
+        if (id == m_summaries.size())
+            m_summaries.emplace_back();
+
+        return id;
+    }
+
+    /**
+     * Add the next parcel, of the specie @e specie, planned to be sown
+     * on @e sowing.
+     */
+    void add_parcel(std::uint16_t specie, std::int32_t sowing)
+    {
+        m_specie.push_back(specie);
+        m_status.push_back(static_cast <std::uint8_t>(
+                               StatusModel::unavailable));
+        m_sowing.push_back(sowing);
+        m_summaries[specie].status[0]++;
+    }
+
+    void reserve(std::size_t parcels)
+    {
+        m_specie.reserve(parcels);
+        m_status.reserve(parcels);
+        m_sowing.reserve(parcels);
+    }
+
+    /** The parcel @e parcel is sown on @e day. */
+    void sow(std::uint32_t parcel, std::int32_t day)
+    {
+        m_sowing[parcel] = day;
+        move(parcel, StatusModel::sown);
+    }
+
+    /**
+     * The crop model of @e parcel reports @e status on @e time with its
+     * emergence day @e day_lev.
+     */
+    void update(std::uint32_t parcel, StatusModel status, double day_lev,
+                double time)
+    {
+        StatusModel previous = static_cast <StatusModel>(m_status[parcel]);
+        if (previous == status)
+            return;
+
+        Summary &summary = m_summaries[m_specie[parcel]];
+
+        if (status >= StatusModel::raised && previous < StatusModel::raised
+            && day_lev > 0.0) {
+            summary.emergence[bin(day_lev)]++;
+            summary.emergence_delay.push(day_lev - m_sowing[parcel]);
+        }
+
+        if (status == StatusModel::maturity) {
+            summary.maturity[bin(time)]++;
+            summary.maturity_delay.push(time - m_sowing[parcel]);
+        }
+
+        move(parcel, status);
+    }
+
+    const SpecieDictionary& species() const
+    {
+        return m_species;
+    }
+
+    const Summary& summary(std::uint16_t specie) const
+    {
+        return m_summaries[specie];
+    }
+
+    std::size_t size() const
+    {
+        return m_specie.size();
+    }
+
+    /**
+     * The values of the observation port @e port: `SPECIE' gives the
+     * number of parcels in each status (unavailable, sown, raised,
+     * flowering, maturity), `SPECIE.status' one of them,
+     * `SPECIE.emergence-mean', `SPECIE.emergence-stddev',
+     * `SPECIE.maturity-mean' and `SPECIE.maturity-stddev' the delays
+     * from sowing in days, `SPECIE.emergence-days' and
+     * `SPECIE.maturity-days' the 366 bins of the histograms. Return false
+     * if the port does not name a specie and a field.
+     */
+    bool observe(const std::string &port, std::vector <double> &values) const
+    {
+        std::uint16_t id;
+        std::string field;
+
+        if (!m_species.find(port, id)) {
+            std::string::size_type dot = port.rfind('.');
+            if (dot == std::string::npos || dot + 1 == port.size() ||
+                !m_species.find(port.substr(0, dot), id))
+                return false;
+
+            field = port.substr(dot + 1);
+        }
+
+        const Summary &summary = m_summaries[id];
+        values.clear();
+
+        if (field.empty()) {
+            values.assign(summary.status.begin(), summary.status.end());
+        } else if (field == "emergence-mean") {
+            values.push_back(summary.emergence_delay.mean);
+        } else if (field == "emergence-stddev") {
+            values.push_back(std::sqrt(summary.emergence_delay.variance()));
+        } else if (field == "maturity-mean") {
+            values.push_back(summary.maturity_delay.mean);
+        } else if (field == "maturity-stddev") {
+            values.push_back(std::sqrt(summary.maturity_delay.variance()));
+        } else if (field == "emergence-days") {
+            values.assign(summary.emergence.begin(), summary.emergence.end());
+        } else if (field == "maturity-days") {
+            values.assign(summary.maturity.begin(), summary.maturity.end());
+        } else {
+            try {
+                values.push_back(summary.status[
+                                     static_cast <std::size_t>(
+                                         status_model(field))]);
+            } catch (const global_unknown_model_status&) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    void move(std::uint32_t parcel, StatusModel status)
+    {
+        Summary &summary = m_summaries[m_specie[parcel]];
+
+        summary.status[m_status[parcel]]--;
+        summary.status[static_cast <std::size_t>(status)]++;
+        m_status[parcel] = static_cast <std::uint8_t>(status);
+    }
+
+    static std::size_t bin(double day)
+    {
+        bool leap;
+        return static_cast <std::size_t>(
+            day_of_year(static_cast <std::int32_t>(day), leap) - 1);
+    }
+
+    SpecieDictionary m_species;
+    std::vector <Summary> m_summaries;
+    std::vector <std::uint16_t> m_specie;
+    std::vector <std::uint8_t> m_status;
+    std::vector <std::int32_t> m_sowing;
+};
+
+}
+
+#endif
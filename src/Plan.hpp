@@ -0,0 +1,445 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef SAFIHR_MODEL_PLAN_HPP
+#define SAFIHR_MODEL_PLAN_HPP
+
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Calendar.hpp"
+#include "Global.hpp"
+
+namespace safihr {
+
+struct plan_open_failure : std::runtime_error
+{
+    explicit plan_open_failure(const std::string &filepath)
+        : std::runtime_error(
+            (boost::format("Plan: can not open `%1%'") % filepath).str())
+    {}
+};
+
+struct plan_format_failure : std::runtime_error
+{
+    explicit plan_format_failure(std::size_t line)
+        : std::runtime_error(
+            (boost::format("Plan: fail to read line `%1%'") % line).str())
+    {}
+};
+
+/**
+ * Intern specie names: each name is stored once and parcels use a
+ * small integer identifier.
+ */
+class SpecieDictionary
+{
+    std::vector <std::string> m_names;
+    std::unordered_map <std::string, std::uint16_t> m_ids;
+
+public:
+    std::uint16_t intern(const std::string &name)
+    {
+        auto it = m_ids.find(name);
+        if (it != m_ids.end())
+            return it->second;
+
+        std::uint16_t id = static_cast <std::uint16_t>(m_names.size());
+        m_names.emplace_back(name);
+        m_ids.emplace(name, id);
+
+        return id;
+    }
+
+    bool find(const std::string &name, std::uint16_t &id) const
+    {
+        auto it = m_ids.find(name);
+        if (it == m_ids.end())
+            return false;
+
+        id = it->second;
+        return true;
+    }
+
+    const std::string& name(std::uint16_t id) const
+    {
+        return m_names[id];
+    }
+
+    std::size_t size() const
+    {
+        return m_names.size();
+    }
+};
+
+/**
+ * A column oriented sowing plan. Dates are julian day numbers. The @e
+ * order column lists the rows sorted by sowing date @e dmin.
+ */
+struct PlanTable
+{
+    SpecieDictionary species;
+    std::vector <std::uint32_t> id;
+    std::vector <std::uint16_t> specie;
+    std::vector <float> surface1;
+    std::vector <float> surface2;
+    std::vector <std::int32_t> dmin;
+    std::vector <std::int32_t> dmax;
+    std::vector <std::int32_t> duration;
+    std::vector <std::uint32_t> order;
+
+    std::size_t size() const
+    {
+        return id.size();
+    }
+
+    const std::string& specie_name(std::size_t row) const
+    {
+        return species.name(specie[row]);
+    }
+
+    void reserve(std::size_t size)
+    {
+        id.reserve(size);
+        specie.reserve(size);
+        surface1.reserve(size);
+        surface2.reserve(size);
+        dmin.reserve(size);
+        dmax.reserve(size);
+        duration.reserve(size);
+    }
+
+    /**
+     * Fill the @e order column with a counting sort on @e dmin: linear
+     * in the number of rows plus the number of days between the first
+     * and the last sowing date. The sort is stable.
+     */
+    void sort_by_dmin()
+    {
+        order.resize(size());
+
+        if (dmin.empty())
+            return;
+
+        auto minmax = std::minmax_element(dmin.begin(), dmin.end());
+        const std::int32_t first = *minmax.first;
+        const std::size_t days = *minmax.second - first + 1;
+
+        std::vector <std::uint32_t> count(days + 1, 0u);
+        for (auto day : dmin)
+            ++count[day - first + 1];
+
+        for (std::size_t i = 1; i <= days; ++i)
+            count[i] += count[i - 1];
+
+        for (std::size_t row = 0, end = size(); row != end; ++row)
+            order[count[dmin[row] - first]++] =
+                static_cast <std::uint32_t>(row);
+    }
+};
+
+/**
+ * Copy the @e rows of @e plan, with their identifiers, into @e out.
+ */
+inline void select_rows(const PlanTable &plan,
+                        const std::vector <std::uint32_t> &rows,
+                        PlanTable &out)
+{
+    out = PlanTable();
+    out.reserve(rows.size());
+
+    for (auto row : rows) {
+        out.id.push_back(plan.id[row]);
+        out.specie.push_back(out.species.intern(plan.specie_name(row)));
+        out.surface1.push_back(plan.surface1[row]);
+        out.surface2.push_back(plan.surface2[row]);
+        out.dmin.push_back(plan.dmin[row]);
+        out.dmax.push_back(plan.dmax[row]);
+        out.duration.push_back(plan.duration[row]);
+    }
+
+    out.sort_by_dmin();
+}
+
+/**
+ * The header of the simulation-outputs.csv files.
+ */
+constexpr const char *plan_result_header = "id_parcelle;libelle_occup;"
+    "Date-semis;Date-Lev;Date-recolte-observee;Date-recolte-simulee;distance";
+
+/**
+ * A row of a simulation-outputs.csv file: the plan row with the
+ * simulated emergence and maturity days (-1 if not reached).
+ */
+struct PlanResult
+{
+    const PlanTable &plan;
+    std::size_t row;
+    std::int32_t dlev;
+    std::int32_t result;
+};
+
+/*
+ * The distance keeps the format of the first CompareDateAI output (six
+ * significant digits): a row without maturity gives 2.45616e+06.
+ */
+inline std::ostream& operator<<(std::ostream& out, const PlanResult& r)
+{
+    out << r.plan.id[r.row] << ';' << r.plan.specie_name(r.row) << ';'
+        << format_date(r.plan.dmin[r.row]) << ';'
+        << format_date(r.dlev) << ';'
+        << format_date(r.plan.dmax[r.row]) << ';'
+        << format_date(r.result) << ';';
+
+    std::streamsize precision = out.precision(6);
+    out << static_cast <double>(r.plan.dmax[r.row] - r.result);
+    out.precision(precision);
+
+    return out;
+}
+
+namespace details {
+
+struct plan_chunk
+{
+    PlanTable table;
+    std::vector <std::string> names; /* local specie names. */
+    std::size_t lines;
+    std::size_t error_line;
+    bool error;
+
+    plan_chunk()
+        : lines(0), error_line(0), error(false)
+    {}
+};
+
+/* Next non empty `;' separated field in [str, end). */
+inline bool plan_field(const char *&str, const char *end,
+                       const char *&first, const char *&last)
+{
+    while (str != end && *str == ';')
+        ++str;
+
+    if (str == end)
+        return false;
+
+    first = str;
+    while (str != end && *str != ';')
+        ++str;
+    last = str;
+
+    return true;
+}
+
+/* The buffer is null terminated so strtod_c stops at the field end. */
+inline bool plan_number(const char *first, const char *last, double &value)
+{
+    char *end;
+
+    value = strtod_c(first, &end);
+
+    return end != first && end == last;
+}
+
+inline void plan_parse_chunk(const char *str, const char *end,
+                             plan_chunk &chunk)
+{
+    std::unordered_map <std::string, std::uint16_t> local;
+    DateCache dates;
+    const char *fields[6][2];
+
+    while (str != end) {
+        const char *eol = std::find(str, end, '\n');
+        const char *line_end = eol;
+        if (line_end != str && *(line_end - 1) == '\r')
+            --line_end;
+
+        ++chunk.lines;
+
+        if (line_end != str) {
+            const char *it = str;
+            int nb = 0;
+            while (nb < 6 && plan_field(it, line_end, fields[nb][0],
+                                        fields[nb][1]))
+                ++nb;
+
+            double sur1, sur2, dura;
+            std::int32_t dmin, dmax;
+
+            if (nb != 6 ||
+                !plan_number(fields[1][0], fields[1][1], sur1) ||
+                !plan_number(fields[2][0], fields[2][1], sur2) ||
+                !dates.parse(fields[3][0], fields[3][1], dmin) ||
+                !dates.parse(fields[4][0], fields[4][1], dmax) ||
+                !plan_number(fields[5][0], fields[5][1], dura) ||
+                dmax - dmin != dura) {
+                chunk.error = true;
+                chunk.error_line = chunk.lines;
+                return;
+            }
+
+            std::string name(fields[0][0], fields[0][1]);
+            auto found = local.find(name);
+            std::uint16_t specie;
+            if (found == local.end()) {
+                specie = static_cast <std::uint16_t>(chunk.names.size());
+                local.emplace(name, specie);
+                chunk.names.emplace_back(std::move(name));
+            } else {
+                specie = found->second;
+            }
+
+            chunk.table.specie.push_back(specie);
+            chunk.table.surface1.push_back(static_cast <float>(sur1));
+            chunk.table.surface2.push_back(static_cast <float>(sur2));
+            chunk.table.dmin.push_back(dmin);
+            chunk.table.dmax.push_back(dmax);
+            chunk.table.duration.push_back(static_cast <std::int32_t>(dura));
+        }
+
+        str = (eol == end) ? end : eol + 1;
+    }
+}
+
+}
+
+/**
+ * Read a sowing plan file `name;surface;surface;dmin;dmax;duration'
+ * with a header line. The file is loaded in memory, split into chunks
+ * on line boundaries and each chunk is parsed by its own thread. Rows
+ * receive the identifiers 0, 1, ... in file order and the @e order
+ * column is sorted by sowing date. The dates are `dd/mm/yyyy' or
+ * `yyyy-mm-dd', each thread memoizes them in a DateCache.
+ *
+ * @param threads The number of parser threads, 0 to use the number of
+ * hardware threads. Small files are always read by a single thread.
+ */
+inline void read_plan(const std::string &filepath, PlanTable &plan,
+                      unsigned threads = 0)
+{
+    std::string buffer;
+    {
+        std::ifstream file(filepath, std::ios::in | std::ios::binary);
+        if (!file.is_open())
+            throw plan_open_failure(filepath);
+
+        file.seekg(0, std::ios::end);
+        buffer.resize(static_cast <std::size_t>(file.tellg()));
+        file.seekg(0, std::ios::beg);
+        file.read(&buffer[0], buffer.size());
+    }
+
+    const char *begin = buffer.data();
+    const char *end = begin + buffer.size();
+
+    /* Forget the header. */
+    begin = std::find(begin, end, '\n');
+    if (begin != end)
+        ++begin;
+
+    const std::size_t min_chunk = 1u << 20;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast <unsigned>(
+        std::max <std::size_t>(1u, std::min <std::size_t>(
+                threads, (end - begin) / min_chunk)));
+
+    std::vector <details::plan_chunk> chunks(threads);
+    std::vector <const char*> bounds(threads + 1, end);
+    bounds[0] = begin;
+    for (unsigned i = 1; i < threads; ++i) {
+        const char *pos = std::max(bounds[i - 1],
+                                   begin + (end - begin) * i / threads);
+        pos = std::find(pos, end, '\n');
+        bounds[i] = (pos == end) ? end : pos + 1;
+    }
+
+    if (threads == 1) {
+        details::plan_parse_chunk(bounds[0], bounds[1], chunks[0]);
+    } else {
+        std::vector <std::thread> workers;
+        for (unsigned i = 0; i < threads; ++i)
+            workers.emplace_back(details::plan_parse_chunk, bounds[i],
+                                 bounds[i + 1], std::ref(chunks[i]));
+
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    std::size_t rows = 0, lines = 1;
+    for (const auto &chunk : chunks) {
+        if (chunk.error)
+            throw plan_format_failure(lines + chunk.error_line);
+
+        rows += chunk.table.dmin.size();
+        lines += chunk.lines;
+    }
+
+    plan = PlanTable();
+    plan.reserve(rows);
+
+    for (auto &chunk : chunks) {
+        std::vector <std::uint16_t> remap;
+        for (const auto &name : chunk.names)
+            remap.push_back(plan.species.intern(name));
+
+        for (std::size_t i = 0, e = chunk.table.dmin.size(); i != e; ++i) {
+            plan.id.push_back(static_cast <std::uint32_t>(plan.id.size()));
+            plan.specie.push_back(remap[chunk.table.specie[i]]);
+        }
+
+        plan.surface1.insert(plan.surface1.end(),
+                             chunk.table.surface1.begin(),
+                             chunk.table.surface1.end());
+        plan.surface2.insert(plan.surface2.end(),
+                             chunk.table.surface2.begin(),
+                             chunk.table.surface2.end());
+        plan.dmin.insert(plan.dmin.end(), chunk.table.dmin.begin(),
+                         chunk.table.dmin.end());
+        plan.dmax.insert(plan.dmax.end(), chunk.table.dmax.begin(),
+                         chunk.table.dmax.end());
+        plan.duration.insert(plan.duration.end(),
+                             chunk.table.duration.begin(),
+                             chunk.table.duration.end());
+
+        chunk.table = PlanTable();
+    }
+
+    plan.sort_by_dmin();
+}
+
+}
+
+#endif
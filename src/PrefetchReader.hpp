@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SAFIHR_MODEL_PREFETCHREADER_HPP
+#define SAFIHR_MODEL_PREFETCHREADER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FileReader.hpp"
+
+namespace safihr {
+
+/**
+ * A bounded ring between one producer thread and one consumer thread.
+ * The capacity is rounded up to a power of two. push() and pop() never
+ * block and never lock: they fail when the ring is full or empty.
+ */
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(std::size_t capacity)
+        : m_head(0), m_tail(0)
+    {
+        std::size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+
+        m_slots.resize(size);
+        m_mask = size - 1;
+    }
+
+    /** Producer side. */
+    bool push(const T &value)
+    {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_seq_cst) == m_slots.size())
+            return false;
+
+        m_slots[head & m_mask] = value;
+        m_head.store(head + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    /** Consumer side. */
+    bool pop(T &value)
+    {
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_seq_cst))
+            return false;
+
+        value = m_slots[tail & m_mask];
+        m_tail.store(tail + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    bool full() const
+    {
+        return m_head.load(std::memory_order_seq_cst) -
+            m_tail.load(std::memory_order_seq_cst) == m_slots.size();
+    }
+
+    bool empty() const
+    {
+        return m_head.load(std::memory_order_seq_cst) ==
+            m_tail.load(std::memory_order_seq_cst);
+    }
+
+private:
+    std::vector <T> m_slots;
+    std::size_t m_mask;
+
+    /* Free running counters on their own cache lines. */
+    char m_pad0[64];
+    std::atomic <std::size_t> m_head;
+    char m_pad1[64 - sizeof(std::atomic <std::size_t>)];
+    std::atomic <std::size_t> m_tail;
+    char m_pad2[64 - sizeof(std::atomic <std::size_t>)];
+};
+
+/** A parsed record of the weather file. */
+struct WeatherDay
+{
+    double tmin;
+    double tmax;
+    double tmoy;
+    unsigned long line;
+    std::int32_t date; /* julian day number. */
+};
+
+/**
+ * A FileReader run by a background thread which parses the records
+ * ahead of the simulation into a SpscRing. The simulation thread only
+ * pops parsed records and waits only if the reader is behind.
+ *
+ * When the ring is full the reader sleeps until a record is popped.
+ * The sleeping side is woken through a mutex and a condition variable
+ * only when it announced it sleeps: the flag is written before the
+ * ring is checked again and read after the ring is updated (sequential
+ * consistency), so a wake up can not be lost.
+ *
+ * The file is opened and its header read by the constructor, so
+ * file_generator_open and file_generator_format are thrown as with the
+ * FileReader. A format error in a record is thrown by the next() call
+ * which would have read it. With a capacity of 0 there is no thread:
+ * next() reads the file, which is faster on a single core.
+ */
+class PrefetchReader
+{
+public:
+    PrefetchReader(const std::string &filepath, std::size_t capacity = 256)
+        : m_ring(std::max <std::size_t>(1, capacity)),
+        m_current { 0.0, 0.0, 0.0, 1, 0 }, m_end_line(1), m_finished(false),
+        m_stop(false), m_producer_waits(false), m_consumer_waits(false)
+    {
+        m_reader.open(filepath);
+
+        if (capacity > 0)
+            m_thread = std::thread(&PrefetchReader::produce, this);
+    }
+
+    ~PrefetchReader()
+    {
+        if (!m_thread.joinable())
+            return;
+
+        m_stop.store(true, std::memory_order_seq_cst);
+        {
+            std::lock_guard <std::mutex> lock(m_mutex);
+            m_cond.notify_all();
+        }
+        m_thread.join();
+    }
+
+    PrefetchReader(const PrefetchReader&) = delete;
+    PrefetchReader& operator=(const PrefetchReader&) = delete;
+
+    /**
+     * Pop the next record into current(). Return false at the end of
+     * the file or throw the error of the reader.
+     */
+    bool next()
+    {
+        if (!m_thread.joinable()) {
+            bool ret = m_reader.next();
+            m_current = WeatherDay { m_reader.m_tmin, m_reader.m_tmax,
+                                     m_reader.m_tmoy, m_reader.m_line,
+                                     m_reader.m_date };
+            return ret;
+        }
+
+        for (;;) {
+            if (m_ring.pop(m_current)) {
+                if (m_producer_waits.load(std::memory_order_seq_cst)) {
+                    std::lock_guard <std::mutex> lock(m_mutex);
+                    m_cond.notify_all();
+                }
+                return true;
+            }
+
+            if (spin())
+                continue;
+
+            if (m_finished.load(std::memory_order_acquire)) {
+                if (m_ring.pop(m_current))
+                    return true;
+                if (m_error)
+                    std::rethrow_exception(m_error);
+                m_current.line = m_end_line;
+                return false;
+            }
+
+            std::unique_lock <std::mutex> lock(m_mutex);
+            m_consumer_waits.store(true, std::memory_order_seq_cst);
+            m_cond.wait(lock, [this]()
+                        {
+                            return !m_ring.empty() ||
+                                m_finished.load(std::memory_order_acquire);
+                        });
+            m_consumer_waits.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    /** The last record popped. */
+    const WeatherDay& current() const
+    {
+        return m_current;
+    }
+
+private:
+    void produce()
+    {
+        try {
+            while (!m_stop.load(std::memory_order_relaxed) &&
+                   m_reader.next()) {
+                WeatherDay day { m_reader.m_tmin, m_reader.m_tmax,
+                        m_reader.m_tmoy, m_reader.m_line, m_reader.m_date };
+
+                while (!m_ring.push(day)) {
+                    std::unique_lock <std::mutex> lock(m_mutex);
+                    m_producer_waits.store(true, std::memory_order_seq_cst);
+                    m_cond.wait(lock, [this]()
+                                {
+                                    return !m_ring.full() ||
+                                        m_stop.load(std::memory_order_seq_cst);
+                                });
+                    m_producer_waits.store(false, std::memory_order_relaxed);
+
+                    if (m_stop.load(std::memory_order_relaxed))
+                        return;
+                }
+
+                wake_consumer();
+            }
+            m_end_line = m_reader.m_line;
+        } catch (...) {
+            m_error = std::current_exception();
+        }
+
+        m_finished.store(true, std::memory_order_release);
+        std::lock_guard <std::mutex> lock(m_mutex);
+        m_cond.notify_all();
+    }
+
+    /* A record is often only a few microseconds away: wait for it a
+       little before sleeping. */
+    bool spin() const
+    {
+        for (int i = 0; i != 64; ++i) {
+            if (!m_ring.empty())
+                return true;
+            std::this_thread::yield();
+        }
+
+        return false;
+    }
+
+    void wake_consumer()
+    {
+        if (m_consumer_waits.load(std::memory_order_seq_cst)) {
+            std::lock_guard <std::mutex> lock(m_mutex);
+            m_cond.notify_all();
+        }
+    }
+
+    FileReader m_reader;               /* owned by the thread if any. */
+    SpscRing <WeatherDay> m_ring;
+    WeatherDay m_current;              /* owned by the consumer. */
+    unsigned long m_end_line;          /* written before m_finished. */
+    std::exception_ptr m_error;        /* written before m_finished. */
+    std::atomic <bool> m_finished;
+    std::atomic <bool> m_stop;
+    std::atomic <bool> m_producer_waits;
+    std::atomic <bool> m_consumer_waits;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+};
+
+}
+
+#endif
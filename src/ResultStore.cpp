@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstring>
+#include "ResultStore.hpp"
+
+namespace safihr {
+
+namespace {
+
+const char result_store_magic[8] = { 'S', 'A', 'F', 'I', 'H', 'R', 'R', 'S' };
+const std::uint32_t result_store_version = 1;
+const std::size_t result_store_record = 16;
+
+}
+
+ResultStore::ResultStore(const std::string &filepath)
+    : m_filepath(filepath)
+{
+    std::streamoff valid = 0;
+
+    {
+        std::ifstream input(filepath, std::ios::in | std::ios::binary);
+
+        /* Only a missing or empty file is created, a short header is
+         * not an interrupted run but another file. */
+        if (input.is_open() &&
+            input.peek() != std::ifstream::traits_type::eof()) {
+            char magic[8];
+            std::uint32_t version = 0, padding = 0;
+
+            if (!input.read(magic, sizeof(magic)) ||
+                !input.read(reinterpret_cast <char*>(&version),
+                            sizeof(version)) ||
+                !input.read(reinterpret_cast <char*>(&padding),
+                            sizeof(padding)) ||
+                std::memcmp(magic, result_store_magic, sizeof(magic)) ||
+                version != result_store_version)
+                throw result_store_failure(filepath);
+
+            valid = input.tellg();
+
+            char record[result_store_record];
+            while (input.read(record, sizeof(record))) {
+                std::uint64_t key;
+                Entry entry;
+                std::memcpy(&key, record, 8);
+                std::memcpy(&entry.dlev, record + 8, 4);
+                std::memcpy(&entry.result, record + 12, 4);
+                m_index[key] = entry;
+                valid += result_store_record;
+            }
+        }
+    }
+
+    if (valid == 0) {
+        m_file.open(filepath, std::ios::out | std::ios::binary |
+                    std::ios::trunc);
+        if (!m_file.is_open())
+            throw result_store_failure(filepath);
+
+        std::uint32_t padding = 0;
+        m_file.write(result_store_magic, sizeof(result_store_magic));
+        m_file.write(reinterpret_cast <const char*>(&result_store_version),
+                     sizeof(result_store_version));
+        m_file.write(reinterpret_cast <const char*>(&padding),
+                     sizeof(padding));
+    } else {
+        /* Open at the end of the last complete record to overwrite a
+         * truncated one. */
+        m_file.open(filepath, std::ios::in | std::ios::out |
+                    std::ios::binary);
+        if (!m_file.is_open())
+            throw result_store_failure(filepath);
+
+        m_file.seekp(valid);
+    }
+}
+
+ResultStore::~ResultStore()
+{
+    m_file.flush();
+}
+
+void ResultStore::insert(std::uint64_t key, const Entry &entry)
+{
+    if (!m_index.emplace(key, entry).second)
+        return;
+
+    char record[result_store_record];
+    std::memcpy(record, &key, 8);
+    std::memcpy(record + 8, &entry.dlev, 4);
+    std::memcpy(record + 12, &entry.result, 4);
+
+    m_file.write(record, sizeof(record));
+}
+
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef SAFIHR_MODEL_RESULTSTORE_HPP
+#define SAFIHR_MODEL_RESULTSTORE_HPP
+
+#include <boost/format.hpp>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+namespace safihr {
+
+struct result_store_failure : std::runtime_error
+{
+    explicit result_store_failure(const std::string &filepath)
+        : std::runtime_error(
+            (boost::format("Result store: bad or unreadable file `%1%'")
+             % filepath).str())
+    {}
+};
+
+/**
+ * A local store of simulated scenarios: an append-only file of fixed
+ * size records (scenario hash, emergence day, maturity day) indexed in
+ * memory by the scenario hash when the store is opened. A truncated
+ * last record (interrupted run) is ignored. A missing or empty file is
+ * created, any other file without the header of the store is rejected
+ * with result_store_failure.
+ */
+class ResultStore
+{
+public:
+    struct Entry
+    {
+        std::int32_t dlev;
+        std::int32_t result;
+    };
+
+    explicit ResultStore(const std::string &filepath);
+
+    ~ResultStore();
+
+    bool find(std::uint64_t key, Entry &entry) const
+    {
+        auto it = m_index.find(key);
+        if (it == m_index.end())
+            return false;
+
+        entry = it->second;
+        return true;
+    }
+
+    /**
+     * Add a new scenario at the end of the file.
+     */
+    void insert(std::uint64_t key, const Entry &entry);
+
+    void flush()
+    {
+        m_file.flush();
+    }
+
+    std::size_t size() const
+    {
+        return m_index.size();
+    }
+
+private:
+    std::unordered_map <std::uint64_t, Entry> m_index;
+    std::ofstream m_file;
+    std::string m_filepath;
+};
+
+}
+
+#endif
@@ -0,0 +1,383 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SAFIHR_MODEL_RESULTWRITER_HPP
+#define SAFIHR_MODEL_RESULTWRITER_HPP
+
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace safihr {
+
+struct result_writer_open_failure : std::runtime_error
+{
+    explicit result_writer_open_failure(const std::string &filepath)
+        : std::runtime_error(
+            (boost::format("Result writer: can not open `%1%'")
+             % filepath).str())
+    {}
+};
+
+struct result_writer_format_failure : std::runtime_error
+{
+    explicit result_writer_format_failure(const std::string &filepath)
+        : std::runtime_error(
+            (boost::format("Result writer: bad identifier in `%1%'")
+             % filepath).str())
+    {}
+};
+
+struct result_writer_header_failure : std::runtime_error
+{
+    explicit result_writer_header_failure(const std::string &filepath)
+        : std::runtime_error(
+            (boost::format("Result writer: `%1%' has an other header")
+             % filepath).str())
+    {}
+};
+
+/**
+ * A large buffered output stream for simulation results. Rows are
+ * written as soon as they are available and the stream is flushed
+ * every @e flush_rows rows so a crash loses at most the last rows
+ * still in the buffer.
+ */
+class ResultWriter
+{
+    std::vector <char> m_buffer;
+    std::ofstream m_file;
+    std::string m_filepath;
+    std::size_t m_flush_rows;
+    std::size_t m_pending;
+
+public:
+    ResultWriter(const std::string &filepath, const std::string &header,
+                 std::size_t buffer_size = 1u << 20,
+                 std::size_t flush_rows = 4096)
+        : m_buffer(buffer_size), m_filepath(filepath),
+        m_flush_rows(flush_rows), m_pending(0)
+    {
+        /* pubsetbuf must be called before the open. */
+        m_file.rdbuf()->pubsetbuf(m_buffer.data(), m_buffer.size());
+        m_file.open(filepath, std::ios::out | std::ios::trunc);
+
+        if (!m_file.is_open())
+            throw result_writer_open_failure(filepath);
+
+        m_file.imbue(std::locale::classic());
+        m_file << std::setprecision(std::numeric_limits <double>::digits10)
+               << std::boolalpha
+               << header << '\n';
+    }
+
+    ~ResultWriter()
+    {
+        close();
+    }
+
+    const std::string& filepath() const
+    {
+        return m_filepath;
+    }
+
+    /**
+     * Format a row directly into the stream buffer using its @c
+     * operator<<.
+     */
+    template <typename Row>
+    void push(const Row &row)
+    {
+        m_file << row << '\n';
+
+        if (++m_pending >= m_flush_rows)
+            flush();
+    }
+
+    void flush()
+    {
+        m_file.flush();
+        m_pending = 0;
+    }
+
+    void close()
+    {
+        if (m_file.is_open()) {
+            m_file.flush();
+            m_file.close();
+        }
+    }
+};
+
+namespace details {
+
+inline unsigned long result_line_id(const std::string &line,
+                                    const std::string &filepath)
+{
+    char *end = nullptr;
+    unsigned long id = std::strtoul(line.c_str(), &end, 10);
+
+    if (end == line.c_str())
+        throw result_writer_format_failure(filepath);
+
+    return id;
+}
+
+typedef std::pair <unsigned long, std::string> result_row;
+
+/* Remove the temporary files it holds when it goes out of scope. */
+class result_temporaries
+{
+    std::vector <std::string> m_paths;
+
+public:
+    result_temporaries() = default;
+    result_temporaries(const result_temporaries&) = delete;
+    result_temporaries& operator=(const result_temporaries&) = delete;
+
+    ~result_temporaries()
+    {
+        for (const auto &path : m_paths)
+            std::remove(path.c_str());
+    }
+
+    const std::string& add(const std::string &path)
+    {
+        m_paths.emplace_back(path);
+        return m_paths.back();
+    }
+
+    /* The file @e path is kept (it has been renamed). */
+    void release(const std::string &path)
+    {
+        m_paths.erase(std::remove(m_paths.begin(), m_paths.end(), path),
+                      m_paths.end());
+    }
+};
+
+inline void result_sort_run(std::vector <result_row> &run)
+{
+    std::stable_sort(run.begin(), run.end(),
+                     [](const result_row &lhs, const result_row &rhs)
+                     {
+                         return lhs.first < rhs.first;
+                     });
+}
+
+/*
+ * Merge the rows of the files @e paths, each sorted by identifier, into
+ * @e filepath after @e header. Rows with the same identifier keep the
+ * order of the files.
+ */
+inline void result_merge(const std::vector <std::string> &paths,
+                         std::vector <std::unique_ptr <std::ifstream> >
+                         &readers, const std::string &header,
+                         const std::string &filepath)
+{
+    typedef std::pair <result_row, std::size_t> merge_item;
+    auto greater = [](const merge_item &lhs, const merge_item &rhs)
+        {
+            return lhs.first.first > rhs.first.first ||
+                (lhs.first.first == rhs.first.first &&
+                 lhs.second > rhs.second);
+        };
+
+    std::priority_queue <merge_item, std::vector <merge_item>,
+                         decltype(greater)> heap(greater);
+
+    /* Next non empty row of the reader @e i. */
+    std::string line;
+    auto next = [&](std::size_t i)
+        {
+            while (std::getline(*readers[i], line))
+                if (!line.empty()) {
+                    heap.emplace(result_row(result_line_id(line, paths[i]),
+                                            line), i);
+                    return;
+                }
+        };
+
+    for (std::size_t i = 0, e = readers.size(); i != e; ++i)
+        next(i);
+
+    std::vector <char> buffer(1u << 20);
+    std::ofstream out;
+    out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+    out.open(filepath, std::ios::out | std::ios::trunc);
+    if (!out.is_open())
+        throw result_writer_open_failure(filepath);
+
+    out << header << '\n';
+
+    while (!heap.empty()) {
+        merge_item top = heap.top();
+        heap.pop();
+
+        out << top.first.second << '\n';
+        next(top.second);
+    }
+
+    out.close();
+    if (!out)
+        throw result_writer_open_failure(filepath);
+}
+
+}
+
+/**
+ * Sort the rows of a result file by the identifier in the first column
+ * (the header is kept). The sort is an external merge sort: the file is
+ * read in runs of at most @e run_rows rows, each run is sorted and
+ * written into a temporary file then the runs are merged. Memory usage
+ * is bounded by @e run_rows whatever the size of the file. The merge
+ * is written into a temporary file renamed over @e filepath: on error
+ * the file is left unchanged and the temporary files are removed.
+ */
+inline void sort_result_file(const std::string &filepath,
+                             std::size_t run_rows = 1u << 18)
+{
+    using details::result_row;
+
+    std::ifstream input(filepath);
+    if (!input.is_open())
+        throw result_writer_open_failure(filepath);
+
+    std::string header, line;
+    std::getline(input, header);
+
+    details::result_temporaries temporaries;
+    std::vector <std::string> runs;
+    std::vector <result_row> run;
+    run.reserve(std::min(run_rows, std::size_t(1u << 16)));
+
+    auto write_run = [](const std::vector <result_row> &rows,
+                        const std::string &path)
+        {
+            std::ofstream out(path, std::ios::out | std::ios::trunc);
+            if (!out.is_open())
+                throw result_writer_open_failure(path);
+
+            for (const auto &row : rows)
+                out << row.second << '\n';
+
+            out.close();
+            if (!out)
+                throw result_writer_open_failure(path);
+        };
+
+    bool eof = false;
+    while (!eof) {
+        run.clear();
+
+        while (run.size() < run_rows) {
+            if (!std::getline(input, line)) {
+                eof = true;
+                break;
+            }
+
+            if (line.empty())
+                continue;
+
+            unsigned long id = details::result_line_id(line, filepath);
+            run.emplace_back(id, std::move(line));
+        }
+
+        if (run.empty())
+            break;
+
+        details::result_sort_run(run);
+        runs.emplace_back(temporaries.add(
+                              filepath + ".run" + std::to_string(runs.size())));
+        write_run(run, runs.back());
+    }
+
+    input.close();
+    std::vector <result_row>().swap(run);
+
+    std::vector <std::unique_ptr <std::ifstream> > readers;
+    for (const auto &path : runs) {
+        readers.emplace_back(new std::ifstream(path));
+        if (!readers.back()->is_open())
+            throw result_writer_open_failure(path);
+    }
+
+    std::string tmp = temporaries.add(filepath + ".sort");
+    details::result_merge(runs, readers, header, tmp);
+    readers.clear();
+
+    if (std::rename(tmp.c_str(), filepath.c_str()) != 0)
+        throw result_writer_open_failure(filepath);
+
+    temporaries.release(tmp);
+}
+
+/**
+ * Merge result files, each sorted by identifier (see sort_result_file)
+ * and with the same header, into the result file @e filepath sorted by
+ * identifier. Rows with the same identifier keep the order of
+ * @e inputs.
+ */
+inline void merge_result_files(const std::vector <std::string> &inputs,
+                               const std::string &filepath)
+{
+    std::vector <std::unique_ptr <std::ifstream> > readers;
+    std::string header, line;
+
+    for (const auto &path : inputs) {
+        readers.emplace_back(new std::ifstream(path));
+        if (!readers.back()->is_open())
+            throw result_writer_open_failure(path);
+
+        std::getline(*readers.back(), line);
+        if (readers.size() == 1)
+            header = line;
+        else if (line != header)
+            throw result_writer_header_failure(path);
+    }
+
+    details::result_temporaries temporaries;
+    std::string tmp = temporaries.add(filepath + ".merge");
+    details::result_merge(inputs, readers, header, tmp);
+    readers.clear();
+
+    if (std::rename(tmp.c_str(), filepath.c_str()) != 0)
+        throw result_writer_open_failure(filepath);
+
+    temporaries.release(tmp);
+}
+
+}
+
+#endif
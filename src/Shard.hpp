@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SAFIHR_MODEL_SHARD_HPP
+#define SAFIHR_MODEL_SHARD_HPP
+
+#include <boost/format.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Plan.hpp"
+#include "ResultWriter.hpp"
+
+namespace safihr {
+
+struct shard_format_failure : std::runtime_error
+{
+    explicit shard_format_failure(const std::string &str)
+        : std::runtime_error(
+            (boost::format("Shard: `%1%' is not a shard i/K with 0 <= i < K")
+             % str).str())
+    {}
+};
+
+/**
+ * The shard @e index of @e count of a sowing plan: the parcels whose
+ * identifier modulo @e count is @e index. Each shard is simulated by
+ * its own process and writes its own result file, sorted by
+ * identifier; merge_shards gives the result of the whole plan.
+ */
+struct PlanShard
+{
+    std::uint32_t index;
+    std::uint32_t count; /* 0 if the plan is not sharded. */
+
+    PlanShard()
+        : index(0), count(0)
+    {}
+
+    PlanShard(std::uint32_t index, std::uint32_t count)
+        : index(index), count(count)
+    {}
+
+    bool enabled() const
+    {
+        return count != 0;
+    }
+
+    bool contains(std::uint32_t id) const
+    {
+        return count == 0 || id % count == index;
+    }
+};
+
+/**
+ * Parse a shard `i/K'.
+ *
+ * @throw shard_format_failure.
+ */
+inline PlanShard parse_shard(const std::string &str)
+{
+    unsigned long index, count;
+    int end = 0;
+
+    if (std::sscanf(str.c_str(), "%lu/%lu%n", &index, &count, &end) != 2 ||
+        static_cast <std::size_t>(end) != str.size() || count == 0 ||
+        index >= count || count > UINT32_MAX)
+        throw shard_format_failure(str);
+
+    return PlanShard(static_cast <std::uint32_t>(index),
+                     static_cast <std::uint32_t>(count));
+}
+
+/**
+ * The shard of the SAFIHR_SHARD environment variable (set by
+ * safihr-shard for each process), not sharded if unset.
+ *
+ * @throw shard_format_failure.
+ */
+inline PlanShard shard_from_environment()
+{
+    const char *env = std::getenv("SAFIHR_SHARD");
+
+    return (env && *env) ? parse_shard(env) : PlanShard();
+}
+
+/**
+ * The shard of a `shard' option or condition: `i/K', or `environment'
+ * for the shard of SAFIHR_SHARD. The variable is never read otherwise,
+ * so a process does not inherit the shard of its parent by mistake.
+ *
+ * @throw shard_format_failure.
+ */
+inline PlanShard shard_option(const std::string &value)
+{
+    return value == "environment" ? shard_from_environment() :
+        parse_shard(value);
+}
+
+/**
+ * The result file of a shard: @e filepath itself if the plan is not
+ * sharded, else `filepath.i-of-K'.
+ */
+inline std::string shard_filepath(const std::string &filepath,
+                                  const PlanShard &shard)
+{
+    if (!shard.enabled())
+        return filepath;
+
+    return (boost::format("%1%.%2%-of-%3%") % filepath % shard.index
+            % shard.count).str();
+}
+
+/**
+ * Copy the rows of @e plan in @e shard, with their identifiers, into
+ * @e out.
+ */
+inline void select_shard(const PlanTable &plan, const PlanShard &shard,
+                         PlanTable &out)
+{
+    std::vector <std::uint32_t> rows;
+
+    for (std::size_t row = 0, e = plan.size(); row != e; ++row)
+        if (shard.contains(plan.id[row]))
+            rows.push_back(static_cast <std::uint32_t>(row));
+
+    select_rows(plan, rows, out);
+}
+
+/**
+ * Merge the result files of the @e count shards of @e filepath into
+ * @e filepath, sorted by identifier like the result of the whole plan.
+ * The shard files are removed unless @e keep.
+ */
+inline void merge_shards(const std::string &filepath, std::uint32_t count,
+                         bool keep = false)
+{
+    std::vector <std::string> inputs;
+
+    for (std::uint32_t i = 0; i != count; ++i)
+        inputs.push_back(shard_filepath(filepath, PlanShard(i, count)));
+
+    merge_result_files(inputs, filepath);
+
+    if (!keep)
+        for (const auto &path : inputs)
+            std::remove(path.c_str());
+}
+
+}
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Global.hpp"
+#include "Shard.hpp"
+
+namespace {
+
+void usage()
+{
+    std::cout <<
+        "safihr-shard: run a simulation of a sowing plan as K processes\n"
+        "and merge their results\n\n"
+        "  safihr-shard [options] -- command [arguments]\n"
+        "  safihr-shard --merge --shards K --output file\n\n"
+        "  --shards K         the number of shards\n"
+        "  --jobs n           the number of processes run at once\n"
+        "                     [hardware threads]\n"
+        "  --only first-last  run the shards first to last only (on a\n"
+        "                     node of a cluster) and do not merge\n"
+        "  --output file      the result file of the command\n"
+        "                     [simulation-outputs.csv]\n"
+        "  --merge            merge the shard results of the runs\n"
+        "  --keep             keep the shard results after the merge\n\n"
+        "Each process runs the command with the SAFIHR_SHARD environment\n"
+        "variable set to `i/K': safihr-cropsim (with `--shard\n"
+        "environment') and the CompareDateAI (with its `shard' condition\n"
+        "set to `environment') simulate the parcels whose identifier\n"
+        "modulo K is i and write `file.i-of-K', sorted by identifier. The\n"
+        "merged file is the file of a run of the whole plan:\n\n"
+        "  safihr-shard --shards 8 -- vle-1.1 -P safihr.cropmodel "
+        "compare.vpz\n";
+}
+
+struct Options
+{
+    std::vector <std::string> command;
+    std::string output;
+    unsigned long shards;
+    unsigned long first;
+    unsigned long last;
+    unsigned jobs;
+    bool only;
+    bool merge;
+    bool keep;
+
+    Options()
+        : output("simulation-outputs.csv"), shards(0), first(0), last(0),
+        jobs(0), only(false), merge(false), keep(false)
+    {}
+};
+
+bool parse(int argc, char *argv[], Options &opts)
+{
+    int i = 1;
+    for (; i < argc; ++i) {
+        std::string arg(argv[i]);
+
+        if (arg == "-h" || arg == "--help")
+            return false;
+
+        if (arg == "--") {
+            ++i;
+            break;
+        }
+
+        if (arg == "--merge") {
+            opts.merge = true;
+            continue;
+        }
+
+        if (arg == "--keep") {
+            opts.keep = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for `" << arg << "'\n";
+            return false;
+        }
+
+        std::string value(argv[++i]);
+
+        if (arg == "--shards")
+            opts.shards = safihr::stoi(value);
+        else if (arg == "--jobs")
+            opts.jobs = safihr::stoi(value);
+        else if (arg == "--output")
+            opts.output = value;
+        else if (arg == "--only") {
+            std::string::size_type dash = value.find('-');
+            opts.first = safihr::stoi(value.substr(0, dash));
+            opts.last = dash == std::string::npos ? opts.first :
+                safihr::stoi(value.substr(dash + 1));
+            opts.only = true;
+        } else {
+            std::cerr << "unknown option `" << arg << "'\n";
+            return false;
+        }
+    }
+
+    for (; i < argc; ++i)
+        opts.command.emplace_back(argv[i]);
+
+    if (opts.shards == 0 || opts.shards > UINT32_MAX) {
+        std::cerr << "--shards is mandatory\n";
+        return false;
+    }
+
+    if (!opts.only) {
+        opts.first = 0;
+        opts.last = opts.shards - 1;
+    }
+
+    if (opts.first > opts.last || opts.last >= opts.shards) {
+        std::cerr << "--only must be a range of [0, " << opts.shards - 1
+                  << "]\n";
+        return false;
+    }
+
+    if (opts.merge == !opts.command.empty()) {
+        std::cerr << "a command or --merge is mandatory\n";
+        return false;
+    }
+
+    return true;
+}
+
+/* Run the command with SAFIHR_SHARD=shard/shards. */
+pid_t spawn(const std::vector <std::string> &command, unsigned long shard,
+            unsigned long shards)
+{
+    std::string env = std::to_string(shard) + '/' + std::to_string(shards);
+
+    std::vector <char*> args;
+    for (const auto &arg : command)
+        args.push_back(const_cast <char*>(arg.c_str()));
+    args.push_back(nullptr);
+
+    pid_t pid = ::fork();
+    if (pid < 0)
+        throw std::runtime_error(std::strerror(errno));
+
+    if (pid == 0) {
+        ::setenv("SAFIHR_SHARD", env.c_str(), 1);
+        ::execvp(args[0], args.data());
+        std::cerr << "safihr-shard: " << args[0] << ": "
+                  << std::strerror(errno) << '\n';
+        ::_exit(127);
+    }
+
+    return pid;
+}
+
+/**
+ * Run the shards [first, last], at most @e jobs at once. Return the
+ * number of shards which failed.
+ */
+unsigned long run(const Options &opts)
+{
+    unsigned jobs = opts.jobs ? opts.jobs :
+        std::max(1u, std::thread::hardware_concurrency());
+
+    std::map <pid_t, unsigned long> running;
+    unsigned long next = opts.first, failed = 0;
+
+    while (next <= opts.last || !running.empty()) {
+        while (next <= opts.last && running.size() < jobs) {
+            running[spawn(opts.command, next, opts.shards)] = next;
+            ++next;
+        }
+
+        int status;
+        pid_t pid = ::waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error(std::strerror(errno));
+        }
+
+        auto it = running.find(pid);
+        if (it == running.end())
+            continue;
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "safihr-shard: shard " << it->second << '/'
+                      << opts.shards << " failed\n";
+            ++failed;
+        }
+
+        running.erase(it);
+    }
+
+    return failed;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+
+    if (!parse(argc, argv, opts)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        if (!opts.merge && run(opts) != 0)
+            return EXIT_FAILURE;
+
+        if (opts.merge || !opts.only)
+            safihr::merge_shards(opts.output,
+                                 static_cast <std::uint32_t>(opts.shards),
+                                 opts.keep);
+    } catch (const std::exception &e) {
+        std::cerr << "safihr-shard: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
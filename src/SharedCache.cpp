@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <boost/format.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Hash.hpp"
+#include "SharedCache.hpp"
+#include "Weather.hpp"
+
+namespace safihr {
+
+namespace {
+
+const char shared_cache_magic[8] = { 'S', 'A', 'F', 'I', 'H', 'R', 'S', 'C' };
+const std::uint32_t shared_cache_version = 2;
+
+/* The payload starts on the next cache line. */
+const std::size_t shared_cache_header = 64;
+
+struct SegmentHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::atomic <std::uint32_t> ready;
+    std::uint64_t key;
+    std::uint64_t size;
+    std::uint64_t checksum;
+};
+
+static_assert(sizeof(SegmentHeader) <= shared_cache_header,
+              "the header must fit before the payload");
+
+/* How long a reader waits for a segment being written. */
+const std::chrono::seconds shared_cache_timeout(2);
+
+std::uint64_t checksum(const double *data, std::size_t size)
+{
+    return Hash().update(size).update(data, size * sizeof(double)).value();
+}
+
+/* The segments of a user are never shared with the other users. */
+std::string segment_name(const std::string &kind, std::uint64_t key)
+{
+    return (boost::format("/safihr-v%d-%u-%s-%016x") % shared_cache_version
+            % ::geteuid() % kind % key).str();
+}
+
+/*
+ * Map the segment @e name read only and check it. A segment of an
+ * other user or open to the other users is ignored; a segment which
+ * does not match or is not completed in time is unlinked.
+ */
+bool attach(const std::string &name, std::uint64_t key, void *&mapping,
+            std::size_t &length)
+{
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) || st.st_uid != ::geteuid() ||
+        (st.st_mode & (S_IRWXG | S_IRWXO))) {
+        ::close(fd);
+        return false;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() +
+        shared_cache_timeout;
+
+    /* The writer may not have set the size yet. */
+    while (::fstat(fd, &st) == 0 &&
+           static_cast <std::size_t>(st.st_size) < shared_cache_header &&
+           std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    length = static_cast <std::size_t>(st.st_size);
+    mapping = length < shared_cache_header ? MAP_FAILED :
+        ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (mapping == MAP_FAILED) {
+        ::shm_unlink(name.c_str());
+        return false;
+    }
+
+    const SegmentHeader *header = static_cast <const SegmentHeader*>(mapping);
+    while (header->ready.load(std::memory_order_acquire) == 0 &&
+           std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    const double *data = reinterpret_cast <const double*>(
+        static_cast <const char*>(mapping) + shared_cache_header);
+
+    bool valid = header->ready.load(std::memory_order_acquire) == 1 &&
+        !std::memcmp(header->magic, shared_cache_magic,
+                     sizeof(shared_cache_magic)) &&
+        header->version == shared_cache_version && header->key == key &&
+        shared_cache_header + header->size * sizeof(double) <= length &&
+        header->checksum == checksum(data, header->size);
+
+    if (!valid) {
+        ::munmap(mapping, length);
+        ::shm_unlink(name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Create the segment @e name with @e values. Return false if an other
+ * process created it first or if it can not be created.
+ */
+bool publish(const std::string &name, std::uint64_t key,
+             const std::vector <double> &values, void *&mapping,
+             std::size_t &length)
+{
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return false;
+
+    length = shared_cache_header + values.size() * sizeof(double);
+    mapping = ::ftruncate(fd, static_cast <off_t>(length)) ? MAP_FAILED :
+        ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (mapping == MAP_FAILED) {
+        ::shm_unlink(name.c_str());
+        return false;
+    }
+
+    char *bytes = static_cast <char*>(mapping);
+    if (!values.empty())
+        std::memcpy(bytes + shared_cache_header, values.data(),
+                    values.size() * sizeof(double));
+
+    SegmentHeader *header = reinterpret_cast <SegmentHeader*>(bytes);
+    std::memcpy(header->magic, shared_cache_magic,
+                sizeof(shared_cache_magic));
+    header->version = shared_cache_version;
+    header->key = key;
+    header->size = values.size();
+    header->checksum = checksum(values.data(), values.size());
+    header->ready.store(1, std::memory_order_release);
+
+    ::mprotect(mapping, length, PROT_READ);
+
+    return true;
+}
+
+}
+
+std::shared_ptr <const SharedArray> SharedArray::get(
+    const std::string &kind, std::uint64_t key,
+    const std::function <std::vector <double>()> &make)
+{
+    std::shared_ptr <SharedArray> ret(new SharedArray());
+    const std::string name = segment_name(kind, key);
+
+    bool mapped = attach(name, key, ret->m_mapping, ret->m_length);
+
+    if (!mapped) {
+        ret->m_private = make();
+
+        mapped = publish(name, key, ret->m_private, ret->m_mapping,
+                         ret->m_length) ||
+            attach(name, key, ret->m_mapping, ret->m_length);
+    }
+
+    if (mapped) {
+        const SegmentHeader *header =
+            static_cast <const SegmentHeader*>(ret->m_mapping);
+
+        ret->m_private.clear();
+        ret->m_private.shrink_to_fit();
+        ret->m_data = reinterpret_cast <const double*>(
+            static_cast <const char*>(ret->m_mapping) + shared_cache_header);
+        ret->m_size = header->size;
+    } else {
+        ret->m_mapping = nullptr;
+        ret->m_data = ret->m_private.data();
+        ret->m_size = ret->m_private.size();
+    }
+
+    return ret;
+}
+
+SharedArray::~SharedArray()
+{
+    if (m_mapping)
+        ::munmap(m_mapping, m_length);
+}
+
+bool shared_cache_enabled()
+{
+    static const bool enabled = []()
+        {
+            const char *env = std::getenv("SAFIHR_SHARED_CACHE");
+            return env && *env && std::strcmp(env, "0");
+        }();
+
+    return enabled;
+}
+
+std::shared_ptr <const Photoperiod> make_photoperiod(const Specie &specie,
+                                                     double latitude)
+{
+    if (!shared_cache_enabled())
+        return std::make_shared <Photoperiod>(specie, latitude);
+
+    const std::uint64_t key = Hash()
+        .update(specie.data[Specie::PBASE])
+        .update(specie.data[Specie::POPT])
+        .update(latitude)
+        .value();
+
+    std::shared_ptr <const SharedArray> table = SharedArray::get(
+        "photoperiod", key, [&specie, latitude]()
+        {
+            std::vector <double> values(Photoperiod::table_size);
+            Photoperiod::compute(specie, latitude, values.data());
+            return values;
+        });
+
+    if (table->size() != Photoperiod::table_size)
+        return std::make_shared <Photoperiod>(specie, latitude);
+
+    return std::make_shared <Photoperiod>(table->data(), table);
+}
+
+std::shared_ptr <const SharedArray> shared_weather(
+    const std::string &filepath)
+{
+    std::string content;
+    {
+        std::ifstream file(filepath, std::ios::in | std::ios::binary);
+        if (!file.is_open())
+            throw weather_open_failure(filepath);
+
+        content.assign(std::istreambuf_iterator <char>(file),
+                       std::istreambuf_iterator <char>());
+    }
+
+    const std::uint64_t key = Hash().update(content).value();
+
+    return SharedArray::get(
+        "weather", key, [&filepath]()
+        {
+            WeatherSeries weather;
+            read_weather(filepath, weather);
+
+            std::vector <double> values;
+            values.reserve(4 * weather.size());
+            values.insert(values.end(), weather.tmin.begin(),
+                          weather.tmin.end());
+            values.insert(values.end(), weather.tmax.begin(),
+                          weather.tmax.end());
+            values.insert(values.end(), weather.tmoy.begin(),
+                          weather.tmoy.end());
+            values.insert(values.end(), weather.date.begin(),
+                          weather.date.end());
+            return values;
+        });
+}
+
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SAFIHR_MODEL_SHAREDCACHE_HPP
+#define SAFIHR_MODEL_SHAREDCACHE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CropModel.hpp"
+
+namespace safihr {
+
+/**
+ * A read-only array of doubles shared by the processes of a node
+ * through a named POSIX shared memory segment. The name holds the
+ * cache version, the user, the kind of the data and a hash of the
+ * inputs which produced it, so a segment is only found by processes
+ * of the same user with the same inputs. Only the segments owned by
+ * the user and closed to the other users (mode 0600) are attached. The segment header repeats the version and the hash and
+ * holds a hash of the content, checked at each attach: a segment which
+ * does not match, or which is never completed by its writer, is
+ * removed and never used.
+ *
+ * The first process computes the array and publishes it, the next ones
+ * map it without copy. If the segment can not be created the array
+ * stays private to the process.
+ */
+class SharedArray
+{
+public:
+    /**
+     * The array of @e kind for the inputs @e key: attach to its segment
+     * or compute it with @e make and publish it.
+     */
+    static std::shared_ptr <const SharedArray> get(
+        const std::string &kind, std::uint64_t key,
+        const std::function <std::vector <double>()> &make);
+
+    ~SharedArray();
+
+    SharedArray(const SharedArray&) = delete;
+    SharedArray& operator=(const SharedArray&) = delete;
+
+    const double* data() const
+    {
+        return m_data;
+    }
+
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+    /** false if the array is a private copy. */
+    bool shared() const
+    {
+        return m_mapping != nullptr;
+    }
+
+private:
+    SharedArray()
+        : m_data(nullptr), m_size(0), m_mapping(nullptr), m_length(0)
+    {}
+
+    const double *m_data;
+    std::size_t m_size;
+    void *m_mapping;
+    std::size_t m_length;
+    std::vector <double> m_private;
+};
+
+/**
+ * true if the SAFIHR_SHARED_CACHE environment variable is set to a non
+ * empty value other than `0'.
+ */
+bool shared_cache_enabled();
+
+/**
+ * The photoperiod of @e specie at @e latitude, in the shared cache if
+ * enabled. The table only depends on PBASE, POPT and the latitude.
+ */
+std::shared_ptr <const Photoperiod> make_photoperiod(const Specie &specie,
+                                                     double latitude);
+
+/**
+ * The tmin, tmax, tmoy and date (julian day number) columns (four
+ * arrays of size() / 4 records) of the weather file @e filepath, keyed
+ * by a hash of the file content.
+ *
+ * @throw weather_open_failure, weather_format_failure.
+ */
+std::shared_ptr <const SharedArray> shared_weather(
+    const std::string &filepath);
+
+}
+
+#endif
@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SAFIHR_MODEL_SOWINGPLANNER_HPP
+#define SAFIHR_MODEL_SOWINGPLANNER_HPP
+
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Global.hpp"
+
+namespace safihr {
+
+struct sowing_rule_failure : std::runtime_error
+{
+    explicit sowing_rule_failure(const std::string &filepath,
+                                 std::size_t line)
+        : std::runtime_error(
+            (boost::format("Sowing rules: fail to read line `%1%' of `%2%'")
+             % line % filepath).str())
+    {}
+};
+
+/**
+ * The weather rule of the sowing of a specie: the mean of tmoy over the
+ * last @e days records must be in [tmoy_min, tmoy_max]. The rule fails
+ * until @e days records are received.
+ */
+struct SowingRule
+{
+    std::uint32_t days;
+    double tmoy_min;
+    double tmoy_max;
+};
+
+/**
+ * Mean of the last @e size values. A value is added in O(1), the sum
+ * is computed again at each turn of the buffer to avoid the drift of
+ * the additions and subtractions.
+ */
+class TrailingMean
+{
+    std::vector <double> m_values;
+    std::size_t m_pos;
+    std::size_t m_count;
+    double m_sum;
+
+public:
+    explicit TrailingMean(std::size_t size)
+        : m_values(std::max <std::size_t>(1, size), 0.0), m_pos(0),
+        m_count(0), m_sum(0.0)
+    {}
+
+    std::size_t size() const
+    {
+        return m_values.size();
+    }
+
+    void push(double value)
+    {
+        m_sum += value - m_values[m_pos];
+        m_values[m_pos] = value;
+        m_count = std::min(m_count + 1, m_values.size());
+
+        if (++m_pos == m_values.size()) {
+            m_pos = 0;
+            m_sum = 0.0;
+            for (double v : m_values)
+                m_sum += v;
+        }
+    }
+
+    bool full() const
+    {
+        return m_count == m_values.size();
+    }
+
+    double mean() const
+    {
+        return m_sum / m_values.size();
+    }
+};
+
+/**
+ * Choose the sowing day of the parcels. A parcel is sown on the first
+ * day of its window [dmin, dmax] where the rule of its specie holds, or
+ * on dmax if it never holds. Species without rule are sown on dmin.
+ *
+ * The parcels wait in a calendar indexed by dmin. When their window
+ * opens they move into a queue per specie ordered by dmax. A day costs
+ * one rule evaluation per specie with open windows plus the parcels
+ * sown: waiting parcels are never scanned.
+ *
+ * The rules are only evaluated by advance, when the weather record of
+ * the day is received; open only opens the windows and sows the
+ * parcels without rule or at the end of their window. A parcel is
+ * never sown on a mean of the records before its first day.
+ */
+class SowingPlanner
+{
+public:
+    SowingPlanner()
+        : m_day(std::numeric_limits <std::int32_t>::min())
+    {}
+
+    /** Add the parcel @e id of the specie @e name. */
+    void add(std::uint32_t id, const std::string &name, std::int32_t dmin,
+             std::int32_t dmax)
+    {
+        m_calendar[dmin].push_back(Parcel { id, specie(name), dmax });
+    }
+
+    /** Set the rule of the specie @e name. */
+    void rule(const std::string &name, const SowingRule &rule)
+    {
+        Specie &sp = m_species[specie(name)];
+        sp.rule = rule;
+        sp.window = window(rule.days);
+    }
+
+    /**
+     * Read the rules `specie;days;tmoy_min[;tmoy_max]' of a file with
+     * a header line.
+     */
+    void read_rules(const std::string &filepath)
+    {
+        std::ifstream file(filepath);
+        if (!file.is_open())
+            throw sowing_rule_failure(filepath, 0);
+
+        std::string line;
+        std::getline(file, line);
+
+        std::size_t id = 1;
+        while (std::getline(file, line)) {
+            ++id;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.empty())
+                continue;
+
+            std::vector <std::string> fields(1);
+            for (char c : line) {
+                if (c == ';')
+                    fields.emplace_back();
+                else
+                    fields.back() += c;
+            }
+
+            if (fields.size() < 3 || fields.size() > 4)
+                throw sowing_rule_failure(filepath, id);
+
+            try {
+                int days = safihr::stoi(fields[1]);
+                if (days <= 0)
+                    throw sowing_rule_failure(filepath, id);
+
+                rule(fields[0], SowingRule {
+                        static_cast <std::uint32_t>(days),
+                            safihr::stod(fields[2]),
+                            fields.size() == 4 ? safihr::stod(fields[3]) :
+                            std::numeric_limits <double>::infinity() });
+            } catch (const global_conversion_error &) {
+                throw sowing_rule_failure(filepath, id);
+            }
+        }
+    }
+
+    /** A new weather record: O(1) for each distinct window size. */
+    void weather(double tmoy)
+    {
+        for (auto &window : m_windows)
+            window.push(tmoy);
+    }
+
+    /**
+     * Open the windows of the days up to @e day and append to @e sown
+     * the parcels without rule and the parcels whose window closes at
+     * @e day. The rules are not evaluated: the weather record of @e day
+     * may not be received yet.
+     */
+    void open(std::int32_t day, std::vector <std::uint32_t> &sown)
+    {
+        open_windows(day, sown);
+
+        for (auto &sp : m_species)
+            sow_closing(sp, sown);
+    }
+
+    /**
+     * Append to @e sown the parcels open(@e day) would sow, without
+     * changing the planner: they can be sent with the weather record of
+     * @e day, before open is called.
+     */
+    void due(std::int32_t day, std::vector <std::uint32_t> &sown) const
+    {
+        day = std::max(m_day, day);
+
+        for (auto it = m_calendar.begin();
+             it != m_calendar.end() && it->first <= day; ++it)
+            for (const auto &parcel : it->second)
+                if (m_species[parcel.specie].window < 0 ||
+                    parcel.dmax <= day)
+                    sown.push_back(parcel.id);
+
+        for (const auto &sp : m_species) {
+            if (sp.open.empty() || sp.open.top().dmax > day)
+                continue;
+
+            auto open = sp.open;
+            while (!open.empty() && open.top().dmax <= day) {
+                sown.push_back(open.top().id);
+                open.pop();
+            }
+        }
+    }
+
+    /**
+     * The weather record of @e day is received (see weather): open the
+     * windows up to @e day and append to @e sown the parcels to sow at
+     * @e day. Calling it again for the same day evaluates the rules
+     * with the last weather records.
+     */
+    void advance(std::int32_t day, std::vector <std::uint32_t> &sown)
+    {
+        open_windows(day, sown);
+
+        for (auto &sp : m_species) {
+            if (sp.open.empty())
+                continue;
+
+            if (holds(sp)) {
+                while (!sp.open.empty()) {
+                    sown.push_back(sp.open.top().id);
+                    sp.open.pop();
+                }
+            } else {
+                sow_closing(sp, sown);
+            }
+        }
+    }
+
+    /**
+     * The next day after the last advanced day where a window opens or
+     * a window closes, infinity if there is none.
+     */
+    double next_day() const
+    {
+        double next = std::numeric_limits <double>::infinity();
+
+        if (!m_calendar.empty())
+            next = m_calendar.begin()->first;
+
+        for (const auto &sp : m_species)
+            if (!sp.open.empty())
+                next = std::min(next, static_cast <double>(
+                                    sp.open.top().dmax));
+
+        return next;
+    }
+
+    /** Number of parcels not yet sown. */
+    std::size_t pending() const
+    {
+        std::size_t ret = 0;
+
+        for (const auto &bucket : m_calendar)
+            ret += bucket.second.size();
+
+        for (const auto &sp : m_species)
+            ret += sp.open.size();
+
+        return ret;
+    }
+
+private:
+    struct Parcel
+    {
+        std::uint32_t id;
+        std::uint16_t specie;
+        std::int32_t dmax;
+    };
+
+    struct LaterDmax
+    {
+        bool operator()(const Parcel &lhs, const Parcel &rhs) const
+        {
+            return lhs.dmax > rhs.dmax;
+        }
+    };
+
+    struct Specie
+    {
+        std::string name;
+        SowingRule rule;
+        int window; /* index in m_windows, -1 without rule. */
+        std::priority_queue <Parcel, std::vector <Parcel>, LaterDmax> open;
+    };
+
+    std::uint16_t specie(const std::string &name)
+    {
+        auto it = m_ids.find(name);
+        if (it != m_ids.end())
+            return it->second;
+
+        std::uint16_t id = static_cast <std::uint16_t>(m_species.size());
+        m_species.push_back(Specie { name, SowingRule { 0, 0.0, 0.0 }, -1,
+                    {} });
+        m_ids.emplace(name, id);
+
+        return id;
+    }
+
+    void open_windows(std::int32_t day, std::vector <std::uint32_t> &sown)
+    {
+        m_day = std::max(m_day, day);
+
+        while (!m_calendar.empty() && m_calendar.begin()->first <= m_day) {
+            for (const auto &parcel : m_calendar.begin()->second) {
+                Specie &sp = m_species[parcel.specie];
+                if (sp.window < 0)
+                    sown.push_back(parcel.id);
+                else
+                    sp.open.push(parcel);
+            }
+            m_calendar.erase(m_calendar.begin());
+        }
+    }
+
+    /* Sow the parcels of @e sp at the end of their window. */
+    void sow_closing(Specie &sp, std::vector <std::uint32_t> &sown)
+    {
+        while (!sp.open.empty() && sp.open.top().dmax <= m_day) {
+            sown.push_back(sp.open.top().id);
+            sp.open.pop();
+        }
+    }
+
+    /* The species with the same number of days share a window. */
+    int window(std::uint32_t days)
+    {
+        days = std::max <std::uint32_t>(1, days);
+
+        for (std::size_t i = 0, e = m_windows.size(); i != e; ++i)
+            if (m_windows[i].size() == days)
+                return static_cast <int>(i);
+
+        m_windows.emplace_back(days);
+        return static_cast <int>(m_windows.size() - 1);
+    }
+
+    bool holds(const Specie &sp) const
+    {
+        const TrailingMean &window = m_windows[sp.window];
+
+        return window.full() && window.mean() >= sp.rule.tmoy_min &&
+            window.mean() <= sp.rule.tmoy_max;
+    }
+
+    std::map <std::int32_t, std::vector <Parcel> > m_calendar;
+    std::vector <Specie> m_species;
+    std::unordered_map <std::string, std::uint16_t> m_ids;
+    std::vector <TrailingMean> m_windows;
+    std::int32_t m_day;
+};
+
+}
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "BuiltinSpecies.hpp"
+#include "CropEngine.hpp"
+
+namespace {
+
+void usage()
+{
+    std::cout <<
+        "safihr-sowingtable: emergence and maturity days of each specie\n"
+        "for a sowing at each day of a weather file\n\n"
+        "  --weather file     the weather file (date;tmin;tmax;tmoy)\n"
+        "  --species file     the specie parameters [built-in species]\n"
+        "  --latitude value   the latitude of the parcels [48.48]\n"
+        "  --output file      the table [sowing-table.bin]\n"
+        "  --csv              write a csv file (specie;sowing;emergence;\n"
+        "                     maturity) instead of the binary table\n"
+        "  --threads n        the number of threads [hardware threads]\n"
+        "  --validate n       simulate n sowing days of each specie from\n"
+        "                     scratch, report the differences and exit\n\n"
+        "The binary table is little endian: the magic `SAFIHRST', the\n"
+        "uint32 version, the uint32 number of species, the int32 julian\n"
+        "day of the first sowing day, the uint32 number of sowing days,\n"
+        "the specie names (uint16 length and bytes) then, by specie and\n"
+        "sowing day, the uint16 emergence and maturity days relative to\n"
+        "the sowing day, 65535 if not reached.\n";
+}
+
+struct Options
+{
+    std::string weather;
+    std::string species;
+    std::string output;
+    double latitude;
+    long validate;
+    unsigned threads;
+    bool csv;
+
+    Options()
+        : output("sowing-table.bin"), latitude(48.48), validate(0),
+        threads(0), csv(false)
+    {}
+};
+
+bool parse(int argc, char *argv[], Options &opts)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+
+        if (arg == "-h" || arg == "--help")
+            return false;
+
+        if (arg == "--csv") {
+            opts.csv = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for `" << arg << "'\n";
+            return false;
+        }
+
+        std::string value(argv[++i]);
+
+        if (arg == "--weather")
+            opts.weather = value;
+        else if (arg == "--species")
+            opts.species = value;
+        else if (arg == "--output")
+            opts.output = value;
+        else if (arg == "--latitude")
+            opts.latitude = safihr::stod(value);
+        else if (arg == "--validate")
+            opts.validate = safihr::stoi(value);
+        else if (arg == "--threads")
+            opts.threads = safihr::stoi(value);
+        else {
+            std::cerr << "unknown option `" << arg << "'\n";
+            return false;
+        }
+    }
+
+    if (opts.weather.empty()) {
+        std::cerr << "--weather is mandatory\n";
+        return false;
+    }
+
+    return true;
+}
+
+constexpr std::uint32_t table_version = 1;
+constexpr std::uint16_t not_reached = 0xffff;
+
+template <typename T>
+void write(std::ostream &out, T value)
+{
+    unsigned char bytes[sizeof(T)];
+    for (std::size_t i = 0; i != sizeof(T); ++i)
+        bytes[i] = static_cast <unsigned char>(
+            static_cast <std::uint64_t>(value) >> (8 * i));
+
+    out.write(reinterpret_cast <const char*>(bytes), sizeof(T));
+}
+
+/* A day relative to the sowing day, not_reached if -1 or too far. */
+std::uint16_t offset(std::int32_t day, std::int32_t sowing)
+{
+    return (day < 0 || day - sowing >= not_reached) ? not_reached :
+        static_cast <std::uint16_t>(day - sowing);
+}
+
+void write_table(const std::string &filepath,
+                 const safihr::SowingTable &table)
+{
+    std::ofstream file(filepath, std::ios::out | std::ios::binary |
+                       std::ios::trunc);
+    if (!file.is_open())
+        throw std::runtime_error("SowingTable: can not write `" + filepath +
+                                 "'");
+
+    file.write("SAFIHRST", 8);
+    write <std::uint32_t>(file, table_version);
+    write <std::uint32_t>(file, static_cast <std::uint32_t>(
+                              table.species.size()));
+    write <std::int32_t>(file, table.first);
+    write <std::uint32_t>(file, static_cast <std::uint32_t>(table.days));
+
+    for (const auto &name : table.species) {
+        write <std::uint16_t>(file, static_cast <std::uint16_t>(name.size()));
+        file.write(name.data(), name.size());
+    }
+
+    for (std::size_t i = 0, e = table.dlev.size(); i != e; ++i) {
+        const std::int32_t sowing = table.first +
+            static_cast <std::int32_t>(i % table.days);
+
+        write <std::uint16_t>(file, offset(table.dlev[i], sowing));
+        write <std::uint16_t>(file, offset(table.result[i], sowing));
+    }
+
+    if (!file)
+        throw std::runtime_error("SowingTable: can not write `" + filepath +
+                                 "'");
+}
+
+void write_csv(const std::string &filepath,
+               const safihr::SowingTable &table)
+{
+    std::ofstream file(filepath, std::ios::out | std::ios::trunc);
+    if (!file.is_open())
+        throw std::runtime_error("SowingTable: can not write `" + filepath +
+                                 "'");
+
+    file << "libelle_occup;Date-semis;Date-Lev;Date-recolte-simulee\n";
+
+    for (std::size_t i = 0, e = table.dlev.size(); i != e; ++i)
+        file << table.species[i / table.days] << ';'
+             << safihr::format_date(table.first + static_cast <std::int32_t>(
+                                        i % table.days)) << ';'
+             << safihr::format_date(table.dlev[i]) << ';'
+             << safihr::format_date(table.result[i]) << '\n';
+
+    if (!file)
+        throw std::runtime_error("SowingTable: can not write `" + filepath +
+                                 "'");
+}
+
+/**
+ * Simulate @e sample evenly spaced sowing days of each specie with
+ * CropEngine::simulate and count the differences with @e table.
+ */
+std::size_t validate(const safihr::CropEngine &engine,
+                     const safihr::WeatherSeries &weather, std::int32_t end,
+                     const safihr::SowingTable &table, std::size_t sample)
+{
+    std::size_t differ = 0;
+    sample = std::min(sample, table.days);
+
+    for (std::size_t s = 0, e = table.species.size(); s != e; ++s) {
+        for (std::size_t k = 0; k != sample; ++k) {
+            const std::size_t day = k * table.days / sample;
+            const std::size_t i = s * table.days + day;
+            std::int32_t dlev, result;
+
+            engine.simulate(engine.find(table.species[s]),
+                            table.first + static_cast <std::int32_t>(day),
+                            weather.tmoy.data(), weather.size(),
+                            weather.begin, end, dlev, result);
+
+            if (dlev != table.dlev[i] || result != table.result[i]) {
+                ++differ;
+                std::cerr << table.species[s] << " sown "
+                          << safihr::format_date(table.first +
+                                                 static_cast <std::int32_t>(
+                                                     day))
+                          << ": " << safihr::format_date(table.dlev[i]) << ' '
+                          << safihr::format_date(table.result[i])
+                          << " instead of " << safihr::format_date(dlev)
+                          << ' ' << safihr::format_date(result) << '\n';
+            }
+        }
+    }
+
+    return differ;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+
+    if (!parse(argc, argv, opts)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+
+        safihr::WeatherSeries weather;
+        safihr::read_weather(opts.weather, weather);
+
+        safihr::CropEngine engine(
+            opts.species.empty() ? safihr::builtin_species() :
+            safihr::SpecieFileReader(opts.species).get_all(), opts.latitude);
+
+        const std::int32_t end = weather.begin +
+            static_cast <std::int32_t>(weather.size());
+
+        auto loaded = std::chrono::steady_clock::now();
+
+        safihr::SowingTable table;
+        engine.sowing_table(weather, weather.begin, end, table, opts.threads);
+
+        auto computed = std::chrono::steady_clock::now();
+
+        typedef std::chrono::duration <double> seconds;
+
+        if (opts.validate > 0) {
+            std::size_t differ = validate(
+                engine, weather, end, table,
+                static_cast <std::size_t>(opts.validate));
+
+            std::cout << table.species.size() << " species x "
+                      << std::min(table.days, static_cast <std::size_t>(
+                                      opts.validate))
+                      << " sowing days, " << differ << " differ\n";
+            return differ ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+
+        if (opts.csv)
+            write_csv(opts.output, table);
+        else
+            write_table(opts.output, table);
+
+        auto written = std::chrono::steady_clock::now();
+
+        std::cerr << table.species.size() << " species x " << table.days
+                  << " sowing days, read "
+                  << seconds(loaded - start).count() << "s, table "
+                  << seconds(computed - loaded).count() << "s, write "
+                  << seconds(written - computed).count() << "s\n";
+    } catch (const std::exception &e) {
+        std::cerr << "safihr-sowingtable: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
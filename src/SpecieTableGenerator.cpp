@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Build step: generate the SpecieTable.hpp header of the built-in
+ * species from a CULTURES.csv file.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "CropModel.hpp"
+#include "Hash.hpp"
+
+namespace {
+
+std::string literal(double value)
+{
+    if (std::isinf(value))
+        return value > 0 ? "infinity" : "-infinity";
+
+    std::ostringstream out;
+    out.imbue(std::locale::classic());
+    out.precision(17);
+    out << value;
+
+    std::string str = out.str();
+    if (str.find_first_of(".e") == std::string::npos)
+        str += ".0";
+
+    return str;
+}
+
+/**
+ * Find an offset basis of string_hash without collision of the names
+ * in a table of 2^(32 - @e shift) slots. The slot is given by the high
+ * bits of the hash: the low bits only depend on the low bits of the
+ * seed.
+ */
+std::uint32_t find_seed(const std::vector <safihr::Specie> &species,
+                        unsigned shift)
+{
+    for (std::uint32_t seed = 2166136261u; ; ++seed) {
+        std::set <std::uint32_t> used;
+        bool collision = false;
+
+        for (const auto &specie : species) {
+            std::uint32_t slot = safihr::string_hash(specie.name.c_str(),
+                                                     seed) >> shift;
+            if (!used.insert(slot).second) {
+                collision = true;
+                break;
+            }
+        }
+
+        if (!collision)
+            return seed;
+    }
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        std::cerr << "usage: safihr-speciegen CULTURES.csv SpecieTable.hpp\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        safihr::SpecieFileReader reader(argv[1]);
+        std::vector <safihr::Specie> species = reader.get_all();
+
+        if (species.empty())
+            throw std::runtime_error("no specie");
+
+        std::set <std::string> names;
+        for (const auto &specie : species)
+            if (!names.insert(specie.name).second)
+                throw std::runtime_error("specie `" + specie.name +
+                                         "' is defined twice");
+
+        if (species.size() > 16384)
+            throw std::runtime_error("too many species");
+
+        std::uint32_t slots = 2;
+        unsigned shift = 31;
+        while (slots < 2 * species.size()) {
+            slots *= 2;
+            --shift;
+        }
+
+        const std::uint32_t seed = find_seed(species, shift);
+
+        std::vector <int> table(slots, -1);
+        for (std::size_t i = 0; i != species.size(); ++i)
+            table[safihr::string_hash(species[i].name.c_str(), seed) >>
+                  shift] = static_cast <int>(i);
+
+        std::ostringstream out;
+        out << "/* Generated by safihr-speciegen from " << argv[1]
+            << ", do not edit. */\n\n"
+            << "#ifndef SAFIHR_MODEL_SPECIETABLE_HPP\n"
+            << "#define SAFIHR_MODEL_SPECIETABLE_HPP\n\n"
+            << "#include <cstddef>\n#include <cstdint>\n#include <limits>\n\n"
+            << "namespace safihr { namespace specie_table {\n\n"
+            << "constexpr double infinity = "
+            << "std::numeric_limits <double>::infinity();\n\n"
+            << "constexpr std::size_t size = " << species.size() << ";\n"
+            << "constexpr std::size_t parameters = "
+            << species.front().data.size() << ";\n"
+            << "constexpr std::uint32_t seed = " << seed << "u;\n"
+            << "constexpr std::uint32_t slots = " << slots << ";\n"
+            << "constexpr unsigned shift = " << shift << ";\n\n";
+
+        out << "constexpr const char *names[size] = {\n";
+        for (const auto &specie : species)
+            out << "    \"" << specie.name << "\",\n";
+        out << "};\n\n";
+
+        out << "constexpr double data[size][parameters] = {\n";
+        for (const auto &specie : species) {
+            out << "    { /* " << specie.name << " */\n";
+            for (std::size_t j = 0; j != specie.data.size(); ++j)
+                out << "        " << literal(specie.data[j]) << ",\n";
+            out << "    },\n";
+        }
+        out << "};\n\n";
+
+        out << "/* Index of the specie in each slot of the hash, -1 if"
+            << " empty. */\n"
+            << "constexpr std::int16_t index[slots] = {\n";
+        for (int i : table)
+            out << "    " << i << ",\n";
+        out << "};\n\n} }\n\n#endif\n";
+
+        std::ofstream file(argv[2]);
+        if (!(file << out.str()))
+            throw std::runtime_error(std::string("can not write `") +
+                                     argv[2] + "'");
+    } catch (const std::exception &e) {
+        std::cerr << "safihr-speciegen: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
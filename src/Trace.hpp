@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SAFIHR_MODEL_TRACE_HPP
+#define SAFIHR_MODEL_TRACE_HPP
+
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace safihr {
+
+enum class TraceEvent : std::uint16_t
+{
+    header = 0,   /* parcel: trace_version, values[0]: record size. */
+    crop_built,   /* a crop model is built. */
+    crop_specie,  /* values: the specie name, at most 24 characters. */
+    crop_sown,    /* values[0]: latitude. */
+    crop_status,  /* values[0]: status, values[1]: day of emergence. */
+    ai_built,     /* values[0]: number of parcels of the plan. */
+    ai_specie,    /* values: the specie name, at most 24 characters. */
+    ai_schedule,  /* values[0]: dmax. */
+    ai_start,     /* values[0]: start messages, values[1]: plan index. */
+    ai_maturity,  /* values[0]: day of emergence. */
+    crop_day,     /* values: vdd, udev and tmoy after a computed day. */
+    last
+};
+
+inline const char* to_string(TraceEvent event)
+{
+    static const char *str[] = { "header", "crop_built", "crop_specie",
+                                 "crop_sown", "crop_status", "ai_built",
+                                 "ai_specie", "ai_schedule", "ai_start",
+                                 "ai_maturity", "crop_day" };
+
+    return event < TraceEvent::last ?
+        str[static_cast <std::uint16_t>(event)] : "unknown";
+}
+
+/**
+ * A fixed size trace record. The file is a sequence of records in the
+ * native byte order, each write of a thread buffer starts with a
+ * @c header record.
+ */
+struct TraceRecord
+{
+    std::uint16_t event;
+    std::uint16_t thread;
+    std::uint32_t parcel;
+    double day;
+    double values[3];
+};
+
+static_assert(sizeof(TraceRecord) == 40, "TraceRecord must be packed");
+
+const std::uint32_t trace_version = 1;
+
+struct trace_file_failure : std::runtime_error
+{
+    explicit trace_file_failure(const std::string &filepath)
+        : std::runtime_error(
+            (boost::format("Trace: bad or unreadable file `%1%' (version %2%)")
+             % filepath % trace_version).str())
+    {}
+};
+
+/**
+ * The trace is enabled with the SAFIHR_TRACE environment variable,
+ * the path of the trace file. Records are appended to the file so
+ * several processes or plugins may share it. SAFIHR_TRACE_RECORDS is
+ * the size of the per-thread buffer in records [65536].
+ *
+ * If SAFIHR_TRACE_RING is set to 1, the buffer is a ring which keeps
+ * the last SAFIHR_TRACE_RECORDS records of the thread and is only
+ * written when the thread exits.
+ */
+struct TraceConfig
+{
+    std::string filepath;
+    std::size_t capacity;
+    bool ring;
+    bool enabled;
+
+    TraceConfig()
+        : capacity(1u << 16), ring(false), enabled(false)
+    {
+        if (const char *env = std::getenv("SAFIHR_TRACE")) {
+            filepath = env;
+            enabled = !filepath.empty();
+        }
+
+        if (const char *env = std::getenv("SAFIHR_TRACE_RECORDS"))
+            capacity = std::max(1ul, std::strtoul(env, nullptr, 10));
+
+        if (const char *env = std::getenv("SAFIHR_TRACE_RING"))
+            ring = std::strcmp(env, "1") == 0;
+    }
+
+    TraceConfig(const std::string &filepath, std::size_t capacity,
+                bool ring)
+        : filepath(filepath), capacity(std::max(std::size_t(1), capacity)),
+        ring(ring), enabled(!filepath.empty())
+    {}
+};
+
+inline const TraceConfig& trace_config()
+{
+    static const TraceConfig config;
+
+    return config;
+}
+
+/**
+ * The per-thread buffer of records. It is written into the trace file
+ * when full, when flushed by the models at the end of the simulation
+ * and when the thread exits, so no record is lost. In ring mode the
+ * oldest records are overwritten instead and only the last @e capacity
+ * records are written.
+ */
+class TraceBuffer
+{
+    TraceConfig m_config;
+    std::vector <TraceRecord> m_records; /* the header and the records. */
+    std::size_t m_size;
+    std::size_t m_next;
+    std::uint16_t m_thread;
+
+public:
+    explicit TraceBuffer(const TraceConfig &config = trace_config())
+        : m_config(config), m_records(config.capacity + 1), m_size(0),
+        m_next(0),
+        m_thread(static_cast <std::uint16_t>(
+                     std::hash <std::thread::id>()(
+                         std::this_thread::get_id())))
+    {
+        TraceRecord &header = m_records.front();
+        header.event = static_cast <std::uint16_t>(TraceEvent::header);
+        header.thread = m_thread;
+        header.parcel = trace_version;
+        header.day = 0.0;
+        header.values[0] = sizeof(TraceRecord);
+        header.values[1] = 0.0;
+        header.values[2] = 0.0;
+    }
+
+    ~TraceBuffer()
+    {
+        flush();
+    }
+
+    TraceBuffer(const TraceBuffer&) = delete;
+    TraceBuffer& operator=(const TraceBuffer&) = delete;
+
+    bool ring() const
+    {
+        return m_config.ring;
+    }
+
+    void push(TraceEvent event, std::uint32_t parcel, double day,
+              double v0, double v1, double v2)
+    {
+        TraceRecord &record = m_records[1 + m_next];
+        record.event = static_cast <std::uint16_t>(event);
+        record.thread = m_thread;
+        record.parcel = parcel;
+        record.day = day;
+        record.values[0] = v0;
+        record.values[1] = v1;
+        record.values[2] = v2;
+
+        m_next = (m_next + 1) % m_config.capacity;
+        m_size = std::min(m_size + 1, m_config.capacity);
+
+        if (!m_config.ring && m_size == m_config.capacity)
+            flush();
+    }
+
+    /**
+     * Append the header and the records, oldest first, to the trace
+     * file with one unbuffered write so the records of several threads
+     * are never interleaved.
+     */
+    void flush()
+    {
+        if (m_size == 0)
+            return;
+
+        if (m_size == m_config.capacity && m_next != 0)
+            std::rotate(m_records.begin() + 1, m_records.begin() + 1 + m_next,
+                        m_records.end());
+
+        const std::string &filepath = m_config.filepath;
+        if (std::FILE *file = std::fopen(filepath.c_str(), "ab")) {
+            std::setvbuf(file, nullptr, _IONBF, 0);
+            std::fwrite(m_records.data(), sizeof(TraceRecord), m_size + 1,
+                        file);
+            std::fclose(file);
+        } else {
+            std::cerr << "Trace: can not open `" << filepath << "'\n";
+        }
+
+        m_size = 0;
+        m_next = 0;
+    }
+};
+
+inline TraceBuffer& trace_buffer()
+{
+    thread_local TraceBuffer buffer;
+
+    return buffer;
+}
+
+/** Add a record to the trace if SAFIHR_TRACE is defined. */
+inline void trace(TraceEvent event, std::uint32_t parcel, double day,
+                  double v0 = 0.0, double v1 = 0.0, double v2 = 0.0)
+{
+    if (trace_config().enabled)
+        trace_buffer().push(event, parcel, day, v0, v1, v2);
+}
+
+/** Add a record whose values are the first 24 characters of @e str. */
+inline void trace(TraceEvent event, std::uint32_t parcel, double day,
+                  const std::string &str)
+{
+    if (trace_config().enabled) {
+        double values[3] = { 0.0, 0.0, 0.0 };
+        std::memcpy(values, str.data(), std::min(str.size(),
+                                                 sizeof(values)));
+        trace_buffer().push(event, parcel, day, values[0], values[1],
+                            values[2]);
+    }
+}
+
+/**
+ * Write the records of the current thread into the trace file. The
+ * ring keeps its records until the thread exits.
+ */
+inline void trace_flush()
+{
+    if (trace_config().enabled && !trace_buffer().ring())
+        trace_buffer().flush();
+}
+
+/**
+ * Read the records of a trace file. The header records are checked and
+ * skipped.
+ */
+class TraceReader
+{
+    std::string m_filepath;
+    std::FILE *m_file;
+    unsigned long m_index;
+
+public:
+    /** @throw trace_file_failure if the file can not be opened. */
+    explicit TraceReader(const std::string &filepath)
+        : m_filepath(filepath), m_file(std::fopen(filepath.c_str(), "rb")),
+        m_index(0)
+    {
+        if (!m_file)
+            throw trace_file_failure(filepath);
+    }
+
+    ~TraceReader()
+    {
+        std::fclose(m_file);
+    }
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    /**
+     * Read the next record.
+     *
+     * @return false at the end of the file.
+     * @throw trace_file_failure if the file does not start with a header
+     * of this version or if a record is unknown.
+     */
+    bool next(TraceRecord &record)
+    {
+        while (std::fread(&record, sizeof(record), 1, m_file) == 1) {
+            const bool header = record.event == static_cast <std::uint16_t>(
+                TraceEvent::header);
+
+            if ((m_index++ == 0 || header) &&
+                (!header || record.parcel != trace_version ||
+                 record.values[0] != sizeof(record)))
+                throw trace_file_failure(m_filepath);
+
+            if (record.event >= static_cast <std::uint16_t>(TraceEvent::last))
+                throw trace_file_failure(m_filepath);
+
+            if (!header)
+                return true;
+        }
+
+        return false;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "Calendar.hpp"
+#include "Global.hpp"
+#include "Trace.hpp"
+
+namespace {
+
+void usage()
+{
+    std::cout <<
+        "safihr-tracedump: decode a SAFIHR_TRACE file\n\n"
+        "  safihr-tracedump [options] file\n\n"
+        "  --event name       only print the records of this event\n"
+        "  --parcel id        only print the records of this parcel\n";
+}
+
+std::string record_name(const safihr::TraceRecord &record)
+{
+    char buffer[sizeof(record.values) + 1];
+    std::memcpy(buffer, record.values, sizeof(record.values));
+    buffer[sizeof(record.values)] = '\0';
+
+    return buffer;
+}
+
+std::string record_day(double day)
+{
+    return day >= 1.0 ? safihr::format_date(day) : std::to_string(day);
+}
+
+void print(const safihr::TraceRecord &record)
+{
+    using safihr::TraceEvent;
+
+    TraceEvent event = static_cast <TraceEvent>(record.event);
+
+    std::cout << record.thread << ' ' << safihr::to_string(event) << ' '
+              << record.parcel << ' ' << record_day(record.day);
+
+    switch (event) {
+    case TraceEvent::crop_specie:
+    case TraceEvent::ai_specie:
+        std::cout << ' ' << record_name(record);
+        break;
+    case TraceEvent::crop_status:
+        std::cout << ' ' << safihr::to_string(
+            static_cast <safihr::StatusModel>(record.values[0]))
+                  << ' ' << record_day(record.values[1]);
+        break;
+    case TraceEvent::crop_day:
+        std::cout << " vdd=" << record.values[0] << " udev="
+                  << record.values[1] << " tmoy=" << record.values[2];
+        break;
+    case TraceEvent::ai_schedule:
+    case TraceEvent::ai_maturity:
+        std::cout << ' ' << record_day(record.values[0]);
+        break;
+    default:
+        std::cout << ' ' << record.values[0] << ' ' << record.values[1]
+                  << ' ' << record.values[2];
+        break;
+    }
+
+    std::cout << '\n';
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    std::string filepath, event;
+    long parcel = -1;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+
+        if (arg == "-h" || arg == "--help") {
+            usage();
+            return EXIT_SUCCESS;
+        } else if (arg == "--event" && i + 1 < argc) {
+            event = argv[++i];
+        } else if (arg == "--parcel" && i + 1 < argc) {
+            parcel = safihr::stoi(argv[++i]);
+        } else if (filepath.empty() && arg[0] != '-') {
+            filepath = arg;
+        } else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (filepath.empty()) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        safihr::TraceReader reader(filepath);
+        safihr::TraceRecord record;
+
+        while (reader.next(record)) {
+            if (parcel >= 0 && record.parcel != static_cast <unsigned long>(
+                    parcel))
+                continue;
+
+            if (!event.empty() && event != safihr::to_string(
+                    static_cast <safihr::TraceEvent>(record.event)))
+                continue;
+
+            print(record);
+        }
+    } catch (const safihr::trace_file_failure &e) {
+        std::cerr << "safihr-tracedump: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef SAFIHR_MODEL_WEATHER_HPP
+#define SAFIHR_MODEL_WEATHER_HPP
+
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Calendar.hpp"
+#include "Global.hpp"
+#include "Hash.hpp"
+
+namespace safihr {
+
+struct weather_open_failure : std::runtime_error
+{
+    explicit weather_open_failure(const std::string &filepath)
+        : std::runtime_error(
+            (boost::format("Weather: can not open file `%1%'")
+             % filepath).str())
+    {}
+};
+
+struct weather_format_failure : std::runtime_error
+{
+    explicit weather_format_failure(std::size_t line)
+        : std::runtime_error(
+            (boost::format("Weather: fail to read line `%1%'") % line).str())
+    {}
+};
+
+/**
+ * A daily weather series `date;tmin;tmax;tmoy'. Like the Meteo model,
+ * simulations use the records as consecutive days from the beginning of
+ * the simulation whatever the dates in the file (some files have
+ * missing days). The @e begin attribute is the date of the first
+ * record.
+ */
+struct WeatherSeries
+{
+    std::int32_t begin;
+    std::uint32_t station;
+    std::vector <std::int32_t> date;
+    std::vector <double> tmin;
+    std::vector <double> tmax;
+    std::vector <double> tmoy;
+
+    WeatherSeries()
+        : begin(0), station(0)
+    {}
+
+    std::size_t size() const
+    {
+        return tmoy.size();
+    }
+
+    /**
+     * A hash of the temperatures used by the crop models.
+     */
+    std::uint64_t content_hash() const
+    {
+        Hash hash;
+        hash.update(tmoy.size());
+        hash.update(tmoy.data(), tmoy.size() * sizeof(double));
+        return hash.value();
+    }
+};
+
+/**
+ * An ensemble of K weather series, the members, read as consecutive
+ * days from @e begin. The temperatures of the K members for the record
+ * @e i are stored together: tmoy[i * members + k].
+ */
+struct WeatherEnsemble
+{
+    std::int32_t begin;
+    std::size_t members;
+    std::vector <double> tmoy;
+
+    WeatherEnsemble()
+        : begin(0), members(0)
+    {}
+
+    /** Number of records of each member. */
+    std::size_t size() const
+    {
+        return members ? tmoy.size() / members : 0;
+    }
+
+    /** The K temperatures of the record @e i. */
+    const double* record(std::size_t i) const
+    {
+        return &tmoy[i * members];
+    }
+};
+
+/**
+ * Build an ensemble with a member for each series and each offset
+ * added to its temperatures (a series with the offsets -1, 0 and 1
+ * gives 3 members). The members are truncated to the shortest series
+ * and begin with the first series.
+ */
+inline void make_ensemble(const std::vector <WeatherSeries> &series,
+                          const std::vector <double> &offsets,
+                          WeatherEnsemble &ensemble)
+{
+    ensemble = WeatherEnsemble();
+    if (series.empty() || offsets.empty())
+        return;
+
+    std::size_t size = series.front().size();
+    for (const auto &member : series)
+        size = std::min(size, member.size());
+
+    ensemble.begin = series.front().begin;
+    ensemble.members = series.size() * offsets.size();
+    ensemble.tmoy.reserve(size * ensemble.members);
+
+    for (std::size_t i = 0; i != size; ++i)
+        for (const auto &member : series)
+            for (double offset : offsets)
+                ensemble.tmoy.push_back(member.tmoy[i] + offset);
+}
+
+/**
+ * Read a whole weather file. Trailing columns are ignored.
+ */
+inline void read_weather(const std::string &filepath, WeatherSeries &weather)
+{
+    std::ifstream file(filepath);
+    if (!file.is_open())
+        throw weather_open_failure(filepath);
+
+    std::string line;
+    if (!std::getline(file, line))
+        throw weather_format_failure(0);
+
+    weather = WeatherSeries();
+
+    std::size_t line_id = 1;
+    while (std::getline(file, line)) {
+        ++line_id;
+
+        if (line.empty() || line == "\r")
+            continue;
+
+        const char *str = line.c_str();
+        const char *sep = std::find(str, str + line.size(), ';');
+        std::int32_t jdn;
+
+        if (!parse_date(str, sep, jdn))
+            throw weather_format_failure(line_id);
+
+        if (weather.tmoy.empty())
+            weather.begin = jdn;
+
+        double values[3];
+        for (int i = 0; i < 3; ++i) {
+            if (*sep != ';')
+                throw weather_format_failure(line_id);
+
+            str = sep + 1;
+            char *end;
+            values[i] = strtod_c(str, &end);
+            if (end == str || (*end != ';' && *end != '\0' && *end != '\r'))
+                throw weather_format_failure(line_id);
+            sep = end;
+        }
+
+        weather.date.push_back(jdn);
+        weather.tmin.push_back(values[0]);
+        weather.tmax.push_back(values[1]);
+        weather.tmoy.push_back(values[2]);
+    }
+}
+
+}
+
+#endif
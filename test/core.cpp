@@ -0,0 +1,1577 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Unit tests of the crop model core (safihr-cropcore), without VLE.
+ */
+
+#define BOOST_TEST_MAIN
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core_test
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <chrono>
+#include <clocale>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "BuiltinSpecies.hpp"
+#include "Calendar.hpp"
+#include "CropEngine.hpp"
+#include "Forecast.hpp"
+#include "Metrics.hpp"
+#include "ObservationPolicy.hpp"
+#include "PhenologyAggregates.hpp"
+#include "Plan.hpp"
+#include "PrefetchReader.hpp"
+#include "ResultStore.hpp"
+#include "ResultWriter.hpp"
+#include "SharedCache.hpp"
+#include "SowingPlanner.hpp"
+#include "Trace.hpp"
+#include "Weather.hpp"
+
+namespace {
+
+std::string read_file(const std::string &filepath)
+{
+    std::ifstream file(filepath);
+    std::ostringstream out;
+    out << file.rdbuf();
+    return out.str();
+}
+
+void write_file(const std::string &filepath, const std::string &content)
+{
+    std::ofstream file(filepath, std::ios::out | std::ios::trunc);
+    file << content;
+}
+
+bool exists(const std::string &filepath)
+{
+    return ::access(filepath.c_str(), F_OK) == 0;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(sort_result_file_sorts_by_identifier)
+{
+    const std::string filepath("core-sort.csv");
+    write_file(filepath, "id;value\n3;c\n1;a\n2;b\n1;d\n");
+
+    safihr::sort_result_file(filepath, 2);
+
+    BOOST_REQUIRE_EQUAL(read_file(filepath), "id;value\n1;a\n1;d\n2;b\n3;c\n");
+    BOOST_REQUIRE(!exists(filepath + ".run0"));
+    BOOST_REQUIRE(!exists(filepath + ".sort"));
+    std::remove(filepath.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(sort_result_file_cleans_up_on_failure)
+{
+    const std::string filepath("core-sort-failure.csv");
+    const std::string content("id;value\n3;c\n1;a\nbad\n2;b\n");
+    write_file(filepath, content);
+
+    BOOST_REQUIRE_THROW(safihr::sort_result_file(filepath, 2),
+                        safihr::result_writer_format_failure);
+
+    BOOST_REQUIRE_EQUAL(read_file(filepath), content);
+    BOOST_REQUIRE(!exists(filepath + ".run0"));
+    BOOST_REQUIRE(!exists(filepath + ".run1"));
+    BOOST_REQUIRE(!exists(filepath + ".sort"));
+    std::remove(filepath.c_str());
+}
+
+/* A locale with a decimal comma for LC_NUMERIC, restored at the end. */
+struct DecimalCommaLocale
+{
+    std::string previous;
+    bool enabled;
+
+    DecimalCommaLocale()
+        : previous(std::setlocale(LC_NUMERIC, nullptr)), enabled(false)
+    {
+        for (const char *name : { "fr_FR.UTF-8", "fr_FR.utf8", "fr_FR",
+                    "de_DE.UTF-8", "de_DE.utf8", "de_DE" })
+            if (std::setlocale(LC_NUMERIC, name)) {
+                enabled = true;
+                break;
+            }
+
+        if (!enabled)
+            BOOST_TEST_MESSAGE("no decimal comma locale, C locale only");
+    }
+
+    ~DecimalCommaLocale()
+    {
+        std::setlocale(LC_NUMERIC, previous.c_str());
+    }
+};
+
+BOOST_AUTO_TEST_CASE(numbers_are_read_in_the_c_locale)
+{
+    DecimalCommaLocale locale;
+
+    char *end;
+    const char *str = "12.5;";
+    BOOST_REQUIRE_EQUAL(safihr::strtod_c(str, &end), 12.5);
+    BOOST_REQUIRE_EQUAL(end, str + 4);
+
+    const std::string weather_path("core-weather.csv");
+    write_file(weather_path, "Date;Tmin;Tmax;Tmoy\n"
+               "01/01/1992;2.4;7.9;4.6\n02/01/1992;4;7.9;5.25\n");
+
+    safihr::WeatherSeries weather;
+    safihr::read_weather(weather_path, weather);
+    BOOST_REQUIRE_EQUAL(weather.size(), 2u);
+    BOOST_REQUIRE_EQUAL(weather.tmin[0], 2.4);
+    BOOST_REQUIRE_EQUAL(weather.tmoy[1], 5.25);
+    std::remove(weather_path.c_str());
+
+    const std::string plan_path("core-plan.csv");
+    write_file(plan_path, "libelle_occup;Surface;id;Date-semis;"
+               "Date-recolte-observee;duration\n"
+               "BLE;12.5;2.25;15/10/2001;20/07/2002;278\n");
+
+    safihr::PlanTable plan;
+    safihr::read_plan(plan_path, plan, 1);
+    BOOST_REQUIRE_EQUAL(plan.size(), 1u);
+    BOOST_REQUIRE_EQUAL(plan.surface1[0], 12.5f);
+    BOOST_REQUIRE_EQUAL(plan.surface2[0], 2.25f);
+    std::remove(plan_path.c_str());
+}
+
+namespace {
+
+/*
+ * The GenericModel::compute of the first GenericCropModel plugin, as
+ * it was before generic_compute. Its photoperiod is indexed by the day
+ * of the year instead of the day minus one, and its 365 and 366 day
+ * tables are swapped on the 1st of January of a leap year and of the
+ * year after, so a sowing in a leap year used the 365 day table until
+ * the next year then the 366 day table. On the last day of a year the
+ * plugin read past the end of its table (undefined, two past the end
+ * on the 31st of December of a leap year of sowing), read as 0.0 here.
+ */
+struct PluginGenericModel
+{
+    const safihr::Specie &specie;
+    std::vector <double> fp;
+    std::vector <double> fp_leapyear;
+    safihr::GenericState state;
+
+    PluginGenericModel(const safihr::Specie &specie,
+                       const safihr::Photoperiod &photoperiod)
+        : specie(specie), fp(photoperiod.table(), photoperiod.table() + 365),
+        fp_leapyear(photoperiod.table() + 365, photoperiod.table() + 731)
+    {
+        fp.resize(367, 0.0);
+        fp_leapyear.resize(367, 0.0);
+    }
+
+    safihr::StatusModel compute(std::int32_t time, double tmoy)
+    {
+        bool leap;
+        int day = safihr::day_of_year(time, leap);
+
+        if (day == 1 && (leap || safihr::is_leap_year_of(time - 1)))
+            std::swap(fp, fp_leapyear);
+
+        const double *data = &specie.data[0];
+        double tdev = (tmoy >= data[safihr::Specie::TMAXDEV]) ?
+            std::max(0.0, data[safihr::Specie::TMAXDEV] -
+                     data[safihr::Specie::TBASE]) :
+            std::max(0.0, tmoy - data[safihr::Specie::TBASE]);
+
+        state.tdev_sum += tdev;
+
+        if (state.tdev_sum >= data[safihr::Specie::SEM_LEV] &&
+            state.day_lev == safihr::infinity) {
+            state.day_lev = time;
+            state.status = safihr::StatusModel::raised;
+        }
+
+        double jvi = (data[safihr::Specie::TFROID] == safihr::infinity) ?
+            0.0 : std::max(0.0, (1.0 - (((data[safihr::Specie::TFROID] -
+                                          tmoy) /
+                                         data[safihr::Specie::AMPFROID]) *
+                                        ((data[safihr::Specie::TFROID] -
+                                          tmoy) /
+                                         data[safihr::Specie::AMPFROID]))));
+
+        double old_vdd = state.vdd;
+        state.vdd = time < state.day_lev ? 0.0 : old_vdd + jvi;
+
+        if (state.status == safihr::StatusModel::raised) {
+            double fv = data[safihr::Specie::VBASE] == 1.0 ? 1.0 :
+                std::max(0.0, std::min(
+                             1.0, ((old_vdd - data[safihr::Specie::VBASE]) /
+                                   (data[safihr::Specie::VSAT] -
+                                    data[safihr::Specie::VBASE]))));
+
+            state.udev += tdev * fv * fp[day];
+
+            if (state.udev > data[safihr::Specie::LEV_MAT])
+                state.status = safihr::StatusModel::maturity;
+        }
+
+        return state.status;
+    }
+};
+
+/*
+ * The emergence and maturity days of the plugin kernel for a sowing at
+ * @e sowing, with the timing of CropEngine::simulate (-1 if not
+ * reached before @e end).
+ */
+void plugin_simulate(const safihr::Specie &specie, double latitude,
+                     std::int32_t sowing, const safihr::WeatherSeries &weather,
+                     std::int32_t begin, std::int32_t end,
+                     std::int32_t &dlev, std::int32_t &result)
+{
+    safihr::Photoperiod photoperiod(specie, latitude);
+    PluginGenericModel model(specie, photoperiod);
+    dlev = -1;
+    result = -1;
+
+    for (std::int32_t t = sowing + 1; t + 1 <= end; ++t) {
+        std::int32_t i = t - 2 - begin;
+        double tmoy = i >= 0 && static_cast <std::size_t>(i) <
+            weather.size() ? weather.tmoy[i] : 0.0;
+
+        if (model.compute(t, tmoy) == safihr::StatusModel::maturity) {
+            dlev = static_cast <std::int32_t>(model.state.day_lev);
+            result = t + 1;
+            return;
+        }
+    }
+}
+
+std::vector <std::string> split(const std::string &line)
+{
+    std::vector <std::string> ret;
+    std::istringstream in(line);
+    std::string field;
+
+    while (std::getline(in, field, ';'))
+        ret.push_back(field);
+
+    return ret;
+}
+
+}
+
+/*
+ * The rows of the compare experiment whose emergence or maturity
+ * changed between the plugin kernel and generic_compute (see
+ * PluginGenericModel), with the timing of CropEngine::simulate. The
+ * list is kept in golden/kernel-changes.csv; the test writes it again
+ * into kernel-changes.csv.
+ */
+BOOST_AUTO_TEST_CASE(kernel_changes_from_the_plugin)
+{
+    const std::string data(SAFIHR_DATA_DIR);
+    const double latitude = 48.48;
+    const std::int32_t begin = 2451911;
+
+    safihr::WeatherSeries weather;
+    safihr::read_weather(data + "/luneray_temp_2001_2011-Aude.csv", weather);
+
+    safihr::PlanTable plan;
+    safihr::read_plan(data + "/date-semis-bourville-Aude.csv", plan, 1);
+
+    safihr::CropEngine engine(safihr::builtin_species(), latitude);
+    const std::int32_t end = std::min(
+        begin + 4016, begin + static_cast <std::int32_t>(weather.size()));
+
+    std::ofstream out("kernel-changes.csv", std::ios::out | std::ios::trunc);
+    out << "id_parcelle;libelle_occup;Date-semis;plugin-Date-Lev;"
+        "plugin-Date-recolte-simulee;Date-Lev;Date-recolte-simulee\n";
+
+    for (std::size_t row = 0, e = plan.size(); row != e; ++row) {
+        int specie = engine.find(plan.specie_name(row));
+        if (specie < 0)
+            continue;
+
+        std::int32_t dlev, result;
+        engine.simulate(specie, plan.dmin[row], weather.tmoy.data(),
+                        weather.size(), begin, end, dlev, result);
+
+        std::int32_t plugin_dlev, plugin_result;
+        plugin_simulate(engine.species()[specie], latitude, plan.dmin[row],
+                        weather, begin, end, plugin_dlev, plugin_result);
+
+        if (dlev != plugin_dlev || result != plugin_result)
+            out << plan.id[row] << ';' << plan.specie_name(row) << ';'
+                << safihr::format_date(plan.dmin[row]) << ';'
+                << safihr::format_date(plugin_dlev) << ';'
+                << safihr::format_date(plugin_result) << ';'
+                << safihr::format_date(dlev) << ';'
+                << safihr::format_date(result) << '\n';
+    }
+
+    out.close();
+
+    BOOST_REQUIRE_EQUAL(read_file("kernel-changes.csv"),
+                        read_file(std::string(SAFIHR_GOLDEN_DIR) +
+                                  "/kernel-changes.csv"));
+}
+
+/*
+ * The golden outputs of the headless compare scenarios are not only
+ * the output of the engine they check: they are the output of the
+ * plugin kernel, with the rows of golden/kernel-changes.csv changed.
+ */
+BOOST_AUTO_TEST_CASE(headless_golden_from_the_plugin)
+{
+    const std::string data(SAFIHR_DATA_DIR);
+    const std::string golden(SAFIHR_GOLDEN_DIR);
+    const double latitude = 48.48;
+    const std::int32_t begin = 2451911;
+
+    safihr::WeatherSeries weather;
+    safihr::read_weather(data + "/luneray_temp_2001_2011-Aude.csv", weather);
+
+    safihr::PlanTable plan;
+    safihr::read_plan(data + "/date-semis-bourville-Aude.csv", plan, 1);
+
+    safihr::CropEngine engine(safihr::builtin_species(), latitude);
+    const std::int32_t end = std::min(
+        begin + 4016, begin + static_cast <std::int32_t>(weather.size()));
+
+    /* Date-Lev and Date-recolte-simulee of each parcel. */
+    std::map <std::string, std::pair <std::string, std::string> > expected;
+    for (std::size_t row = 0, e = plan.size(); row != e; ++row) {
+        int specie = engine.find(plan.specie_name(row));
+        BOOST_REQUIRE_GE(specie, 0);
+
+        std::int32_t dlev, result;
+        plugin_simulate(engine.species()[specie], latitude, plan.dmin[row],
+                        weather, begin, end, dlev, result);
+
+        expected[std::to_string(plan.id[row])] = std::make_pair(
+            safihr::format_date(dlev), safihr::format_date(result));
+    }
+
+    std::ifstream changes(golden + "/kernel-changes.csv");
+    std::string line;
+    BOOST_REQUIRE(std::getline(changes, line));
+    while (std::getline(changes, line)) {
+        std::vector <std::string> f = split(line);
+        BOOST_REQUIRE_EQUAL(f.size(), 7u);
+        BOOST_REQUIRE(expected.count(f[0]));
+        BOOST_REQUIRE_EQUAL(expected[f[0]].first, f[3]);
+        BOOST_REQUIRE_EQUAL(expected[f[0]].second, f[4]);
+        expected[f[0]] = std::make_pair(f[5], f[6]);
+    }
+
+    std::ifstream outputs(golden + "/compare-headless-simulation-outputs.csv");
+    std::size_t rows = 0;
+    BOOST_REQUIRE(std::getline(outputs, line));
+    while (std::getline(outputs, line)) {
+        std::vector <std::string> f = split(line);
+        BOOST_REQUIRE_EQUAL(f.size(), 7u);
+        BOOST_REQUIRE(expected.count(f[0]));
+        BOOST_CHECK_EQUAL(expected[f[0]].first, f[3]);
+        BOOST_CHECK_EQUAL(expected[f[0]].second, f[5]);
+        ++rows;
+    }
+
+    BOOST_REQUIRE_EQUAL(rows, plan.size());
+
+    /* The compact state gives the same days. */
+    BOOST_REQUIRE_EQUAL(
+        read_file(golden + "/compare-compact-simulation-outputs.csv"),
+        read_file(golden + "/compare-headless-simulation-outputs.csv"));
+}
+
+namespace {
+
+/*
+ * The maturity of the generic model from @e state at @e time with the
+ * weather of the historical year @e year at the calendar days of the
+ * two years from @e time, one generic_compute per day. Feb 29 of a
+ * classic historical year takes the value of Feb 28, a missing record
+ * the value of the previous day.
+ */
+double forecast_year(const safihr::Specie &specie,
+                     const safihr::Photoperiod &photoperiod,
+                     safihr::GenericState state, std::int32_t time,
+                     const std::map <std::int32_t, double> &tmoy, int year)
+{
+    int year0, month, day;
+    safihr::gregorian_date(time, year0, month, day);
+
+    for (std::int32_t t = time; ; ++t) {
+        int y;
+        safihr::gregorian_date(t, y, month, day);
+        if (y > year0 + 1)
+            return safihr::infinity;
+
+        int history = year + (y - year0);
+        if (month == 2 && day == 29 && !safihr::is_leap_year(history))
+            day = 28;
+
+        /* A missing record takes the value of the previous day. */
+        std::int32_t date = safihr::julian_day_number(history, month, day);
+        auto found = tmoy.upper_bound(date);
+        BOOST_REQUIRE(found != tmoy.begin());
+        --found;
+
+        bool leap;
+        int doy = safihr::day_of_year(t, leap);
+        if (safihr::generic_compute(specie, photoperiod, state, t,
+                                    found->second, doy, leap) ==
+            safihr::StatusModel::maturity)
+            return t;
+    }
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(forecast_lanes_equal_the_scalar_model)
+{
+    safihr::WeatherSeries weather;
+    safihr::read_weather(std::string(SAFIHR_DATA_DIR) +
+                         "/luneray_temp-1992-2011.csv", weather);
+
+    std::map <std::int32_t, double> tmoy;
+    for (std::size_t i = 0, e = weather.size(); i != e; ++i)
+        tmoy[weather.date[i]] = weather.tmoy[i];
+
+    safihr::Forecast forecast(weather);
+    BOOST_REQUIRE_EQUAL(forecast.lanes(), 19u);
+
+    /* Sowings in classic and leap years and a season already started
+     * (60 days of the first lane). */
+    const std::int32_t times[] = {
+        safihr::julian_day_number(2011, 3, 15),
+        safihr::julian_day_number(2011, 10, 15),
+        safihr::julian_day_number(2012, 2, 20),
+        safihr::julian_day_number(2012, 12, 31) };
+
+    std::size_t matured = 0, lanes = 0;
+
+    for (const auto &specie : safihr::builtin_species()) {
+        safihr::Photoperiod photoperiod(specie, 49.85);
+
+        for (std::int32_t time : times) {
+            for (int started = 0; started != 2; ++started) {
+                safihr::GenericState state;
+                std::int32_t start = time;
+
+                for (int day = 0; started && day != 60; ++day, ++start) {
+                    bool leap;
+                    int doy = safihr::day_of_year(start, leap);
+                    int year, month, mday;
+                    safihr::gregorian_date(start, year, month, mday);
+                    safihr::generic_compute(
+                        specie, photoperiod, state, start,
+                        tmoy.at(safihr::julian_day_number(
+                                    forecast.year(0), month,
+                                    month == 2 && mday == 29 ? 28 : mday)),
+                        doy, leap);
+                }
+
+                std::vector <double> maturity;
+                forecast.run(specie, photoperiod, state, start, maturity);
+                BOOST_REQUIRE_EQUAL(maturity.size(), forecast.lanes());
+
+                lanes += maturity.size();
+                matured += std::count_if(maturity.begin(), maturity.end(),
+                                         [](double day)
+                                         {
+                                             return day != safihr::infinity;
+                                         });
+
+                for (std::size_t lane = 0; lane != maturity.size(); ++lane)
+                    BOOST_CHECK_MESSAGE(
+                        maturity[lane] == forecast_year(
+                            specie, photoperiod, state, start, tmoy,
+                            forecast.year(lane)),
+                        specie.name << " from " << start << ", lane "
+                        << forecast.year(lane) << ": " << maturity[lane]);
+            }
+        }
+    }
+
+    BOOST_TEST_MESSAGE(matured << " of " << lanes << " lanes matured");
+    BOOST_REQUIRE(matured > lanes / 2);
+}
+
+/*
+ * On dmin, the internal transition of the MinimalistAI (open) may come
+ * before the weather record of the day (advance): the parcel must not
+ * be sown on the records before dmin.
+ */
+BOOST_AUTO_TEST_CASE(sowing_rules_wait_for_the_weather_of_the_day)
+{
+    safihr::SowingPlanner planner;
+    planner.rule("BLE", safihr::SowingRule { 1, 10.0, 20.0 });
+    planner.add(1, "BLE", 100, 110);
+
+    std::vector <std::uint32_t> sown;
+
+    planner.weather(15.0);
+    planner.advance(99, sown);
+    BOOST_REQUIRE(sown.empty());
+    BOOST_REQUIRE_EQUAL(planner.next_day(), 100.0);
+
+    /* The mean of the day 99 holds but is not used on the day 100. */
+    planner.open(100, sown);
+    BOOST_REQUIRE(sown.empty());
+
+    planner.weather(5.0);
+    planner.advance(100, sown);
+    BOOST_REQUIRE(sown.empty());
+
+    planner.weather(12.0);
+    planner.advance(101, sown);
+    BOOST_REQUIRE_EQUAL(sown.size(), 1u);
+    BOOST_REQUIRE_EQUAL(sown.front(), 1u);
+    BOOST_REQUIRE_EQUAL(planner.pending(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(sowing_rules_fall_back_to_dmax)
+{
+    safihr::SowingPlanner planner;
+    planner.rule("BLE", safihr::SowingRule { 3, 10.0, 20.0 });
+    planner.add(1, "BLE", 100, 103);
+    planner.add(2, "BLE", 100, 105);
+    planner.add(3, "POIS", 101, 120);
+
+    std::vector <std::uint32_t> sown;
+
+    /* Species without rule are sown on dmin. */
+    planner.open(100, sown);
+    BOOST_REQUIRE(sown.empty());
+    planner.open(101, sown);
+    BOOST_REQUIRE_EQUAL(sown.size(), 1u);
+    BOOST_REQUIRE_EQUAL(sown.front(), 3u);
+    sown.clear();
+
+    for (std::int32_t day = 101; day != 103; ++day) {
+        planner.weather(2.0);
+        planner.advance(day, sown);
+        BOOST_REQUIRE(sown.empty());
+    }
+
+    /* The window of the parcel 1 closes at 103, with or without the
+     * weather of the day. */
+    BOOST_REQUIRE_EQUAL(planner.next_day(), 103.0);
+    planner.open(103, sown);
+    BOOST_REQUIRE_EQUAL(sown.size(), 1u);
+    BOOST_REQUIRE_EQUAL(sown.front(), 1u);
+    sown.clear();
+
+    planner.weather(2.0);
+    planner.advance(103, sown);
+    planner.weather(2.0);
+    planner.advance(104, sown);
+    BOOST_REQUIRE(sown.empty());
+
+    planner.weather(2.0);
+    planner.advance(105, sown);
+    BOOST_REQUIRE_EQUAL(sown.size(), 1u);
+    BOOST_REQUIRE_EQUAL(sown.front(), 2u);
+    BOOST_REQUIRE_EQUAL(planner.pending(), 0u);
+    BOOST_REQUIRE_EQUAL(planner.next_day(),
+                        std::numeric_limits <double>::infinity());
+}
+
+/*
+ * A segment of the shared cache readable by the other users is never
+ * attached; the segments published are closed to the other users.
+ */
+BOOST_AUTO_TEST_CASE(shared_segments_are_private_to_the_user)
+{
+    const std::uint64_t key = 0x5afe000000000000ull + ::getpid();
+    const std::string name = (boost::format("/safihr-v2-%u-test-%016x")
+                              % ::geteuid() % key).str();
+    const auto make = []() { return std::vector <double> { 1.0, 2.0 }; };
+
+    ::shm_unlink(name.c_str());
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    BOOST_REQUIRE(fd >= 0);
+    BOOST_REQUIRE(::fchmod(fd, 0644) == 0);
+    ::close(fd);
+
+    {
+        auto array = safihr::SharedArray::get("test", key, make);
+        BOOST_REQUIRE(!array->shared());
+        BOOST_REQUIRE_EQUAL(array->size(), 2u);
+        BOOST_REQUIRE_EQUAL(array->data()[1], 2.0);
+    }
+
+    BOOST_REQUIRE(::shm_unlink(name.c_str()) == 0);
+
+    {
+        auto array = safihr::SharedArray::get("test", key, make);
+        BOOST_REQUIRE(array->shared());
+        BOOST_REQUIRE_EQUAL(array->size(), 2u);
+        BOOST_REQUIRE_EQUAL(array->data()[1], 2.0);
+    }
+
+    fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    BOOST_REQUIRE(fd >= 0);
+    struct stat st;
+    BOOST_REQUIRE(::fstat(fd, &st) == 0);
+    ::close(fd);
+    ::shm_unlink(name.c_str());
+
+    BOOST_REQUIRE_EQUAL(st.st_mode & 0777, 0600u);
+    BOOST_REQUIRE_EQUAL(st.st_uid, ::geteuid());
+}
+
+/*
+ * The sowing table equals the plan runs of the engine, the path of
+ * safihr-cropsim, with a parcel per specie and sowing day.
+ */
+BOOST_AUTO_TEST_CASE(sowing_table_equals_the_plan_runs)
+{
+    const std::string data(SAFIHR_DATA_DIR);
+
+    safihr::WeatherSeries weather;
+    safihr::read_weather(data + "/luneray_temp-1992-2011.csv", weather);
+    const std::int32_t end = weather.begin +
+        static_cast <std::int32_t>(weather.size());
+
+    safihr::CropEngine engine(safihr::builtin_species(), 48.48);
+
+    safihr::SowingTable table;
+    engine.sowing_table(weather, weather.begin, end, table, 1);
+    BOOST_REQUIRE_EQUAL(table.days, weather.size());
+    BOOST_REQUIRE_EQUAL(table.dlev.size(),
+                        table.species.size() * table.days);
+
+    safihr::PlanTable plan;
+    plan.reserve(table.dlev.size());
+    for (std::size_t i = 0, e = table.dlev.size(); i != e; ++i) {
+        const std::int32_t day = table.first +
+            static_cast <std::int32_t>(i % table.days);
+
+        plan.id.push_back(static_cast <std::uint32_t>(i));
+        plan.specie.push_back(plan.species.intern(
+                                  table.species[i / table.days]));
+        plan.surface1.push_back(1.0f);
+        plan.surface2.push_back(1.0f);
+        plan.dmin.push_back(day);
+        plan.dmax.push_back(day);
+        plan.duration.push_back(0);
+    }
+    plan.sort_by_dmin();
+
+    safihr::EngineOptions options;
+    options.threads = 1;
+
+    safihr::EngineResult result;
+    engine.run(plan, weather, weather.begin, end, result, options);
+
+    std::size_t matured = 0, differ = 0;
+    for (std::size_t i = 0, e = table.dlev.size(); i != e; ++i) {
+        if (result.dlev[i] != table.dlev[i] ||
+            result.result[i] != table.result[i])
+            ++differ;
+        if (result.result[i] >= 0)
+            ++matured;
+    }
+
+    BOOST_REQUIRE_EQUAL(differ, 0u);
+    BOOST_REQUIRE_GT(matured, table.dlev.size() / 2);
+}
+
+namespace {
+
+/*
+ * The days of the MinimalistAI and GenericCropModel dynamics, without
+ * the DEVS kernel. At day t the Meteo model sends the record
+ * t - 1 - begin; the bag of the weather holds the starts of the
+ * parcels due at t (SowingPlanner::due), a zero-delay step the starts
+ * of the parcels sown by a rule, with the weather forwarded. A crop
+ * drops the weather until it is sown and computes the day t with the
+ * weather received at t - 1. The result of a parcel is the day after
+ * its maturity, as in CropEngine::simulate.
+ */
+struct MinimalistRun
+{
+    std::vector <std::int32_t> sowing, dlev, result;
+
+    MinimalistRun(const safihr::CropEngine &engine,
+                  safihr::SowingPlanner &planner,
+                  const std::vector <std::string> &names,
+                  const safihr::WeatherSeries &weather)
+        : sowing(names.size(), -1), dlev(names.size(), -1),
+        result(names.size(), -1)
+    {
+        const std::int32_t begin = weather.begin;
+        const std::int32_t end = begin +
+            static_cast <std::int32_t>(weather.size());
+        std::vector <std::unique_ptr <safihr::Model> > crops(names.size());
+        std::vector <double> tmoy(names.size(), 0.0);
+
+        auto sow = [&](std::uint32_t id, std::int32_t t, double w)
+            {
+                int specie = engine.find(names[id - 1]);
+                if (specie < 0)
+                    crops[id - 1].reset(new safihr::LinModel());
+                else
+                    crops[id - 1].reset(new safihr::GenericModel(
+                                            t, engine.species()[specie],
+                                            engine.latitude()));
+                sowing[id - 1] = t;
+                tmoy[id - 1] = w;
+            };
+
+        for (std::int32_t t = begin + 1; t + 1 <= end; ++t) {
+            const double w = weather.tmoy[t - 1 - begin];
+
+            for (std::size_t i = 0; i != crops.size(); ++i) {
+                if (!crops[i] || result[i] >= 0 || sowing[i] == t)
+                    continue;
+                if (crops[i]->compute(t, tmoy[i]) ==
+                    safihr::StatusModel::maturity) {
+                    dlev[i] = static_cast <std::int32_t>(crops[i]->day_lev);
+                    result[i] = t + 1;
+                }
+            }
+
+            std::vector <std::uint32_t> due, opened, ready;
+            if (planner.next_day() == t) {
+                planner.due(t, due);
+                planner.open(t, opened);
+                std::sort(due.begin(), due.end());
+                std::sort(opened.begin(), opened.end());
+                BOOST_REQUIRE(due == opened);
+            }
+
+            for (std::size_t i = 0; i != crops.size(); ++i)
+                if (crops[i])
+                    tmoy[i] = w;
+            for (auto id : due)
+                sow(id, t, w);
+
+            planner.weather(w);
+            planner.advance(t, ready);
+            for (auto id : ready)
+                sow(id, t, w);
+        }
+    }
+};
+
+void read_sowing_dates(const std::string &filepath,
+                       std::vector <std::string> &names,
+                       safihr::SowingPlanner &planner)
+{
+    std::ifstream file(filepath);
+    std::string line;
+    BOOST_REQUIRE(std::getline(file, line));
+
+    while (std::getline(file, line)) {
+        std::vector <std::string> f = split(line);
+        BOOST_REQUIRE_EQUAL(f.size(), 3u);
+
+        std::int32_t dmin, dmax;
+        BOOST_REQUIRE(safihr::parse_date(f[1].data(), f[1].data() +
+                                         f[1].size(), dmin));
+        BOOST_REQUIRE(safihr::parse_date(f[2].data(), f[2].data() +
+                                         f[2].size(), dmax));
+
+        names.push_back(f[0]);
+        planner.add(static_cast <std::uint32_t>(names.size()), f[0], dmin,
+                    dmax);
+    }
+}
+
+}
+
+/*
+ * Without rules, the parcels of first.vpz are sown on dmin with the
+ * weather of the day: the emergence and maturity of CropEngine.
+ */
+BOOST_AUTO_TEST_CASE(minimalist_ai_sows_on_dmin_with_the_weather)
+{
+    const std::string data(SAFIHR_DATA_DIR);
+
+    safihr::WeatherSeries weather;
+    safihr::read_weather(data + "/luneray_temp-1992-2011.csv", weather);
+    const std::int32_t end = weather.begin +
+        static_cast <std::int32_t>(weather.size());
+
+    safihr::CropEngine engine(safihr::builtin_species(), 48.48);
+    safihr::SowingPlanner planner;
+    std::vector <std::string> names;
+    read_sowing_dates(data + "/date_semis.csv", names, planner);
+
+    MinimalistRun run(engine, planner, names, weather);
+
+    std::size_t matured = 0;
+    for (std::size_t i = 0; i != names.size(); ++i) {
+        std::int32_t dlev, result;
+        engine.simulate(engine.find(names[i]), run.sowing[i],
+                        weather.tmoy.data(), weather.size(), weather.begin,
+                        end, dlev, result);
+
+        BOOST_CHECK_EQUAL(run.dlev[i], dlev);
+        BOOST_CHECK_EQUAL(run.result[i], result);
+        matured += result >= 0;
+    }
+
+    BOOST_REQUIRE_EQUAL(planner.pending(), 0u);
+    BOOST_REQUIRE_GT(matured, 0u);
+
+    std::ifstream file(data + "/date_semis.csv");
+    std::string line;
+    std::getline(file, line);
+    for (std::size_t i = 0; std::getline(file, line); ++i) {
+        std::vector <std::string> f = split(line);
+        std::int32_t dmin;
+        safihr::parse_date(f[1].data(), f[1].data() + f[1].size(), dmin);
+        BOOST_CHECK_EQUAL(run.sowing[i], dmin);
+    }
+}
+
+/*
+ * With the rules of first.vpz, a parcel sown by a rule starts with the
+ * weather of its sowing day, forwarded by the AI.
+ */
+BOOST_AUTO_TEST_CASE(minimalist_ai_forwards_the_weather_of_the_rules)
+{
+    const std::string data(SAFIHR_DATA_DIR);
+
+    safihr::WeatherSeries weather;
+    safihr::read_weather(data + "/luneray_temp-1992-2011.csv", weather);
+    const std::int32_t end = weather.begin +
+        static_cast <std::int32_t>(weather.size());
+
+    safihr::CropEngine engine(safihr::builtin_species(), 48.48);
+    safihr::SowingPlanner planner;
+    planner.read_rules(data + "/sowing_rules.csv");
+    std::vector <std::string> names;
+    read_sowing_dates(data + "/date_semis.csv", names, planner);
+
+    MinimalistRun run(engine, planner, names, weather);
+
+    for (std::size_t i = 0; i != names.size(); ++i) {
+        std::int32_t dlev, result;
+        BOOST_REQUIRE_GE(run.sowing[i], 0);
+        engine.simulate(engine.find(names[i]), run.sowing[i],
+                        weather.tmoy.data(), weather.size(), weather.begin,
+                        end, dlev, result);
+
+        BOOST_CHECK_EQUAL(run.dlev[i], dlev);
+        BOOST_CHECK_EQUAL(run.result[i], result);
+    }
+}
+
+namespace {
+
+/* Push @e count crop_day records into @e buffer, the parcel i for the
+ * record i. */
+void push_days(safihr::TraceBuffer &buffer, std::uint32_t count)
+{
+    for (std::uint32_t i = 0; i != count; ++i)
+        buffer.push(safihr::TraceEvent::crop_day, i, 2451911.0 + i,
+                    0.5 * i, 10.0 * i, -1.0 * i);
+}
+
+/* Read the trace file and check that it holds the records of push_days
+ * from the parcel @e first to @e last excluded. */
+void check_days(const std::string &filepath, std::uint32_t first,
+                std::uint32_t last)
+{
+    safihr::TraceReader reader(filepath);
+    safihr::TraceRecord record;
+
+    for (std::uint32_t i = first; i != last; ++i) {
+        BOOST_REQUIRE(reader.next(record));
+        BOOST_CHECK_EQUAL(record.event, static_cast <std::uint16_t>(
+                              safihr::TraceEvent::crop_day));
+        BOOST_CHECK_EQUAL(record.parcel, i);
+        BOOST_CHECK_EQUAL(record.day, 2451911.0 + i);
+        BOOST_CHECK_EQUAL(record.values[0], 0.5 * i);
+        BOOST_CHECK_EQUAL(record.values[1], 10.0 * i);
+        BOOST_CHECK_EQUAL(record.values[2], -1.0 * i);
+    }
+
+    BOOST_CHECK(!reader.next(record));
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(trace_records_are_read_back)
+{
+    const std::string filepath("core-trace.bin");
+    std::remove(filepath.c_str());
+
+    {
+        /* Flushed when full, then by the destructor. */
+        safihr::TraceBuffer buffer(safihr::TraceConfig(filepath, 4, false));
+        push_days(buffer, 10);
+    }
+
+    check_days(filepath, 0, 10);
+    std::remove(filepath.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(trace_ring_keeps_the_last_records)
+{
+    const std::string filepath("core-trace-ring.bin");
+    std::remove(filepath.c_str());
+
+    {
+        safihr::TraceBuffer buffer(safihr::TraceConfig(filepath, 4, true));
+        push_days(buffer, 10);
+        BOOST_REQUIRE(!exists(filepath));
+    }
+
+    check_days(filepath, 6, 10);
+
+    {
+        safihr::TraceBuffer buffer(safihr::TraceConfig(filepath, 4, true));
+        push_days(buffer, 3);
+    }
+
+    /* The second part of the file starts with its own header. */
+    safihr::TraceReader reader(filepath);
+    safihr::TraceRecord record;
+    std::size_t records = 0;
+    while (reader.next(record))
+        ++records;
+    BOOST_CHECK_EQUAL(records, 7u);
+    std::remove(filepath.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(trace_reader_rejects_other_files)
+{
+    const std::string filepath("core-trace-bad.bin");
+    write_file(filepath, std::string(sizeof(safihr::TraceRecord), 'x'));
+
+    safihr::TraceReader reader(filepath);
+    safihr::TraceRecord record;
+    BOOST_CHECK_THROW(reader.next(record), safihr::trace_file_failure);
+    BOOST_CHECK_THROW(safihr::TraceReader("core-trace-missing.bin"),
+                      safihr::trace_file_failure);
+    std::remove(filepath.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(result_store_keeps_the_records)
+{
+    const std::string filepath("core-store.db");
+    std::remove(filepath.c_str());
+
+    {
+        safihr::ResultStore store(filepath);
+        store.insert(1, safihr::ResultStore::Entry { 2451950, 2452100 });
+        store.insert(2, safihr::ResultStore::Entry { 2451960, -1 });
+    }
+
+    /* An interrupted run leaves a truncated record. */
+    {
+        std::ofstream file(filepath, std::ios::out | std::ios::app |
+                           std::ios::binary);
+        file.write("truncated", 9);
+    }
+
+    {
+        safihr::ResultStore store(filepath);
+        safihr::ResultStore::Entry entry;
+        BOOST_REQUIRE(store.find(1, entry));
+        BOOST_CHECK_EQUAL(entry.dlev, 2451950);
+        BOOST_CHECK_EQUAL(entry.result, 2452100);
+        BOOST_REQUIRE(store.find(2, entry));
+        BOOST_CHECK_EQUAL(entry.result, -1);
+        BOOST_CHECK(!store.find(3, entry));
+        store.insert(3, safihr::ResultStore::Entry { 2451970, 2452200 });
+    }
+
+    safihr::ResultStore store(filepath);
+    safihr::ResultStore::Entry entry;
+    BOOST_CHECK(store.find(1, entry));
+    BOOST_CHECK(store.find(3, entry));
+    std::remove(filepath.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(result_store_only_creates_empty_files)
+{
+    const std::string filepath("core-store-empty.db");
+    write_file(filepath, "");
+
+    {
+        safihr::ResultStore store(filepath);
+        store.insert(1, safihr::ResultStore::Entry { 2451950, 2452100 });
+    }
+
+    safihr::ResultStore::Entry entry;
+    BOOST_CHECK(safihr::ResultStore(filepath).find(1, entry));
+
+    /* A short header or an other file is never truncated. */
+    for (const std::string &content : { std::string("SAFIHR"),
+                std::string("id;value\n1;a\n2;b\n") }) {
+        write_file(filepath, content);
+        BOOST_CHECK_THROW(safihr::ResultStore store(filepath),
+                          safihr::result_store_failure);
+        BOOST_CHECK_EQUAL(read_file(filepath), content);
+    }
+
+    std::remove(filepath.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(observation_policy_selects_ids_and_species)
+{
+    safihr::ObservationPolicy policy;
+    BOOST_CHECK(policy.empty());
+    BOOST_CHECK(!policy.observe(267, "BLE"));
+
+    policy.add_id(267);
+    policy.add_specie("COLZA");
+    BOOST_CHECK(!policy.empty());
+    BOOST_CHECK(policy.observe(267, "BLE"));
+    BOOST_CHECK(!policy.observe(268, "BLE"));
+    BOOST_CHECK(policy.observe(268, "COLZA"));
+    BOOST_CHECK_THROW(policy.add_id(-5), safihr::observation_policy_failure);
+
+    const std::string filepath("core-observe.txt");
+    write_file(filepath, "300 301;302\r\n\n  303\n");
+    policy.add_ids_from_file(filepath);
+    for (unsigned int id : { 300u, 301u, 302u, 303u })
+        BOOST_CHECK(policy.observe(id, "BLE"));
+    BOOST_CHECK(!policy.observe(304, "BLE"));
+
+    for (const char *content : { "300\n-5\n", "300\n12a\n",
+                "300\n99999999999\n" }) {
+        write_file(filepath, content);
+        try {
+            policy.add_ids_from_file(filepath);
+            BOOST_ERROR("no failure for " << content);
+        } catch (const safihr::observation_policy_failure &e) {
+            const std::string what(e.what());
+            BOOST_CHECK(what.find(filepath) != std::string::npos);
+            BOOST_CHECK(what.find("line 2") != std::string::npos);
+        }
+    }
+
+    BOOST_CHECK_THROW(policy.add_ids_from_file("core-observe-missing.txt"),
+                      safihr::observation_policy_failure);
+    std::remove(filepath.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(observation_policy_samples_a_fraction)
+{
+    BOOST_CHECK_THROW(safihr::ObservationPolicy().set_sample(1.5, 0),
+                      safihr::observation_policy_failure);
+
+    safihr::ObservationPolicy none, all, first, again, other;
+    none.set_sample(0.0, 1);
+    all.set_sample(1.0, 1);
+    first.set_sample(0.1, 1);
+    again.set_sample(0.1, 1);
+    other.set_sample(0.1, 2);
+
+    const unsigned int parcels = 100000;
+    unsigned int sampled = 0, differ = 0;
+    for (unsigned int id = 0; id != parcels; ++id) {
+        BOOST_REQUIRE(!none.observe(id, "BLE"));
+        BOOST_REQUIRE(all.observe(id, "BLE"));
+        BOOST_REQUIRE_EQUAL(first.observe(id, "BLE"),
+                            again.observe(id, "BLE"));
+        sampled += first.observe(id, "BLE");
+        differ += first.observe(id, "BLE") != other.observe(id, "BLE");
+    }
+
+    /* 10% of the parcels, with a standard deviation of 95 parcels. */
+    BOOST_CHECK_GT(sampled, 9700u);
+    BOOST_CHECK_LT(sampled, 10300u);
+    BOOST_CHECK_GT(differ, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(spsc_ring_is_bounded_and_ordered)
+{
+    safihr::SpscRing <int> ring(3);
+    int value;
+
+    BOOST_CHECK(ring.empty());
+    BOOST_CHECK(!ring.pop(value));
+
+    /* The capacity is rounded up to 4. */
+    for (int i = 0; i != 4; ++i)
+        BOOST_REQUIRE(ring.push(i));
+    BOOST_CHECK(ring.full());
+    BOOST_CHECK(!ring.push(4));
+
+    for (int round = 0; round != 3; ++round) {
+        BOOST_REQUIRE(ring.pop(value));
+        BOOST_CHECK_EQUAL(value, round);
+        BOOST_REQUIRE(ring.push(4 + round));
+    }
+
+    for (int i = 3; i != 7; ++i) {
+        BOOST_REQUIRE(ring.pop(value));
+        BOOST_CHECK_EQUAL(value, i);
+    }
+    BOOST_CHECK(ring.empty());
+}
+
+BOOST_AUTO_TEST_CASE(spsc_ring_passes_values_between_threads)
+{
+    const int count = 100000;
+    safihr::SpscRing <int> ring(16);
+
+    std::thread producer([&ring]()
+                         {
+                             for (int i = 0; i != count; ++i)
+                                 while (!ring.push(i))
+                                     std::this_thread::yield();
+                         });
+
+    int expected = 0, value;
+    while (expected != count) {
+        if (ring.pop(value))
+            BOOST_REQUIRE_EQUAL(value, expected++);
+        else
+            std::this_thread::yield();
+    }
+
+    producer.join();
+    BOOST_CHECK(ring.empty());
+}
+
+namespace {
+
+/* Read @e filepath with a PrefetchReader of @e capacity records and
+ * compare each record with the FileReader. The consumer sleeps on the
+ * first records so the reader waits with a full ring. */
+void check_prefetch(const std::string &filepath, std::size_t capacity)
+{
+    safihr::FileReader reference;
+    reference.open(filepath);
+    safihr::PrefetchReader reader(filepath, capacity);
+
+    for (unsigned long i = 0; reference.next(); ++i) {
+        if (i < 4)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        BOOST_REQUIRE(reader.next());
+        const safihr::WeatherDay &day = reader.current();
+        BOOST_REQUIRE_EQUAL(day.date, reference.m_date);
+        BOOST_REQUIRE_EQUAL(day.line, reference.m_line);
+        BOOST_REQUIRE_EQUAL(day.tmin, reference.m_tmin);
+        BOOST_REQUIRE_EQUAL(day.tmax, reference.m_tmax);
+        BOOST_REQUIRE_EQUAL(day.tmoy, reference.m_tmoy);
+    }
+
+    BOOST_CHECK(!reader.next());
+    BOOST_CHECK(!reader.next());
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_reader_equals_the_file_reader)
+{
+    const std::string filepath(std::string(SAFIHR_DATA_DIR) +
+                               "/luneray_temp-2000-2011.csv");
+
+    for (std::size_t capacity : { 0, 1, 2, 256 })
+        check_prefetch(filepath, capacity);
+
+    const std::string empty("core-prefetch-empty.csv");
+    write_file(empty, "Date;Tmin;Tmax;Tmoy\n");
+    for (std::size_t capacity : { 0, 2 })
+        check_prefetch(empty, capacity);
+    std::remove(empty.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_reader_stops_before_the_end)
+{
+    const std::string filepath(std::string(SAFIHR_DATA_DIR) +
+                               "/luneray_temp-1992-2011.csv");
+
+    /* Destroyed while the reader waits on a full ring, or before it
+     * started. */
+    {
+        safihr::PrefetchReader reader(filepath, 2);
+        BOOST_REQUIRE(reader.next());
+        BOOST_REQUIRE(reader.next());
+        BOOST_CHECK_EQUAL(reader.current().line, 3u);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    for (int i = 0; i != 100; ++i)
+        safihr::PrefetchReader reader(filepath, 2);
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_reader_passes_the_errors)
+{
+    BOOST_CHECK_THROW(safihr::PrefetchReader("core-prefetch-missing.csv"),
+                      safihr::file_generator_open);
+
+    const std::string filepath("core-prefetch-bad.csv");
+    write_file(filepath, "Date;Tmin;Tmax;Tmoy\n"
+               "01/01/1992;2.4;7.9;4.6\n"
+               "02/01/1992;4;7.9;5\n"
+               "03/01/1992;4;bad;5\n"
+               "04/01/1992;4;7.9;5\n");
+
+    for (std::size_t capacity : { 0, 1, 256 }) {
+        safihr::PrefetchReader reader(filepath, capacity);
+        BOOST_REQUIRE(reader.next());
+        BOOST_REQUIRE(reader.next());
+        BOOST_CHECK_EQUAL(reader.current().line, 3u);
+
+        try {
+            reader.next();
+            BOOST_ERROR("no format error with a capacity of " << capacity);
+        } catch (const safihr::file_generator_format &e) {
+            BOOST_CHECK_EQUAL(e.what(), std::string("fail to read line `4'"));
+        }
+    }
+
+    std::remove(filepath.c_str());
+}
+
+namespace {
+
+bool parse(const std::string &str, std::int32_t &jdn)
+{
+    return safihr::parse_date(str.data(), str.data() + str.size(), jdn);
+}
+
+bool valid(const std::string &str)
+{
+    std::int32_t jdn;
+    return parse(str, jdn);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(parse_date_reads_both_formats)
+{
+    const std::int32_t expected = safihr::julian_day_number(2002, 8, 5);
+    BOOST_CHECK_EQUAL(expected, 2452492);
+
+    for (const char *str : { "05/08/2002", "5/8/2002", "2002-08-05",
+                "2002-8-5" }) {
+        std::int32_t jdn = 0;
+        BOOST_CHECK_MESSAGE(parse(str, jdn), str);
+        BOOST_CHECK_EQUAL(jdn, expected);
+    }
+
+    for (const char *str : { "", "05/08", "05/08/02", "05-08-2002",
+                "2002/08/05", "05/08/2002 ", "05/08/2002;", "005/08/2002",
+                "2002-08-005", "+5/08/2002", "20020805" })
+        BOOST_CHECK_MESSAGE(!valid(str), str);
+}
+
+BOOST_AUTO_TEST_CASE(parse_date_checks_the_range_and_the_days)
+{
+    BOOST_CHECK(!valid("31/12/1399"));
+    BOOST_CHECK(valid("01/01/1400"));
+    BOOST_CHECK(valid("9999-12-31"));
+    BOOST_CHECK(!valid("01/01/10000"));
+    BOOST_CHECK(!valid("0999-12-31"));
+
+    BOOST_CHECK(!valid("31/02/2001"));
+    BOOST_CHECK(!valid("29/02/2001"));
+    BOOST_CHECK(valid("29/02/2004"));
+    BOOST_CHECK(!valid("29/02/1900"));
+    BOOST_CHECK(valid("29/02/2000"));
+    BOOST_CHECK(!valid("31/04/2001"));
+    BOOST_CHECK(!valid("00/01/2001"));
+    BOOST_CHECK(!valid("01/00/2001"));
+    BOOST_CHECK(!valid("01/13/2001"));
+    BOOST_CHECK(!valid("2001-02-30"));
+
+    /* Every day of a leap and a common year, through the gregorian
+     * date. */
+    for (std::int32_t jdn = safihr::julian_day_number(2003, 1, 1);
+         jdn != safihr::julian_day_number(2005, 1, 1); ++jdn) {
+        int year, month, day;
+        safihr::gregorian_date(jdn, year, month, day);
+        std::int32_t parsed = 0;
+        BOOST_REQUIRE(parse(std::to_string(day) + '/' +
+                            std::to_string(month) + '/' +
+                            std::to_string(year), parsed));
+        BOOST_REQUIRE_EQUAL(parsed, jdn);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(date_cache_survives_collisions)
+{
+    /* Two thousand dates for 256 slots: each slot is shared. */
+    std::vector <std::string> dates;
+    for (std::int32_t jdn = 2451911; jdn != 2451911 + 2000; ++jdn) {
+        int year, month, day;
+        safihr::gregorian_date(jdn, year, month, day);
+        dates.push_back(std::to_string(year) + '-' + std::to_string(month) +
+                        '-' + std::to_string(day));
+    }
+
+    safihr::DateCache cache;
+    for (int round = 0; round != 2; ++round)
+        for (std::size_t i = 0; i != dates.size(); ++i) {
+            const std::string &str = dates[i];
+            std::int32_t jdn = 0;
+            BOOST_REQUIRE(cache.parse(str.data(), str.data() + str.size(),
+                                      jdn));
+            BOOST_REQUIRE_EQUAL(jdn, static_cast <std::int32_t>(2451911 + i));
+
+            /* The same date again, from the cache. */
+            BOOST_REQUIRE(cache.parse(str.data(), str.data() + str.size(),
+                                      jdn));
+            BOOST_REQUIRE_EQUAL(jdn, static_cast <std::int32_t>(2451911 + i));
+        }
+
+    /* Invalid dates are never cached, long strings bypass the cache. */
+    const std::string bad("31/02/2001"), long_date("2002-08-05 12:00");
+    std::int32_t jdn = 0;
+    for (int round = 0; round != 2; ++round) {
+        BOOST_CHECK(!cache.parse(bad.data(), bad.data() + bad.size(), jdn));
+        BOOST_CHECK(!cache.parse(long_date.data(),
+                                 long_date.data() + long_date.size(), jdn));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(format_date_writes_unknown_days)
+{
+    BOOST_CHECK_EQUAL(safihr::format_date(std::int32_t(2452492)),
+                      "2002-Aug-05");
+    BOOST_CHECK_EQUAL(safihr::format_date(
+                          safihr::julian_day_number(1400, 1, 1)),
+                      "1400-Jan-01");
+    BOOST_CHECK_EQUAL(safihr::format_date(std::int32_t(-1)), "+infinity");
+    BOOST_CHECK_EQUAL(safihr::format_date(std::int32_t(-2452492)),
+                      "+infinity");
+
+    BOOST_CHECK_EQUAL(safihr::format_date(2452492.0), "2002-Aug-05");
+    BOOST_CHECK_EQUAL(safihr::format_date(-1.0), "+infinity");
+    BOOST_CHECK_EQUAL(safihr::format_date(
+                          std::numeric_limits <double>::infinity()),
+                      "+infinity");
+    BOOST_CHECK_EQUAL(safihr::format_date(
+                          -std::numeric_limits <double>::infinity()),
+                      "+infinity");
+    BOOST_CHECK_EQUAL(safihr::format_date(
+                          std::numeric_limits <double>::quiet_NaN()),
+                      "+infinity");
+}
+
+namespace {
+
+std::vector <double> observe(const safihr::PhenologyAggregates &phenology,
+                             const std::string &port)
+{
+    std::vector <double> values;
+    BOOST_REQUIRE_MESSAGE(phenology.observe(port, values), port);
+    return values;
+}
+
+double observe_one(const safihr::PhenologyAggregates &phenology,
+                   const std::string &port)
+{
+    std::vector <double> values = observe(phenology, port);
+    BOOST_REQUIRE_EQUAL(values.size(), 1u);
+    return values.front();
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(phenology_aggregates_follow_the_status_messages)
+{
+    using safihr::StatusModel;
+    using safihr::julian_day_number;
+
+    safihr::PhenologyAggregates phenology;
+    const std::uint16_t ble = phenology.add_specie("BLE");
+    const std::uint16_t colza = phenology.add_specie("COLZA");
+    BOOST_CHECK_EQUAL(phenology.add_specie("ORGE"), 2u);
+    BOOST_CHECK_EQUAL(phenology.add_specie("BLE"), ble);
+
+    const std::int32_t sow0 = julian_day_number(2001, 10, 10);
+    const std::int32_t sow1 = julian_day_number(2001, 10, 20);
+    const std::int32_t sow3 = julian_day_number(2001, 9, 1);
+    phenology.add_parcel(ble, sow0);
+    phenology.add_parcel(ble, sow1);
+    phenology.add_parcel(ble, sow1);
+    phenology.add_parcel(colza, sow3);
+    BOOST_CHECK_EQUAL(phenology.size(), 4u);
+
+    BOOST_CHECK(observe(phenology, "BLE") ==
+                std::vector <double>({ 3, 0, 0, 0, 0 }));
+
+    /* The parcel 2 is never sown. */
+    phenology.sow(0, sow0);
+    phenology.sow(1, sow1);
+    phenology.sow(3, sow3);
+    BOOST_CHECK(observe(phenology, "BLE") ==
+                std::vector <double>({ 1, 2, 0, 0, 0 }));
+
+    /* Emergence after 10 and 14 days, on the days 293 and 307. */
+    phenology.update(0, StatusModel::raised, sow0 + 10, sow0 + 11);
+    phenology.update(1, StatusModel::raised, sow1 + 14, sow1 + 15);
+    phenology.update(1, StatusModel::raised, sow1 + 14, sow1 + 16);
+
+    const std::int32_t harvest = julian_day_number(2002, 7, 20);
+    phenology.update(0, StatusModel::maturity, sow0 + 10, harvest);
+    phenology.update(0, StatusModel::maturity, sow0 + 10, harvest + 1);
+
+    /* The COLZA goes from sown to maturity in one message. */
+    phenology.update(3, StatusModel::maturity, sow3 + 20,
+                     julian_day_number(2002, 6, 1));
+
+    BOOST_CHECK(observe(phenology, "BLE") ==
+                std::vector <double>({ 1, 0, 1, 0, 1 }));
+    BOOST_CHECK_EQUAL(observe_one(phenology, "BLE.raised"), 1.0);
+    BOOST_CHECK_EQUAL(observe_one(phenology, "BLE.unavailable"), 1.0);
+    BOOST_CHECK_EQUAL(observe_one(phenology, "BLE.emergence-mean"), 12.0);
+    BOOST_CHECK_CLOSE(observe_one(phenology, "BLE.emergence-stddev"),
+                      std::sqrt(8.0), 1e-9);
+    BOOST_CHECK_EQUAL(observe_one(phenology, "BLE.maturity-mean"),
+                      harvest - sow0);
+    BOOST_CHECK_EQUAL(observe_one(phenology, "BLE.maturity-stddev"), 0.0);
+
+    /* The histograms give the quantiles of the days. */
+    std::vector <double> days = observe(phenology, "BLE.emergence-days");
+    BOOST_REQUIRE_EQUAL(days.size(), 366u);
+    BOOST_CHECK_EQUAL(days[292], 1.0);
+    BOOST_CHECK_EQUAL(days[306], 1.0);
+    BOOST_CHECK_EQUAL(std::accumulate(days.begin(), days.end(), 0.0), 2.0);
+
+    days = observe(phenology, "BLE.maturity-days");
+    BOOST_CHECK_EQUAL(days[200], 1.0);
+    BOOST_CHECK_EQUAL(std::accumulate(days.begin(), days.end(), 0.0), 1.0);
+
+    BOOST_CHECK(observe(phenology, "COLZA") ==
+                std::vector <double>({ 0, 0, 0, 0, 1 }));
+    BOOST_CHECK_EQUAL(observe_one(phenology, "COLZA.emergence-mean"), 20.0);
+
+    /* A harvested parcel is counted at maturity until sown again. */
+    phenology.sow(0, julian_day_number(2002, 10, 1));
+    BOOST_CHECK(observe(phenology, "BLE") ==
+                std::vector <double>({ 1, 1, 1, 0, 0 }));
+    BOOST_CHECK_EQUAL(observe_one(phenology, "BLE.maturity-mean"),
+                      harvest - sow0);
+
+    /* A specie without parcels. */
+    BOOST_CHECK(observe(phenology, "ORGE") ==
+                std::vector <double>({ 0, 0, 0, 0, 0 }));
+    BOOST_CHECK_EQUAL(observe_one(phenology, "ORGE.emergence-mean"), 0.0);
+    BOOST_CHECK_EQUAL(observe_one(phenology, "ORGE.maturity-stddev"), 0.0);
+    days = observe(phenology, "ORGE.maturity-days");
+    BOOST_CHECK_EQUAL(std::accumulate(days.begin(), days.end(), 0.0), 0.0);
+
+    std::vector <double> values;
+    BOOST_CHECK(!phenology.observe("MAIS", values));
+    BOOST_CHECK(!phenology.observe("MAIS.raised", values));
+    BOOST_CHECK(!phenology.observe("BLE.harvest", values));
+    BOOST_CHECK(!phenology.observe("BLE.", values));
+}
+
+BOOST_AUTO_TEST_CASE(metrics_report_at_the_last_detach)
+{
+    const std::string filepath("core-metrics.jsonl");
+    std::remove(filepath.c_str());
+    ::setenv("SAFIHR_METRICS", filepath.c_str(), 1);
+
+    {
+        safihr::Metrics metrics("Test");
+        BOOST_REQUIRE(metrics.enabled());
+
+        for (int round = 0; round != 2; ++round) {
+            metrics.attach();
+            metrics.attach();
+            metrics.internal_transition();
+            metrics.internal_transition();
+            metrics.external_transition();
+            metrics.events(3);
+            metrics.observation();
+            {
+                safihr::Metrics::Scope scope(metrics,
+                                             safihr::Metrics::compute);
+            }
+
+            /* Only the last detach writes the report. */
+            metrics.detach();
+            const std::string report = read_file(filepath);
+            BOOST_CHECK_EQUAL(std::count(report.begin(), report.end(), '\n'),
+                              round);
+            metrics.detach();
+        }
+    }
+
+    /* One line by experiment, the counters restart at zero. */
+    std::istringstream lines(read_file(filepath));
+    std::string line;
+    for (int round = 0; round != 2; ++round) {
+        BOOST_REQUIRE(std::getline(lines, line));
+        BOOST_CHECK_EQUAL(line.find("{\"dynamics\": \"Test\", "
+                                    "\"instances\": 2, "
+                                    "\"internal_transitions\": 2, "
+                                    "\"external_transitions\": 1, "
+                                    "\"events\": 3, \"observations\": 1, "
+                                    "\"parse_seconds\": 0, "
+                                    "\"compute_seconds\": "), 0u);
+        BOOST_CHECK_EQUAL(line.back(), '}');
+    }
+    BOOST_CHECK(!std::getline(lines, line));
+    std::remove(filepath.c_str());
+
+    /* `1' writes on the standard error, `0' disables the counters. */
+    ::setenv("SAFIHR_METRICS", "1", 1);
+    std::ostringstream err;
+    std::streambuf *previous = std::cerr.rdbuf(err.rdbuf());
+    {
+        safihr::Metrics metrics("Stderr");
+        metrics.attach();
+        metrics.events(5);
+        metrics.detach();
+    }
+    std::cerr.rdbuf(previous);
+    BOOST_CHECK_EQUAL(err.str().find("{\"dynamics\": \"Stderr\", "
+                                     "\"instances\": 1, "), 0u);
+    BOOST_CHECK(err.str().find("\"events\": 5, ") != std::string::npos);
+
+    ::setenv("SAFIHR_METRICS", "0", 1);
+    {
+        safihr::Metrics metrics("Disabled");
+        BOOST_CHECK(!metrics.enabled());
+        metrics.attach();
+        metrics.events(5);
+        metrics.detach();
+        BOOST_CHECK(metrics.json().find("\"events\": 0, ") !=
+                    std::string::npos);
+    }
+
+    ::unsetenv("SAFIHR_METRICS");
+}
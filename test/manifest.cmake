@@ -0,0 +1,65 @@
+##
+## The incremental runs (--manifest) after edits of the plan, of the
+## species and of --begin: each output must equal the output of a full
+## run on the same inputs.
+##
+## cmake -DCROPSIM=safihr-cropsim -DDATA=data -P manifest.cmake
+##
+
+set(options --weather ${DATA}/luneray_temp-1992-2011.csv --latitude 48.48
+  --threads 1)
+
+file(REMOVE simulation-outputs.csv simulation-outputs.manifest)
+
+function(cropsim)
+  execute_process(COMMAND ${CROPSIM} ${options} ${ARGN}
+    RESULT_VARIABLE status ERROR_VARIABLE log)
+  if (NOT status EQUAL 0)
+    message(FATAL_ERROR "safihr-cropsim ${ARGN} failed: ${log}")
+  endif ()
+  set(log "${log}" PARENT_SCOPE)
+endfunction()
+
+# Run incrementally with the inputs ${ARGN}, compare the output with a
+# full run and check the number of rows copied from the previous output.
+function(incremental reused)
+  cropsim(${ARGN} --output reference.csv)
+  cropsim(${ARGN} --output simulation-outputs.csv
+    --manifest simulation-outputs.manifest)
+
+  if (NOT log MATCHES " ${reused} from manifest")
+    message(FATAL_ERROR "${ARGN}: ${reused} rows expected from manifest: "
+      "${log}")
+  endif ()
+
+  execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files
+    simulation-outputs.csv reference.csv RESULT_VARIABLE status)
+  if (NOT status EQUAL 0)
+    message(FATAL_ERROR "${ARGN}: the incremental run differs from the "
+      "full run")
+  endif ()
+endfunction()
+
+# The edited inputs: the first sowing day of the first parcel, a new parcel
+# and the LEV_MAT of BLE.
+file(READ ${DATA}/date-semis-bourville-Aude.csv plan)
+file(WRITE plan.csv "${plan}")
+string(REPLACE "BLE;30;9;10/10/2001;05/08/2002;299"
+  "BLE;30;9;20/10/2001;05/08/2002;289" plan "${plan}")
+file(WRITE plan-edited.csv "${plan}BLE;12;400;25/10/2004;01/08/2005;280\n")
+
+file(READ ${DATA}/CULTURES.csv species)
+file(WRITE species.csv "${species}")
+string(REPLACE "\nBLE;275;375;150;1232;" "\nBLE;275;375;150;1300;"
+  species "${species}")
+file(WRITE species-edited.csv "${species}")
+
+incremental(0 --plan plan.csv --species species.csv --begin 2451911)
+incremental(274 --plan plan.csv --species species.csv --begin 2451911)
+incremental(273 --plan plan-edited.csv --species species.csv --begin 2451911)
+incremental(0 --plan plan-edited.csv --species species-edited.csv
+  --begin 2451911)
+incremental(0 --plan plan-edited.csv --species species-edited.csv
+  --begin 2451545)
+incremental(275 --plan plan-edited.csv --species species-edited.csv
+  --begin 2451545)
@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2014 INRA
+ *
+ * Gauthier Quesnel <gauthier.quesnel@toulouse.inra.fr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Golden output and timing regression of a scenario: run a command
+ * (safihr-cropsim or a VLE experiment), compare the files it produces
+ * with the checked-in golden files, numbers within a tolerance, and
+ * compare its wall time with the baseline of the scenario. The time of
+ * each run is appended to a record file.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Global.hpp"
+
+namespace {
+
+void usage()
+{
+    std::cout <<
+        "regression: golden output and timing test of a scenario\n\n"
+        "  regression [options] -- command [arguments]\n\n"
+        "  --name name          the scenario name\n"
+        "  --compare out golden compare the file out of the command to\n"
+        "                       the golden file (repeatable)\n"
+        "  --baseline file      the baseline wall times `name;seconds'\n"
+        "  --record file        append `name;seconds;baseline;ratio'\n"
+        "  --tolerance value    relative tolerance of the numbers [1e-9]\n"
+        "  --slowdown value     fail if the time exceeds the baseline by\n"
+        "                       this factor, 0 to only record the time\n"
+        "                       [3]\n"
+        "  --repetitions n      run the command n times, keep the best\n"
+        "                       time [3]\n"
+        "  --update             write the golden files and the baseline\n";
+}
+
+struct Options
+{
+    std::string name;
+    std::vector <std::pair <std::string, std::string> > compare;
+    std::vector <std::string> command;
+    std::string baseline;
+    std::string record;
+    double tolerance;
+    double slowdown;
+    long repetitions;
+    bool update;
+
+    Options()
+        : tolerance(1e-9), slowdown(3.0), repetitions(3), update(false)
+    {}
+};
+
+/* Times under this slack never fail: process start up is noisy. */
+const double time_slack = 0.05;
+
+bool parse(int argc, char *argv[], Options &opts)
+{
+    int i = 1;
+    for (; i < argc; ++i) {
+        std::string arg(argv[i]);
+
+        if (arg == "-h" || arg == "--help")
+            return false;
+
+        if (arg == "--") {
+            ++i;
+            break;
+        }
+
+        if (arg == "--update") {
+            opts.update = true;
+            continue;
+        }
+
+        if (arg == "--compare") {
+            if (i + 2 >= argc) {
+                std::cerr << "missing files for `--compare'\n";
+                return false;
+            }
+            opts.compare.emplace_back(argv[i + 1], argv[i + 2]);
+            i += 2;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for `" << arg << "'\n";
+            return false;
+        }
+
+        std::string value(argv[++i]);
+
+        if (arg == "--name")
+            opts.name = value;
+        else if (arg == "--baseline")
+            opts.baseline = value;
+        else if (arg == "--record")
+            opts.record = value;
+        else if (arg == "--tolerance")
+            opts.tolerance = safihr::stod(value);
+        else if (arg == "--slowdown")
+            opts.slowdown = safihr::stod(value);
+        else if (arg == "--repetitions")
+            opts.repetitions = std::max(1, safihr::stoi(value));
+        else {
+            std::cerr << "unknown option `" << arg << "'\n";
+            return false;
+        }
+    }
+
+    for (; i < argc; ++i)
+        opts.command.emplace_back(argv[i]);
+
+    if (opts.name.empty() || opts.command.empty()) {
+        std::cerr << "--name and a command are mandatory\n";
+        return false;
+    }
+
+    return true;
+}
+
+std::string quote(const std::string &arg)
+{
+    std::string ret("'");
+
+    for (char c : arg) {
+        if (c == '\'')
+            ret += "'\\''";
+        else
+            ret += c;
+    }
+
+    return ret + '\'';
+}
+
+/* Run the command, return its wall time in seconds. */
+double run(const std::vector <std::string> &command)
+{
+    std::string line;
+    for (const auto &arg : command)
+        line += (line.empty() ? "" : " ") + quote(arg);
+
+    auto start = std::chrono::steady_clock::now();
+    int status = std::system(line.c_str());
+    auto end = std::chrono::steady_clock::now();
+
+    if (status != 0)
+        throw std::runtime_error("command failed: " + line);
+
+    return std::chrono::duration <double>(end - start).count();
+}
+
+/* Fields of a line of a csv (`;') or of a VLE rdata (blanks) file. */
+std::vector <std::string> fields(const std::string &line)
+{
+    std::vector <std::string> ret;
+    std::string::size_type first = 0;
+
+    for (;;) {
+        std::string::size_type last = line.find_first_of(";\t \r", first);
+        ret.push_back(line.substr(first, last - first));
+        if (last == std::string::npos)
+            return ret;
+        first = last + 1;
+    }
+}
+
+bool number(const std::string &str, double &value)
+{
+    char *end = nullptr;
+
+    value = std::strtod(str.c_str(), &end);
+    return !str.empty() && end == str.c_str() + str.size();
+}
+
+bool same_field(const std::string &lhs, const std::string &rhs,
+                double tolerance)
+{
+    double a, b;
+
+    if (lhs == rhs)
+        return true;
+
+    if (!number(lhs, a) || !number(rhs, b))
+        return false;
+
+    return std::abs(a - b) <= tolerance * std::max(1.0, std::max(
+                                                       std::abs(a),
+                                                       std::abs(b)));
+}
+
+/**
+ * Compare the file @e output with @e golden, line by line and field by
+ * field. Report the first differences, return their number.
+ */
+std::size_t compare(const std::string &output, const std::string &golden,
+                    double tolerance)
+{
+    std::ifstream out(output), gold(golden);
+    if (!out.is_open())
+        throw std::runtime_error("can not open `" + output + "'");
+    if (!gold.is_open())
+        throw std::runtime_error("no golden file `" + golden +
+                                 "' (record it with --update)");
+
+    const std::size_t max_report = 10;
+    std::size_t differ = 0, id = 0;
+    std::string lhs, rhs;
+
+    for (;;) {
+        bool has_lhs = static_cast <bool>(std::getline(out, lhs));
+        bool has_rhs = static_cast <bool>(std::getline(gold, rhs));
+        ++id;
+
+        if (!has_lhs && !has_rhs)
+            break;
+
+        if (has_lhs != has_rhs) {
+            std::cerr << output << ": " << (has_lhs ? "more" : "less")
+                      << " lines than " << golden << " from line " << id
+                      << '\n';
+            return differ + 1;
+        }
+
+        std::vector <std::string> a = fields(lhs), b = fields(rhs);
+        bool same = a.size() == b.size();
+        for (std::size_t i = 0; same && i != a.size(); ++i)
+            same = same_field(a[i], b[i], tolerance);
+
+        if (!same && differ++ < max_report)
+            std::cerr << output << ':' << id << ": `" << lhs
+                      << "' instead of `" << rhs << "'\n";
+    }
+
+    return differ;
+}
+
+void copy(const std::string &from, const std::string &to)
+{
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+
+    if (!in.is_open() || !out.is_open() || !(out << in.rdbuf()))
+        throw std::runtime_error("can not copy `" + from + "' to `" + to +
+                                 "'");
+}
+
+std::map <std::string, double> read_baseline(const std::string &filepath)
+{
+    std::map <std::string, double> ret;
+    std::ifstream file(filepath);
+    std::string line;
+
+    while (std::getline(file, line)) {
+        std::string::size_type pos = line.find(';');
+        if (line.empty() || line[0] == '#' || pos == std::string::npos)
+            continue;
+
+        ret[line.substr(0, pos)] = safihr::stod(line.substr(pos + 1));
+    }
+
+    return ret;
+}
+
+void write_baseline(const std::string &filepath,
+                    const std::map <std::string, double> &baseline)
+{
+    std::ofstream file(filepath, std::ios::out | std::ios::trunc);
+    if (!file.is_open())
+        throw std::runtime_error("can not write `" + filepath + "'");
+
+    file << "# scenario;wall time in seconds (regression --update)\n";
+    for (const auto &entry : baseline)
+        file << entry.first << ';' << entry.second << '\n';
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+
+    if (!parse(argc, argv, opts)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        double seconds = run(opts.command);
+        for (long i = 1; i < opts.repetitions; ++i)
+            seconds = std::min(seconds, run(opts.command));
+
+        std::size_t differ = 0;
+        for (const auto &files : opts.compare) {
+            if (opts.update)
+                copy(files.first, files.second);
+            else
+                differ += compare(files.first, files.second, opts.tolerance);
+        }
+
+        std::map <std::string, double> baseline;
+        if (!opts.baseline.empty())
+            baseline = read_baseline(opts.baseline);
+
+        if (opts.update && !opts.baseline.empty()) {
+            baseline[opts.name] = seconds;
+            write_baseline(opts.baseline, baseline);
+        }
+
+        auto found = baseline.find(opts.name);
+        double reference = found == baseline.end() ? 0.0 : found->second;
+        double ratio = reference > 0.0 ? seconds / reference : 0.0;
+
+        std::cout << opts.name << ": " << seconds << "s";
+        if (reference > 0.0)
+            std::cout << " (baseline " << reference << "s, x" << ratio
+                      << ")";
+        std::cout << ", " << differ << " different lines\n";
+
+        if (!opts.record.empty()) {
+            std::ofstream record(opts.record, std::ios::app);
+            record << opts.name << ';' << seconds << ';' << reference << ';'
+                   << ratio << '\n';
+        }
+
+        if (differ)
+            return EXIT_FAILURE;
+
+        if (opts.slowdown > 0.0 && reference > 0.0 &&
+            seconds > reference * opts.slowdown + time_slack) {
+            std::cerr << opts.name << ": slower than " << opts.slowdown
+                      << " x the baseline\n";
+            return EXIT_FAILURE;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "regression: " << opts.name << ": " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+##
+## A run split by safihr-shard must give the file of an unsharded run,
+## with empty shards too, and SAFIHR_SHARD is ignored without
+## --shard environment.
+##
+## cmake -DSHARD=safihr-shard -DCROPSIM=safihr-cropsim -DDATA=data
+##       -P shard.cmake
+##
+
+set(options --weather ${DATA}/luneray_temp-1992-2011.csv --latitude 48.48
+  --begin 2451911 --threads 1)
+
+file(GLOB files *.csv*)
+if (files)
+  file(REMOVE ${files})
+endif ()
+
+function(same lhs rhs)
+  execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${lhs} ${rhs}
+    RESULT_VARIABLE status)
+  if (NOT status EQUAL 0)
+    message(FATAL_ERROR "${lhs} and ${rhs} differ")
+  endif ()
+endfunction()
+
+# Run @e plan as @e shards processes into @e name.csv and compare it
+# with an unsharded run.
+function(sharded name plan shards)
+  execute_process(COMMAND ${CROPSIM} ${options} --plan ${plan}
+    --output ${name}-reference.csv
+    RESULT_VARIABLE status ERROR_VARIABLE log)
+  if (NOT status EQUAL 0)
+    message(FATAL_ERROR "safihr-cropsim failed: ${log}")
+  endif ()
+
+  execute_process(COMMAND ${SHARD} --shards ${shards} --jobs ${shards} --keep
+    --output ${name}.csv -- ${CROPSIM} ${options} --plan ${plan}
+    --output ${name}.csv --shard environment
+    RESULT_VARIABLE status ERROR_VARIABLE log)
+  if (NOT status EQUAL 0)
+    message(FATAL_ERROR "safihr-shard failed: ${log}")
+  endif ()
+
+  math(EXPR last "${shards} - 1")
+  foreach (shard RANGE ${last})
+    if (NOT EXISTS ${name}.csv.${shard}-of-${shards})
+      message(FATAL_ERROR "the shard ${shard} did not write its file")
+    endif ()
+  endforeach ()
+
+  same(${name}.csv ${name}-reference.csv)
+endfunction()
+
+sharded(aude ${DATA}/date-semis-bourville-Aude.csv 3)
+
+# Two parcels in four shards: the shards 2 and 3 are empty.
+file(READ ${DATA}/date-semis-bourville-Aude.csv plan)
+string(REGEX MATCH "^[^\n]*\n[^\n]*\n[^\n]*\n" plan "${plan}")
+file(WRITE small-plan.csv "${plan}")
+sharded(small small-plan.csv 4)
+
+# An inherited SAFIHR_SHARD is not a request to shard.
+execute_process(COMMAND ${CMAKE_COMMAND} -E env SAFIHR_SHARD=1/3
+  ${CROPSIM} ${options} --plan ${DATA}/date-semis-bourville-Aude.csv
+  --output inherited.csv RESULT_VARIABLE status ERROR_VARIABLE log)
+if (NOT status EQUAL 0 OR EXISTS inherited.csv.1-of-3)
+  message(FATAL_ERROR "SAFIHR_SHARD was not ignored: ${log}")
+endif ()
+same(inherited.csv aude-reference.csv)
@@ -0,0 +1,47 @@
+##
+## The result store across runs with different --begin: the rows read
+## from the store must equal the rows of runs without store.
+##
+## cmake -DCROPSIM=safihr-cropsim -DDATA=data -P store.cmake
+##
+
+set(options --weather ${DATA}/luneray_temp-1992-2011.csv
+  --plan ${DATA}/date-semis-bourville-Aude.csv --latitude 48.48
+  --threads 1)
+
+file(REMOVE store.db)
+
+function(cropsim output)
+  execute_process(COMMAND ${CROPSIM} ${options} ${ARGN} --output ${output}
+    RESULT_VARIABLE status ERROR_VARIABLE log)
+  if (NOT status EQUAL 0)
+    message(FATAL_ERROR "safihr-cropsim ${ARGN} failed: ${log}")
+  endif ()
+  set(log "${log}" PARENT_SCOPE)
+endfunction()
+
+function(same lhs rhs)
+  execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${lhs} ${rhs}
+    RESULT_VARIABLE status)
+  if (NOT status EQUAL 0)
+    message(FATAL_ERROR "${lhs} and ${rhs} differ")
+  endif ()
+endfunction()
+
+foreach (begin 2451911 2451545)
+  cropsim(reference-${begin}.csv --begin ${begin})
+endforeach ()
+
+# Fill the store from the first period then run the second one and the
+# first one again.
+cropsim(store-2451911.csv --begin 2451911 --store store.db)
+cropsim(store-2451545.csv --begin 2451545 --store store.db)
+cropsim(again-2451911.csv --begin 2451911 --store store.db)
+
+if (NOT log MATCHES "[1-9][0-9]* from store")
+  message(FATAL_ERROR "the second run of 2451911 did not use the store")
+endif ()
+
+same(store-2451911.csv reference-2451911.csv)
+same(store-2451545.csv reference-2451545.csv)
+same(again-2451911.csv reference-2451911.csv)